@@ -0,0 +1,68 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_ARENA_HPP__
+#define __COUCH_DB_ARENA_HPP__
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Bump allocator for trees that live and die together. Memory is handed out
+// from large chunks and only returned, all at once, when the arena is
+// destroyed; nothing allocated from it has its destructor run.
+class COUCHDB_API Arena : private boost::noncopyable
+{
+public:
+    Arena(size_t firstChunk = 4096);
+    ~Arena();
+
+    // returns storage aligned for any JSON value
+    void* allocate(size_t bytes)
+    {
+        bytes = (bytes + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+        if((size_t)(limit - cursor) < bytes)
+            return allocateChunk(bytes);
+
+        void *block = cursor;
+        cursor += bytes;
+        return block;
+    }
+
+    // bytes obtained from the system so far
+    size_t getReserved() const;
+
+private:
+    enum { ALIGNMENT = 8 };
+
+    struct Chunk;
+
+    void* allocateChunk(size_t);
+
+    Chunk  *chunks;
+    char   *cursor;
+    char   *limit;
+    size_t nextChunk;
+    size_t reserved;
+};
+
+} //namespace CouchDB
+
+#endif
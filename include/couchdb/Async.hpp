@@ -0,0 +1,112 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_ASYNC_HPP__
+#define __COUCH_DB_ASYNC_HPP__
+
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/future.hpp>
+
+#include <exception>
+#include <string>
+
+#include "couchdb/Exception.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Response of an asynchronous request, as handed over by the I/O thread.
+struct COUCHDB_API AsyncResponse
+{
+    AsyncResponse();
+
+    // throws Exception if the transfer itself failed
+    void check() const;
+
+    std::string url;
+    std::string error;  // empty unless the transfer failed
+    long        status;
+    std::string body;
+};
+
+// Runs on the I/O thread when a response is complete. It must not block,
+// since every other transfer waits for it; exceptions it throws are dropped.
+typedef boost::function<void (AsyncResponse&)> AsyncHandler;
+
+// Types of the asynchronous calls: each returns a Future, and the variants
+// taking a Callback also pass it the future once it is ready (on the I/O
+// thread, so again without blocking). get() on the future returns the
+// result or throws the Exception the blocking call would have thrown.
+template<typename T>
+struct Async
+{
+    typedef boost::shared_future<T>             Future;
+    typedef boost::function<void (Future)>      Callback;
+    typedef boost::function<T (AsyncResponse&)> Decoder;
+};
+
+// Turns a response into the result of a future; used as the AsyncHandler
+// of the typed asynchronous calls.
+template<typename T>
+class AsyncCompletion
+{
+public:
+    AsyncCompletion(const typename Async<T>::Decoder &_decode,
+            const typename Async<T>::Callback &_callback)
+        : promise(boost::make_shared<boost::promise<T> >())
+        , future(promise->get_future())
+        , decode(_decode)
+        , callback(_callback)
+    {
+    }
+
+    typename Async<T>::Future getFuture() const
+    {
+        return future;
+    }
+
+    void operator()(AsyncResponse &response)
+    {
+        try
+        {
+            promise->set_value(decode(response));
+        }
+        catch(const Exception &e)
+        {
+            promise->set_exception(boost::copy_exception(e));
+        }
+        catch(const std::exception &e)
+        {
+            promise->set_exception(boost::copy_exception(Exception(e.what())));
+        }
+
+        if(callback)
+            callback(future);
+    }
+
+private:
+    boost::shared_ptr<boost::promise<T> > promise;
+    typename Async<T>::Future             future;
+    typename Async<T>::Decoder            decode;
+    typename Async<T>::Callback           callback;
+};
+
+} //namespace CouchDB
+
+#endif
@@ -45,7 +45,14 @@ public:
 
     std::string getData();
 
+    // Same, read into the buffer, which maps a large attachment rather
+    // than hold it in memory (see Communication::setSpillThreshold).
+    // Throws Exception if the attachment cannot be read.
+    void getData(ResponseBuffer&);
+
 private:
+    std::string getURL() const;
+
     Communication &comm;
     std::string   db;
     std::string   document;
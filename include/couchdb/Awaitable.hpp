@@ -0,0 +1,180 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_AWAITABLE_HPP__
+#define __COUCH_DB_AWAITABLE_HPP__
+
+// Coroutine versions of the asynchronous calls, for Boost.Asio programs
+// built as C++20; the library itself does not need them. With the
+// Connection or Communication set to the program's io_context, a request
+// suspends the coroutine without blocking a thread and resumes it on its
+// own executor once the response is in:
+//
+//     boost::asio::io_context io;
+//     CouchDB::Connection conn(io);
+//     CouchDB::Database db = conn.getDatabase("db");
+//     ...
+//     CouchDB::Document doc = co_await CouchDB::Await::getDocument(db, id);
+//
+// The objects passed in must stay alive until the call has completed.
+
+#if !defined(__cpp_impl_coroutine) && !defined(__cpp_coroutines)
+#error "couchdb/Awaitable.hpp requires C++20 coroutines"
+#endif
+
+// before Asio: awaitable.hpp uses std::exchange without including it
+#include <utility>
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/function.hpp>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "couchdb/Connection.hpp"
+
+namespace CouchDB
+{
+namespace Await
+{
+
+// Makes an asynchronous call with the callback given.
+template<typename T>
+struct Starter
+{
+    typedef boost::function<void (const typename Async<T>::Callback&)> Type;
+};
+
+// Hands the result to the awaiting coroutine. It is resumed through its
+// own executor, never from inside curl, which it may well call again.
+template<typename T, typename Handler>
+class Resume
+{
+public:
+    explicit Resume(Handler &&handler)
+        : shared(std::make_shared<Handler>(std::move(handler)))
+    {
+    }
+
+    void operator()(typename Async<T>::Future ready) const
+    {
+        std::shared_ptr<Handler> handler = shared;
+        boost::asio::post(boost::asio::get_associated_executor(*handler),
+                [handler, ready]() { (*handler)(ready); });
+    }
+
+private:
+    std::shared_ptr<Handler> shared;
+};
+
+template<typename T>
+struct Initiation
+{
+    typename Starter<T>::Type start;
+
+    template<typename Handler>
+    void operator()(Handler &&handler) const
+    {
+        start(Resume<T, typename std::decay<Handler>::type>(std::move(handler)));
+    }
+};
+
+template<typename T>
+boost::asio::awaitable<typename Async<T>::Future>
+initiate(const typename Starter<T>::Type &start)
+{
+    Initiation<T> initiation = { start };
+    return boost::asio::async_initiate<const boost::asio::use_awaitable_t<>&,
+            void (typename Async<T>::Future)>(initiation, boost::asio::use_awaitable);
+}
+
+// Awaits an asynchronous call and returns its result, or rethrows the
+// Exception it failed with.
+template<typename T>
+boost::asio::awaitable<T> call(typename Starter<T>::Type start)
+{
+    typename Async<T>::Future future = co_await initiate<T>(start);
+    co_return future.get();
+}
+
+inline boost::asio::awaitable<std::vector<std::string> >
+listDatabases(Connection &conn)
+{
+    return call<std::vector<std::string> >(
+        [&conn](const Async<std::vector<std::string> >::Callback &callback)
+        { conn.listDatabasesAsync(callback); });
+}
+
+inline boost::asio::awaitable<bool>
+createDatabase(Connection &conn, const std::string &db)
+{
+    return call<bool>([&conn, db](const Async<bool>::Callback &callback)
+        { conn.createDatabaseAsync(db, callback); });
+}
+
+inline boost::asio::awaitable<bool>
+deleteDatabase(Connection &conn, const std::string &db)
+{
+    return call<bool>([&conn, db](const Async<bool>::Callback &callback)
+        { conn.deleteDatabaseAsync(db, callback); });
+}
+
+inline boost::asio::awaitable<Document>
+getDocument(Database &db, const std::string &id, const std::string &rev = "")
+{
+    return call<Document>([&db, id, rev](const Async<Document>::Callback &callback)
+        { db.getDocumentAsync(id, rev, callback); });
+}
+
+inline boost::asio::awaitable<Document>
+createDocument(Database &db, const Variant &data, const std::string &id = "")
+{
+    return call<Document>([&db, data, id](const Async<Document>::Callback &callback)
+        { db.createDocumentAsync(data, id, callback); });
+}
+
+inline boost::asio::awaitable<Variant> getData(Document &doc)
+{
+    return call<Variant>([&doc](const Async<Variant>::Callback &callback)
+        { doc.getDataAsync(callback); });
+}
+
+inline boost::asio::awaitable<Variant> getData(Communication &comm,
+        const std::string &url, const std::string &method = "GET",
+        const std::string &data = "")
+{
+    return call<Variant>([&comm, url, method, data](const Async<Variant>::Callback &callback)
+        { comm.getDataAsync(url, method, data, callback); });
+}
+
+inline boost::asio::awaitable<std::string> getRawData(Communication &comm,
+        const std::string &url, const std::string &method = "GET",
+        const std::string &data = "")
+{
+    return call<std::string>([&comm, url, method, data](const Async<std::string>::Callback &callback)
+        { comm.getRawDataAsync(url, method, data, callback); });
+}
+
+} //namespace Await
+} //namespace CouchDB
+
+#endif
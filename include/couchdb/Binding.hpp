@@ -0,0 +1,465 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_BINDING_HPP__
+#define __COUCH_DB_BINDING_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/optional.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <boost/type_traits/is_floating_point.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "couchdb/Exception.hpp"
+#include "couchdb/Value.hpp"
+#include "couchdb/Variant.hpp"
+#include "couchdb/Writer.hpp"
+#include "couchdb/export.hpp"
+
+// Typed binding between C++ structs and JSON. A struct is made bindable by
+// listing its members once, at global scope:
+//
+//    struct Record
+//    {
+//       int         key;
+//       std::string value;
+//       double      dValue;
+//    };
+//    COUCHDB_FIELDS(Record, (key)(value)(dValue))
+//
+// after which fromJSON<Record>() decodes response bytes straight into the
+// struct and toJSON() writes it back out, without an intermediate tree.
+// Members may be bools, numbers, strings, Value, Variant, boost::optional,
+// std::vector, std::map with string keys or other bound structs. Members
+// missing from the JSON keep their value, unknown members are skipped.
+
+#define COUCHDB_VISIT_FIELD(r, object, field) \
+    visitor(BOOST_PP_STRINGIZE(field), object.field);
+
+#define COUCHDB_FIELDS(Type, fields)                                       \
+    namespace CouchDB {                                                    \
+    template<>                                                             \
+    struct JSONFields<Type>                                                \
+    {                                                                      \
+        static const bool defined = true;                                  \
+                                                                           \
+        template<typename Self, typename Visitor>                          \
+        static void visit(Self &object, Visitor &visitor)                  \
+        {                                                                  \
+            BOOST_PP_SEQ_FOR_EACH(COUCHDB_VISIT_FIELD, object, fields)     \
+        }                                                                  \
+    };                                                                     \
+    }
+
+namespace CouchDB
+{
+
+// Specialized by COUCHDB_FIELDS.
+template<typename T>
+struct JSONFields
+{
+    static const bool defined = false;
+};
+
+// Reading position in a JSON text; every read throws Exception if the
+// input does not hold what is asked for.
+class COUCHDB_API JSONCursor
+{
+public:
+    JSONCursor(const char*, size_t);
+
+    // next non-space character, 0 at the end of the input
+    char peek();
+    // consumes the character if it is next
+    bool consume(char);
+    void expect(char);
+    // throws unless only white space is left
+    void finish();
+
+    bool readNull();  // consumes a null if it is next
+    bool readBoolean();
+    ::boost::int64_t readInteger();
+    // the full unsigned range, past what readInteger() takes
+    ::boost::uint64_t readUnsigned();
+    double readReal();
+    void readString(std::string&);
+    Value readValue();
+    Variant readVariant();
+    // name of the next object member and its colon
+    boost::string_view readKey();
+    void skip();
+
+    void fail(const char *expected);
+
+private:
+    const char  *start;
+    const char  *cur;
+    const char  *end;
+    std::string scratch;
+};
+
+// ---[ BINDINGS ]---------------------------------------------------------------
+
+template<typename T, typename Enable = void>
+struct JSONBinding;
+
+template<>
+struct JSONBinding<bool>
+{
+    static void read(JSONCursor &in, bool &value)
+    {
+        value = in.readBoolean();
+    }
+
+    static void write(bool value, std::string &out)
+    {
+        out += value ? "true" : "false";
+    }
+};
+
+template<typename T>
+struct JSONBinding<T, typename boost::enable_if_c<boost::is_integral<T>::value &&
+        std::numeric_limits<T>::is_signed>::type>
+{
+    static void read(JSONCursor &in, T &value)
+    {
+        ::boost::int64_t integer = in.readInteger();
+        if(sizeof(T) < sizeof(integer) &&
+           (integer < (::boost::int64_t)std::numeric_limits<T>::min() ||
+            integer > (::boost::int64_t)std::numeric_limits<T>::max()))
+            in.fail("an integer in range");
+        value = (T)integer;
+    }
+
+    static void write(T value, std::string &out)
+    {
+        writeJSONNumber((::boost::int64_t)value, out);
+    }
+};
+
+template<typename T>
+struct JSONBinding<T, typename boost::enable_if_c<boost::is_integral<T>::value &&
+        !std::numeric_limits<T>::is_signed && !boost::is_same<T, bool>::value>::type>
+{
+    static void read(JSONCursor &in, T &value)
+    {
+        ::boost::uint64_t integer = in.readUnsigned();
+        if(sizeof(T) < sizeof(integer) &&
+           integer > (::boost::uint64_t)std::numeric_limits<T>::max())
+            in.fail("an integer in range");
+        value = (T)integer;
+    }
+
+    static void write(T value, std::string &out)
+    {
+        writeJSONNumber((::boost::uint64_t)value, out);
+    }
+};
+
+template<typename T>
+struct JSONBinding<T, typename boost::enable_if<boost::is_floating_point<T> >::type>
+{
+    static void read(JSONCursor &in, T &value)
+    {
+        value = (T)in.readReal();
+    }
+
+    static void write(T value, std::string &out)
+    {
+        writeJSONNumber((double)value, out);
+    }
+};
+
+template<>
+struct JSONBinding<std::string>
+{
+    static void read(JSONCursor &in, std::string &value)
+    {
+        in.readString(value);
+    }
+
+    static void write(const std::string &value, std::string &out)
+    {
+        writeJSONString(value, out);
+    }
+};
+
+template<>
+struct JSONBinding<Value>
+{
+    static void read(JSONCursor &in, Value &value)
+    {
+        value = in.readValue();
+    }
+
+    static void write(const Value &value, std::string &out)
+    {
+        writeJSON(value, out);
+    }
+};
+
+template<>
+struct JSONBinding<Variant>
+{
+    static void read(JSONCursor &in, Variant &value)
+    {
+        value = in.readVariant();
+    }
+
+    static void write(const Variant &value, std::string &out)
+    {
+        writeJSON(value, out);
+    }
+};
+
+template<typename T>
+struct JSONBinding<boost::optional<T> >
+{
+    static void read(JSONCursor &in, boost::optional<T> &value)
+    {
+        if(in.readNull())
+        {
+            value = boost::none;
+            return;
+        }
+        if(!value)
+            value = T();
+        JSONBinding<T>::read(in, *value);
+    }
+
+    static void write(const boost::optional<T> &value, std::string &out)
+    {
+        if(value)
+            JSONBinding<T>::write(*value, out);
+        else
+            out += "null";
+    }
+};
+
+template<typename T, typename Allocator>
+struct JSONBinding<std::vector<T, Allocator> >
+{
+    static void read(JSONCursor &in, std::vector<T, Allocator> &value)
+    {
+        value.clear();
+        in.expect('[');
+        if(in.consume(']'))
+            return;
+
+        do
+        {
+            value.push_back(T());
+            JSONBinding<T>::read(in, value.back());
+        }
+        while(in.consume(','));
+        in.expect(']');
+    }
+
+    static void write(const std::vector<T, Allocator> &value, std::string &out)
+    {
+        out += '[';
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+            if(i > 0)
+                out += ',';
+            JSONBinding<T>::write(value[i], out);
+        }
+        out += ']';
+    }
+};
+
+template<typename T, typename Compare, typename Allocator>
+struct JSONBinding<std::map<std::string, T, Compare, Allocator> >
+{
+    typedef std::map<std::string, T, Compare, Allocator> Map;
+
+    static void read(JSONCursor &in, Map &value)
+    {
+        value.clear();
+        in.expect('{');
+        if(in.consume('}'))
+            return;
+
+        do
+        {
+            boost::string_view key = in.readKey();
+            JSONBinding<T>::read(in, value[std::string(key.data(), key.size())]);
+        }
+        while(in.consume(','));
+        in.expect('}');
+    }
+
+    static void write(const Map &value, std::string &out)
+    {
+        out += '{';
+        typename Map::const_iterator member = value.begin();
+        const typename Map::const_iterator &memberEnd = value.end();
+        for(; member != memberEnd; ++member)
+        {
+            if(member != value.begin())
+                out += ',';
+            writeJSONString(member->first, out);
+            out += ':';
+            JSONBinding<T>::write(member->second, out);
+        }
+        out += '}';
+    }
+};
+
+// ---[ STRUCTS ]----------------------------------------------------------------
+
+// Reads the member named `key` into the field of the same name, if any.
+class JSONFieldReader
+{
+public:
+    JSONFieldReader(JSONCursor &_in, const boost::string_view &_key)
+        : in(_in), key(_key), matched(false)
+    {
+    }
+
+    template<typename T>
+    void operator()(const char *name, T &field)
+    {
+        if(!matched && key == name)
+        {
+            JSONBinding<T>::read(in, field);
+            matched = true;
+        }
+    }
+
+    bool isMatched() const
+    {
+        return matched;
+    }
+
+private:
+    JSONCursor         &in;
+    boost::string_view key;
+    bool               matched;
+};
+
+// Writes every field as an object member; absent optionals are left out.
+class JSONFieldWriter
+{
+public:
+    JSONFieldWriter(std::string &_out) : out(_out), first(true)
+    {
+    }
+
+    template<typename T>
+    void operator()(const char *name, const T &field)
+    {
+        writeName(name);
+        JSONBinding<T>::write(field, out);
+    }
+
+    template<typename T>
+    void operator()(const char *name, const boost::optional<T> &field)
+    {
+        if(!field)
+            return;
+        writeName(name);
+        JSONBinding<T>::write(*field, out);
+    }
+
+private:
+    void writeName(const char *name)
+    {
+        if(!first)
+            out += ',';
+        first = false;
+        writeJSONString(name, std::char_traits<char>::length(name), out);
+        out += ':';
+    }
+
+    std::string &out;
+    bool        first;
+};
+
+template<typename T>
+struct JSONBinding<T, typename boost::enable_if_c<JSONFields<T>::defined>::type>
+{
+    static void read(JSONCursor &in, T &value)
+    {
+        in.expect('{');
+        if(in.consume('}'))
+            return;
+
+        do
+        {
+            JSONFieldReader reader(in, in.readKey());
+            JSONFields<T>::visit(value, reader);
+            if(!reader.isMatched())
+                in.skip();
+        }
+        while(in.consume(','));
+        in.expect('}');
+    }
+
+    static void write(const T &value, std::string &out)
+    {
+        JSONFieldWriter writer(out);
+        out += '{';
+        JSONFields<T>::visit(value, writer);
+        out += '}';
+    }
+};
+
+// ---[ ENTRY POINTS ]-----------------------------------------------------------
+
+template<typename T>
+void fromJSON(const char *data, size_t size, T &value)
+{
+    JSONCursor in(data, size);
+    JSONBinding<T>::read(in, value);
+    in.finish();
+}
+
+template<typename T>
+T fromJSON(const std::string &data)
+{
+    T value = T();
+    fromJSON(data.data(), data.size(), value);
+    return value;
+}
+
+// appends to `out`, like writeJSON()
+template<typename T>
+void writeJSONAs(const T &value, std::string &out)
+{
+    JSONBinding<T>::write(value, out);
+}
+
+template<typename T>
+typename boost::enable_if_c<JSONFields<T>::defined, std::string>::type
+toJSON(const T &value)
+{
+    std::string out;
+    writeJSONAs(value, out);
+    return out;
+}
+
+} //namespace CouchDB
+
+#endif
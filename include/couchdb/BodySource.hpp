@@ -0,0 +1,139 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_BODY_SOURCE_HPP__
+#define __COUCH_DB_BODY_SOURCE_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <fstream>
+#include <string>
+
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Request body handed to libcurl piece by piece as it is sent, so that it
+// never has to be copied or held in memory as a whole. A source is read
+// from its start; it is only rewound when a request has to be sent again,
+// e.g. on a redirect.
+class COUCHDB_API BodySource
+{
+public:
+    // size() of a body whose length is only known once it has been read;
+    // it is sent with chunked transfer encoding
+    static const ::boost::uint64_t UNKNOWN_SIZE = ~(::boost::uint64_t)0;
+
+    virtual ~BodySource();
+
+    // length of the whole body in bytes, or UNKNOWN_SIZE
+    virtual ::boost::uint64_t size() const = 0;
+
+    // Copies up to `length` bytes from the current position and moves past
+    // them; returns the number copied, 0 at the end. Throwing aborts the
+    // request.
+    virtual size_t read(char *buffer, size_t length) = 0;
+
+    // Moves to `offset` from the start. Returns false if the source cannot
+    // go back, which fails a request that has to be resent.
+    virtual bool seek(::boost::uint64_t offset) = 0;
+};
+
+// Cursor over memory owned by the caller, which must outlive the request.
+class COUCHDB_API MemorySource : public BodySource
+{
+public:
+    MemorySource();
+    MemorySource(const char*, size_t);
+    explicit MemorySource(const std::string&);
+
+    ::boost::uint64_t size() const;
+    size_t read(char*, size_t);
+    bool seek(::boost::uint64_t);
+
+private:
+    const char *data;
+    size_t     length;
+    size_t     position;
+};
+
+// Contents of a file, mapped into memory where the platform allows and
+// read in chunks otherwise.
+class COUCHDB_API FileSource : public BodySource, boost::noncopyable
+{
+public:
+    // Throws Exception if the file cannot be opened.
+    explicit FileSource(const std::string &path);
+    ~FileSource();
+
+    ::boost::uint64_t size() const;
+
+    // Throws Exception if the file cannot be read.
+    size_t read(char*, size_t);
+    bool seek(::boost::uint64_t);
+
+private:
+    std::string       path;
+    ::boost::uint64_t length;
+    ::boost::uint64_t position;
+    const char        *mapped;
+    std::ifstream     file;
+};
+
+// Body of a _bulk_docs request, {"docs":[...]}, serialized while it is
+// sent: the generator is only asked for a document once curl wants more
+// data, so writing overlaps sending and memory stays bounded by the largest
+// document however large the batch is. Cannot be rewound.
+class COUCHDB_API BulkDocsSource : public BodySource, boost::noncopyable
+{
+public:
+    // Appends the next document as JSON to the string, e.g. with writeJSON,
+    // and returns true; returns false once there are none left. Throwing
+    // aborts the request.
+    typedef boost::function<bool (std::string&)> Generator;
+
+    explicit BulkDocsSource(const Generator&);
+
+    ::boost::uint64_t size() const;
+    size_t read(char*, size_t);
+    bool seek(::boost::uint64_t);
+
+    // documents written so far
+    size_t getCount() const;
+
+private:
+    enum State
+    {
+        STATE_OPENING,
+        STATE_WRITING,
+        STATE_CLOSED
+    };
+
+    bool refill();
+
+    Generator         generator;
+    State             state;
+    std::string       pending;   // text written but not sent yet
+    size_t            offset;    // part of pending already sent
+    size_t            count;
+    ::boost::uint64_t position;
+};
+
+} //namespace CouchDB
+
+#endif
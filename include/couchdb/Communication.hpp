@@ -16,41 +16,122 @@
 #ifndef __COUCH_DB_COMM_HPP__
 #define __COUCH_DB_COMM_HPP__
 
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/any.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <iostream>
 #include <string>
-#include <deque>
 #include <map>
+#include <vector>
 
 #include <curl/curl.h>
 
+#include "couchdb/Async.hpp"
+#include "couchdb/BodySource.hpp"
+#include "couchdb/Parser.hpp"
+#include "couchdb/Projection.hpp"
+#include "couchdb/Reply.hpp"
+#include "couchdb/ResponseBuffer.hpp"
+#include "couchdb/StreamParser.hpp"
+#include "couchdb/Transport.hpp"
+#include "couchdb/Variant.hpp"
 #include "couchdb/export.hpp"
 
+namespace boost { namespace asio { class io_context; } }
+
 namespace CouchDB
 {
 
-// some data helpers aligned with TinyJSON implementation
-typedef boost::shared_ptr<boost::any>  Variant;
-typedef std::deque<Variant>            Array;
-typedef std::map<std::string, Variant> Object;
+class AsyncEngine;
+class HandlePool;
+class RequestTracker;
+class Session;
+struct PooledHandle;
+struct SignedRequest;
 
-// convenience template
-template<typename T>
-Variant createVariant(T value)
+// Content encoding of responses and request bodies.
+struct COUCHDB_API CompressionOptions
 {
-    return Variant(new boost::any(value));
-}
+    CompressionOptions();
+
+    // offer the server gzip and deflate (and whatever else libcurl can
+    // decode), on by default; compressed responses are decoded as they
+    // arrive, so streamData handlers still see plain JSON
+    bool   acceptEncoded;
+
+    // request bodies of at least this many bytes are sent gzipped, 0 (the
+    // default) for never; CouchDB inflates them itself
+    size_t minimumSize;
+
+    // zlib level for request bodies, 1 (fastest, the default) to 9
+    int    level;
+};
+
+// Recovery of the blocking calls from failed and slow requests.
+struct COUCHDB_API RequestPolicy
+{
+    RequestPolicy();
 
-template<>
-COUCHDB_API Variant createVariant<const char*>(const char *value);
+    // times a GET or HEAD is sent again after its connection fails (see
+    // TransportException) or it is answered 502, 503 or 504, 0 (the
+    // default) for never; only while none of the response has reached the
+    // caller and the body can be rewound. Other failures, such as a
+    // refused login, are thrown at once.
+    unsigned maxRetries;
+
+    // Retries PUT and DELETE as well; off by default, as CouchDB may have
+    // committed a write before its connection failed or a proxy answered
+    // 502 or 504, and then refuses it sent again with 409 Conflict.
+    bool     retryWrites;
+
+    // the wait before retry n is drawn at random up to backoff * 2^(n-1)
+    // milliseconds, 100 by default, and no more than maxBackoff, 5000
+    unsigned backoff;
+    unsigned maxBackoff;
+
+    // A GET read into a buffer and still unanswered past this percentile
+    // of the latencies of recent ones is sent again on a spare handle, and
+    // the first answer wins. 0 (the default) for never; 95 hedges about
+    // one request in twenty. Over libcurl alone, run on its own.
+    double   hedgePercentile;
+};
+
+// Counts of the blocking calls since the Communication was made.
+struct COUCHDB_API RequestMetrics
+{
+    RequestMetrics();
+
+    size_t requests;
+    size_t retries;     // sent again after failing
+    size_t hedged;      // GETs sent a second time
+    size_t hedgesWon;   // those the second one answered first
+};
 
-class COUCHDB_API Communication
+// HTTP access to one CouchDB server. Requests may be made from any number
+// of threads at once: each borrows an easy handle, with its own response
+// buffer and open connection, from a bounded pool and waits for one when
+// all are busy.
+//
+// The *Async calls return at once and run on a background I/O thread,
+// started by the first of them, which keeps any number of requests in
+// flight. Requests still running when the Communication is destroyed are
+// cancelled. With setIOContext, they run on the caller's io_context instead
+// (see Awaitable.hpp for coroutines).
+class COUCHDB_API Communication : boost::noncopyable
 {
 public:
     typedef std::map<std::string, std::string> HeaderMap;
 
+    enum HTTPVersion
+    {
+        HTTP_DEFAULT,            // libcurl's choice, one connection per handle
+        HTTP_1_1,
+        HTTP_2,                  // negotiated over TLS, else HTTP/1.1
+        HTTP_2_PRIOR_KNOWLEDGE   // h2c without negotiation, for local links
+    };
+
     Communication();
     Communication(const std::string&);
     ~Communication();
@@ -61,20 +142,239 @@ public:
             const std::string &method = "GET",
             const std::string &data = "");
 
+    // Same requests, parsed into a shared Value tree according to the
+    // current parse options.
+    ValuePtr getValue(const std::string&, const std::string &method = "GET",
+            const std::string &data = "");
+    ValuePtr getValue(const std::string&, const HeaderMap&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+
+    // Same requests, read straight into the projection's bound variables.
+    // Throws Exception if the response is not valid JSON.
+    void getProjection(const std::string&, Projection&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+    void getProjection(const std::string&, const HeaderMap&, Projection&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+
+    // Same requests, decoded into the fixed-shape replies of Reply.hpp.
+    // Throws Exception if the response is not valid JSON.
+    void getReply(const std::string&, WriteReply&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+    void getReply(const std::string&, const HeaderMap&, WriteReply&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+    void getReply(const std::string&, DocumentList&);
+
+    // Same, with the body read from the source while it is sent; it is
+    // never compressed.
+    void getReply(const std::string&, const HeaderMap&, WriteReply&,
+            const std::string &method, BodySource&);
+    void getReply(const std::string&, const HeaderMap&,
+            std::vector<WriteReply>&, const std::string &method, BodySource&);
+
+    // Parses the response while it is being received and reports it to
+    // the handler, so the body is never held in memory as a whole. Throws
+    // Exception if the response is not valid JSON; an exception thrown by
+    // the handler aborts the transfer and is rethrown as an Exception.
+    void streamData(const std::string&, JSONHandler&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+    void streamData(const std::string&, const HeaderMap&, JSONHandler&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+
     std::string getRawData(const std::string&);
 
+    // Asynchronous counterparts of getData and getRawData. The callback,
+    // if any, is called on the I/O thread once the future is ready.
+    Async<Variant>::Future getDataAsync(const std::string&,
+            const std::string &method = "GET",
+            const std::string &data = "",
+            const Async<Variant>::Callback& = Async<Variant>::Callback());
+    Async<std::string>::Future getRawDataAsync(const std::string&,
+            const std::string &method = "GET",
+            const std::string &data = "",
+            const Async<std::string>::Callback& = Async<std::string>::Callback());
+
+    // Runs the asynchronous calls on the io_context, on a strand of its
+    // own, instead of a background thread; handlers and callbacks are then
+    // called from the io_context. The io_context must outlive the
+    // Communication, and the Communication must not be destroyed while
+    // the io_context runs one of its handlers. Throws Exception once an
+    // asynchronous call has been made.
+    void setIOContext(boost::asio::io_context&);
+
+    // Queues a request and returns; the handler gets the response on the
+    // I/O thread. Throws Exception if the I/O thread cannot be started.
+    void requestAsync(const std::string&, const AsyncHandler&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+    void requestAsync(const std::string&, const HeaderMap&,
+            const AsyncHandler&, const std::string &method = "GET",
+            const std::string &data = "");
+
+    // Same, with the response turned into the result of a future.
+    template<typename T>
+    typename Async<T>::Future requestAsync(const std::string&,
+            const typename Async<T>::Decoder&,
+            const typename Async<T>::Callback&,
+            const std::string &method = "GET",
+            const std::string &data = "");
+
+    // Same, also returning the HTTP status of the response.
+    std::string getRawData(const std::string&, long &responseCode);
+
+    // Same, with the body left in the buffer, which is mapped rather than
+    // held in memory past the spill threshold, instead of a string.
+    void getRawData(const std::string&, ResponseBuffer&);
+    void getRawData(const std::string&, ResponseBuffer&, long &responseCode);
+
+    // HTTP status of the last response received on any thread; use the
+    // getRawData overload above when requests run concurrently.
+    long getResponseCode() const;
+
+    // Limits the number of easy handles, and so of concurrent requests and
+    // open connections (8 by default).
+    void setMaxHandles(size_t);
+    size_t getMaxHandles() const;
+
+    // With either HTTP/2 version, every request, blocking or not, runs on
+    // the I/O thread's connections (see below): concurrent requests from
+    // all threads are multiplexed over a single connection to the server,
+    // or spread over a pool of keep-alive connections if it only speaks
+    // HTTP/1.1. The handle limit still bounds concurrent blocking calls,
+    // so raise it for many threads. A streamData handler then runs on the
+    // I/O thread while the caller waits, and no blocking call may be made
+    // from an asynchronous handler. Throws Exception if libcurl lacks
+    // HTTP/2 support or once an asynchronous call has been made.
+    void setHTTPVersion(HTTPVersion);
+    HTTPVersion getHTTPVersion() const;
+
+    // Limits the connections the I/O thread opens to the server, 0 (the
+    // default) for no limit. Throws Exception once an asynchronous call
+    // has been made.
+    void setMaxConnections(size_t);
+
+    // Sends every request through the Unix domain socket at the path, for
+    // a server or proxy on the same host, instead of connecting to the
+    // URL's host; the URL still gives the Host header and paths. An empty
+    // path goes back to TCP. Throws Exception if libcurl lacks Unix socket
+    // support or once an asynchronous call has been made.
+    void setUnixSocket(const std::string&);
+    const std::string& getUnixSocket() const;
+
+    // Cookie authentication: posts the credentials to /_session once and
+    // sends the AuthSession cookie it gets back with every request after,
+    // so that the server checks the password once rather than on every
+    // request, as it does for credentials in the URL. The cookie the
+    // server renews in its responses is kept. Past the refresh age, the
+    // session is opened again before the next request, and a request
+    // answered 401 is sent once more after logging in again, unless its
+    // body cannot be rewound. Throws Exception if the login is refused.
+    void login(const std::string &name, const std::string &password);
+
+    // Ends the session, here and on the server. Throws Exception if the
+    // server cannot be reached.
+    void logout();
+
+    // age in seconds past which the session is opened again, 540 by
+    // default, under CouchDB's default session timeout of 600
+    void setSessionRefresh(unsigned);
+    unsigned getSessionRefresh() const;
+
+    // Retries and hedging of the blocking calls to come, off by default,
+    // and how often they happened; see RequestPolicy.
+    void setRequestPolicy(const RequestPolicy&);
+    const RequestPolicy& getRequestPolicy() const;
+    RequestMetrics getRequestMetrics() const;
+
+    // Runs the blocking calls over the transport, e.g. an EpollTransport,
+    // instead of libcurl; a null one, the default, goes back to libcurl.
+    // The HTTP version applies to libcurl alone, and the *Async calls
+    // always use it. Not to be changed while other threads are making
+    // requests.
+    void setTransport(const boost::shared_ptr<Transport>&);
+    const boost::shared_ptr<Transport>& getTransport() const;
+
+    // not to be changed while other threads are making requests
+    void setParseOptions(const ParseOptions&);
+    const ParseOptions& getParseOptions() const;
+
+    // same; compression pays off on slow links and costs CPU on fast ones
+    void setCompression(const CompressionOptions&);
+    const CompressionOptions& getCompression() const;
+
+    // same; responses larger than this many bytes are received into a
+    // temporary file mapping instead of memory, and parsed from there (see
+    // ResponseBuffer); 0, the default, for never
+    void setSpillThreshold(size_t);
+    size_t getSpillThreshold() const;
+
 private:
     void init(const std::string&);
+    AsyncEngine& getEngine();
+    bool isMultiplexed() const;
+    bool encodeBody(const std::string&, const HeaderMap&,
+            std::string &compressed, HeaderMap &encoded) const;
     Variant getData(const std::string&, const std::string&,
-            std::string, const HeaderMap&);
-    void getRawData(const std::string&, const std::string&,
-            std::string, const HeaderMap&);
+            const std::string&, const HeaderMap&);
+    void perform(PooledHandle&, const std::string&, const std::string&,
+            const std::string&, const HeaderMap&, curl_write_callback, void*);
+    void perform(PooledHandle&, const std::string&, const std::string&,
+            BodySource*, const HeaderMap&, curl_write_callback, void*);
+    void performSigned(PooledHandle&, const std::string&, const std::string&,
+            BodySource*, const HeaderMap&, curl_write_callback, void*,
+            bool hedging);
+    void send(PooledHandle&, const std::string&, const std::string&,
+            BodySource*, const HeaderMap&, curl_write_callback, void*,
+            bool signing, bool hedging);
+    struct curl_slist* prepareHandle(PooledHandle&, const std::string&,
+            const std::string&, BodySource*, const HeaderMap&,
+            curl_write_callback, void*, bool signing);
+    void performHedged(PooledHandle&, const std::string&, const HeaderMap&,
+            bool signing);
+    void openSession(PooledHandle&);
+    bool renewSession(PooledHandle&, std::string &cookie);
+    void submitSigned(const boost::shared_ptr<SignedRequest>&);
+    void renewSessionAsync(const boost::shared_ptr<SignedRequest>&);
+    void completeSigned(const boost::shared_ptr<SignedRequest>&, AsyncResponse&);
+    void completeLogin(size_t renewals, AsyncResponse&);
 
-    CURL        *curl;
-    std::string baseURL;
-    std::string buffer;
+    boost::scoped_ptr<HandlePool>  pool;
+    boost::scoped_ptr<AsyncEngine> engine;
+    boost::scoped_ptr<Session>     session;
+    boost::scoped_ptr<RequestTracker> tracker;
+    boost::mutex                   awaitingMutex;
+    bool                           loggingIn;       // asynchronously
+    std::vector<boost::shared_ptr<SignedRequest> > awaitingLogin;
+    boost::mutex                   engineMutex;
+    boost::asio::io_context        *ioContext;
+    HTTPVersion                    httpVersion;
+    size_t                         maxConnections;
+    size_t                         spillThreshold;
+    std::string                    unixSocket;
+    boost::shared_ptr<Transport>   transport;
+    std::string                    baseURL;
+    ParseOptions                   parseOptions;
+    CompressionOptions             compression;
+    RequestPolicy                  policy;
 };
 
+template<typename T>
+typename Async<T>::Future Communication::requestAsync(const std::string &url,
+        const typename Async<T>::Decoder &decode,
+        const typename Async<T>::Callback &callback,
+        const std::string &method, const std::string &data)
+{
+    AsyncCompletion<T> completion(decode, callback);
+    requestAsync(url, AsyncHandler(completion), method, data);
+    return completion.getFuture();
+}
+
 } //namespace CouchDB
 
 COUCHDB_API std::ostream& operator<<(std::ostream&, const CouchDB::Variant&);
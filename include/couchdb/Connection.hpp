@@ -27,27 +27,87 @@
 namespace CouchDB
 {
 
+// A Connection may be used from several threads at once, see Communication.
+// The Database, Document and Attachment handles it hands out are meant for
+// one thread at a time; each thread can get its own. Constructing one makes
+// no request: the server is first contacted by the first call needing it,
+// so an unreachable server is no longer reported by the constructor but by
+// that call, which throws Exception.
 class COUCHDB_API Connection
 {
 public:
     Connection();
     Connection(const std::string&);
+
+    // Talks to the server at the URL through the Unix domain socket at
+    // the path; see Communication::setUnixSocket.
+    Connection(const std::string&, const std::string &unixSocket);
+
+    // Runs the asynchronous calls on the io_context; see
+    // Communication::setIOContext.
+    Connection(boost::asio::io_context&);
+    Connection(boost::asio::io_context&, const std::string&);
     ~Connection();
 
+    // Asks the server on the first call, blocking, and keeps the answer.
+    // Throws Exception if it cannot be reached.
     std::string getCouchDBVersion() const;
 
+    // applies to the Value trees returned by library calls, e.g. enabling
+    // arena allocation for listDocuments() on large databases
+    void setParseOptions(const ParseOptions&);
+
+    // upper bound on concurrent requests and open connections
+    void setMaxHandles(size_t);
+
+    // HTTP/2 multiplexing and its connection limit, see Communication
+    void setHTTPVersion(Communication::HTTPVersion);
+    void setMaxConnections(size_t);
+
+    // content encoding in both directions, see Communication
+    void setCompression(const CompressionOptions&);
+
+    // Unix domain socket for the requests to come, see Communication
+    void setUnixSocket(const std::string&);
+
+    // Cookie authentication for the requests to come: the server checks
+    // the password once per session instead of on every request. See
+    // Communication::login; throws Exception if the login is refused.
+    void login(const std::string &name, const std::string &password);
+    void logout();
+    void setSessionRefresh(unsigned seconds);
+
+    // retries and hedging of the blocking requests to come, and how often
+    // they happened; see RequestPolicy
+    void setRequestPolicy(const RequestPolicy&);
+    RequestMetrics getRequestMetrics() const;
+
+    // transport of the blocking requests to come, see Communication
+    void setTransport(const boost::shared_ptr<Transport>&);
+
     std::vector<std::string> listDatabases();
     Database getDatabase(const std::string&);
 
     bool createDatabase(const std::string&);
     bool deleteDatabase(const std::string&);
 
+    // asynchronous counterparts; see Communication
+    Async<std::vector<std::string> >::Future listDatabasesAsync(
+            const Async<std::vector<std::string> >::Callback& =
+                    Async<std::vector<std::string> >::Callback());
+    Async<bool>::Future createDatabaseAsync(const std::string&,
+            const Async<bool>::Callback& = Async<bool>::Callback());
+    Async<bool>::Future deleteDatabaseAsync(const std::string&,
+            const Async<bool>::Callback& = Async<bool>::Callback());
+
 private:
     void init(const std::string&);
-    void getInfo();
+    void getInfo() const;
 
-    Communication comm;
-    std::string   couchDBVersion;
+    // mutable for the version request made by the const getCouchDBVersion
+    mutable Communication comm;
+    mutable boost::mutex  infoMutex;
+    mutable std::string   couchDBVersion;
 };
 
 } //namespace CouchDB
@@ -19,6 +19,7 @@
 #include <string>
 #include <iostream>
 
+#include "couchdb/Binding.hpp"
 #include "couchdb/Document.hpp"
 #include "couchdb/export.hpp"
 
@@ -46,14 +47,68 @@ public:
     Document createDocument(Variant, std::vector<Attachment>,
             const std::string &id="");
 
+    // Asynchronous getDocument and createDocument; see Communication. The
+    // Database need not outlive the requests, its Communication must.
+    Async<Document>::Future getDocumentAsync(const std::string&,
+            const std::string &rev="",
+            const Async<Document>::Callback& = Async<Document>::Callback());
+    Async<Document>::Future createDocumentAsync(const Variant&,
+            const std::string &id="",
+            const Async<Document>::Callback& = Async<Document>::Callback());
+
+    // Creates, updates or deletes a batch of documents in one _bulk_docs
+    // request, serializing each only as it is sent (see BulkDocsSource).
+    // Returns a reply per document, in the order they were written. Throws
+    // Exception if the request as a whole fails.
+    std::vector<WriteReply> writeDocuments(const BulkDocsSource::Generator&);
+
+    // Typed access for structs declared with COUCHDB_FIELDS; the JSON is
+    // read into and written from the struct directly.
+    template<typename T>
+    T getDocumentAs(const std::string&, const std::string &rev="");
+
+    template<typename T>
+    typename boost::enable_if_c<JSONFields<T>::defined, Document>::type
+    createDocument(const T&, const std::string &id="");
+
 protected:
     Communication& getCommunication();
 
 private:
+    std::string getDocumentJSON(const std::string&, const std::string&);
+    std::string getDocumentURL(const std::string&, const std::string&) const;
+    Document storeDocument(const std::string&);
+
+    static Document readDocument(Communication*, const std::string&,
+            const std::string&, const std::string&, const std::string&);
+    static Document readStored(Communication*, const std::string&,
+            const WriteReply&);
+    static Document decodeDocument(Communication*, const std::string&,
+            const std::string&, const std::string&, AsyncResponse&);
+    static Document decodeStored(Communication*, const std::string&,
+            AsyncResponse&);
+
     Communication &comm;
     std::string   name;
+    std::string   body;  // serialized requests, reused to keep its capacity
 };
 
+template<typename T>
+T Database::getDocumentAs(const std::string &id, const std::string &rev)
+{
+    std::string json = getDocumentJSON(id, rev);
+    return fromJSON<T>(json);
+}
+
+template<typename T>
+typename boost::enable_if_c<JSONFields<T>::defined, Document>::type
+Database::createDocument(const T &data, const std::string &id)
+{
+    body.clear();
+    writeJSONAs(data, body);
+    return storeDocument(id);
+}
+
 } //namespace CouchDB
 
 COUCHDB_API std::ostream& operator<<(std::ostream&, const CouchDB::Database&);
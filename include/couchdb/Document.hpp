@@ -22,6 +22,7 @@
 
 #include "couchdb/Revision.hpp"
 #include "couchdb/Attachment.hpp"
+#include "couchdb/Binding.hpp"
 #include "couchdb/export.hpp"
 
 namespace CouchDB
@@ -39,7 +40,7 @@ public:
     Document(const Document&);
     ~Document();
 
-    Document& operator=(Document&);
+    Document& operator=(const Document&);
     bool operator==(const Document&);
 
     const std::string& getID() const;
@@ -50,8 +51,23 @@ public:
 
     Variant getData();
 
+    // asynchronous getData; see Communication
+    Async<Variant>::Future getDataAsync(
+            const Async<Variant>::Callback& = Async<Variant>::Callback());
+
+    // reads the document into a struct declared with COUCHDB_FIELDS
+    template<typename T>
+    T getDataAs();
+
     bool addAttachment(const std::string&, const std::string&,
             const std::string&);
+
+    // Same, with the data read from the source, or from the file at
+    // `path`, as it is sent, so a large attachment is never held in memory.
+    // Throws Exception if the file cannot be opened.
+    bool addAttachment(const std::string&, const std::string&, BodySource&);
+    bool addAttachmentFile(const std::string&, const std::string&,
+            const std::string &path);
     Attachment getAttachment(const std::string&);
     std::vector<Attachment> getAllAttachments();
     bool removeAttachment(const std::string&);
@@ -66,6 +82,10 @@ protected:
     std::string getURL(bool) const;
 
 private:
+    std::string getJSON();
+    std::string getAttachmentURL(const std::string&) const;
+    bool readAttachmentReply(const std::string&, const WriteReply&);
+
     Communication &comm;
     std::string   db;
     std::string   id;
@@ -73,6 +93,13 @@ private:
     std::string   revision;
 };
 
+template<typename T>
+T Document::getDataAs()
+{
+    std::string json = getJSON();
+    return fromJSON<T>(json);
+}
+
 } //namespace CouchDB
 
 COUCHDB_API std::ostream& operator<<(std::ostream&, const CouchDB::Document&);
@@ -34,6 +34,15 @@ private:
     std::string message;
 };
 
+// Thrown when the connection to the server fails: it cannot be resolved or
+// reached, or it breaks or goes silent before the whole response has come.
+// The server may or may not have seen the request.
+class COUCHDB_API TransportException : public Exception
+{
+public:
+    TransportException(const std::string&);
+};
+
 } //namespace CouchDB
 
 #endif
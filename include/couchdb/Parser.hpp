@@ -0,0 +1,77 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_PARSER_HPP__
+#define __COUCH_DB_PARSER_HPP__
+
+#include <string>
+
+#include "couchdb/Variant.hpp"
+#include "couchdb/Value.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Two-pass JSON parser. The first pass builds an index of the structural
+// characters using the widest SIMD kernel the CPU supports, the second pass
+// walks that index and builds the same Variant tree TinyJSON produced:
+// strings, bools, doubles, ints (64-bit when they do not fit in an int),
+// Object and Array (in their flat form, see Variant.hpp). Malformed input
+// yields a Variant holding an empty boost::any, again matching TinyJSON.
+// Text of 4 GB or more cannot be indexed and throws Exception instead, as
+// do all the parsers below.
+COUCHDB_API Variant parseJSON(const char*, size_t);
+COUCHDB_API Variant parseJSON(const std::string&);
+
+// Same parser, building the compact Value tree instead. Throws Exception on
+// malformed input.
+COUCHDB_API Value parseValue(const char*, size_t);
+COUCHDB_API Value parseValue(const std::string&);
+
+struct COUCHDB_API ParseOptions
+{
+    ParseOptions();
+
+    // allocate every node of the tree from a single arena that is released
+    // in one step with the last handle, instead of one malloc per node
+    bool useArena;
+
+    // keep the JSON text alive with the tree and let strings without
+    // escapes point into it instead of copying them; implies useArena
+    bool borrowStrings;
+};
+
+// Parses into a shared, immutable tree. Throws Exception on malformed input.
+COUCHDB_API ValuePtr parseTree(const char*, size_t,
+        const ParseOptions &options = ParseOptions());
+COUCHDB_API ValuePtr parseTree(const std::string&,
+        const ParseOptions &options = ParseOptions());
+
+// Same, taking over the contents of `text`, which is left empty. With
+// borrowStrings the tree then keeps the text without copying it.
+COUCHDB_API ValuePtr parseTreeSwap(std::string &text,
+        const ParseOptions &options = ParseOptions());
+
+// Name of the structural indexing kernel in use: "avx2", "sse2" or "scalar".
+COUCHDB_API const char* getParserKernel();
+
+// Forces a particular kernel (for benchmarking); returns false if the CPU
+// does not support it. Not safe to call while other threads are parsing.
+COUCHDB_API bool setParserKernel(const std::string&);
+
+} //namespace CouchDB
+
+#endif
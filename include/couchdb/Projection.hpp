@@ -0,0 +1,111 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_PROJECTION_HPP__
+#define __COUCH_DB_PROJECTION_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+#include <string>
+#include <vector>
+
+#include "couchdb/Value.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// On-demand parsing: members are bound to variables by their dotted path
+// ("value.rev") and apply() fills them straight from the JSON text, skipping
+// everything else without decoding it. Scanning stops as soon as every
+// required binding has been seen, so reading "_id" and "_rev" from a large
+// document only touches its first few bytes.
+class COUCHDB_API Projection
+{
+public:
+    enum Presence
+    {
+        BIND_REQUIRED,
+        BIND_OPTIONAL  // filled if seen before the required bindings are complete
+    };
+
+    typedef boost::function<void ()> RowHandler;
+
+    Projection();
+
+    Projection& bind(const std::string&, std::string&, Presence presence = BIND_REQUIRED);
+    Projection& bind(const std::string&, bool&, Presence presence = BIND_REQUIRED);
+    Projection& bind(const std::string&, ::boost::int64_t&, Presence presence = BIND_REQUIRED);
+    Projection& bind(const std::string&, double&, Presence presence = BIND_REQUIRED);
+    Projection& bind(const std::string&, Value&, Presence presence = BIND_REQUIRED);
+
+    // Applies `row` to every element of the array at the path and calls the
+    // handler after each one.
+    Projection& each(const std::string&, Projection&, const RowHandler&,
+            Presence presence = BIND_REQUIRED);
+
+    // Returns false if the input is not valid JSON as far as it was read.
+    // Throws Exception if a bound member has an incompatible type.
+    bool apply(const char*, size_t);
+    bool apply(const std::string&);
+
+    // whether the path was present during the last apply()
+    bool found(const std::string&) const;
+
+private:
+    enum TargetType
+    {
+        TARGET_STRING,
+        TARGET_BOOLEAN,
+        TARGET_INTEGER,
+        TARGET_REAL,
+        TARGET_VALUE,
+        TARGET_EACH
+    };
+
+    enum Status
+    {
+        STATUS_FAILED,
+        STATUS_DONE,
+        STATUS_COMPLETE
+    };
+
+    struct Binding
+    {
+        std::string              path;
+        std::vector<std::string> segments;
+        TargetType               type;
+        void                     *target;
+        Projection               *row;
+        RowHandler               handler;
+        bool                     required;
+        bool                     found;
+    };
+
+    Projection& add(const std::string&, TargetType, void*, Presence);
+    void reset();
+    Status readObject(const char*&, const char*, size_t, ::boost::uint64_t, bool);
+    bool readTarget(Binding&, const char*&, const char*);
+    bool readRows(Binding&, const char*&, const char*);
+
+    std::vector<Binding> bindings;
+    size_t               remaining;
+    std::string          scratch;
+};
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_REPLY_HPP__
+#define __COUCH_DB_REPLY_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+#include <vector>
+
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Decoders for the small, fixed-shape replies CouchDB sends to writes, to
+// failed requests and for _all_docs. Member names are recognized with a
+// perfect hash and values go straight into the structs below; any other
+// shape falls back to the generic parser, so the result is the same either
+// way. Members the decoders do not know are skipped without being
+// validated, as Projection does.
+
+// {"ok":true,"id":...,"rev":...} or {"error":...,"reason":...}
+struct COUCHDB_API WriteReply
+{
+    enum Member
+    {
+        MEMBER_OK     = 1,
+        MEMBER_ID     = 2,
+        MEMBER_REV    = 4,
+        MEMBER_ERROR  = 8,
+        MEMBER_REASON = 16
+    };
+
+    WriteReply();
+
+    // whether the member was present in the reply
+    bool has(Member) const;
+
+    bool        ok;
+    std::string id;
+    std::string rev;
+    std::string error;
+    std::string reason;
+    unsigned    found;
+};
+
+// A _bulk_docs reply is an array of these, one per document and in the
+// same order, where a failed write also carries the id.
+
+// one {"id":...,"key":...,"value":{"rev":...}} row of _all_docs, or a
+// {"key":...,"error":"not_found"} one for a requested key without a
+// document, which leaves id and rev empty
+struct COUCHDB_API DocumentRow
+{
+    std::string id;
+    std::string key;
+    std::string rev;
+    std::string error;
+    std::string reason;
+};
+
+struct COUCHDB_API DocumentList
+{
+    DocumentList();
+
+    ::boost::int64_t         totalRows;
+    ::boost::int64_t         offset;
+    std::vector<DocumentRow> rows;
+
+    // set when the request failed
+    std::string error;
+    std::string reason;
+};
+
+// Fast paths only: replace what the reply held, and return false, leaving
+// it partly filled, if the text does not have the expected shape.
+COUCHDB_API bool decodeWriteReply(const char*, size_t, WriteReply&);
+COUCHDB_API bool decodeWriteReplies(const char*, size_t, std::vector<WriteReply>&);
+COUCHDB_API bool decodeDocumentList(const char*, size_t, DocumentList&);
+
+// Fast path with the generic fallback. Throws Exception if the text is not
+// valid JSON, or if a row of a document list has members of the wrong type.
+// A request that failed as a whole reads as a single failed write.
+COUCHDB_API void readWriteReply(const std::string&, WriteReply&);
+COUCHDB_API void readWriteReply(const char*, size_t, WriteReply&);
+COUCHDB_API void readWriteReplies(const std::string&, std::vector<WriteReply>&);
+COUCHDB_API void readWriteReplies(const char*, size_t, std::vector<WriteReply>&);
+COUCHDB_API void readDocumentList(const std::string&, DocumentList&);
+COUCHDB_API void readDocumentList(const char*, size_t, DocumentList&);
+
+} //namespace CouchDB
+
+#endif
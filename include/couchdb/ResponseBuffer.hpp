@@ -0,0 +1,81 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_RESPONSE_BUFFER_HPP__
+#define __COUCH_DB_RESPONSE_BUFFER_HPP__
+
+#include <boost/noncopyable.hpp>
+
+#include <string>
+
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Body of a response, held in memory or, once it grows past the spill
+// threshold, in a mapping of an unlinked temporary file, which the kernel
+// can write back and evict rather than keep resident. Either way the body
+// is contiguous and can be parsed in place. Mapping is not available on
+// Windows, where the threshold is ignored.
+class COUCHDB_API ResponseBuffer : boost::noncopyable
+{
+public:
+    ResponseBuffer();
+    ~ResponseBuffer();
+
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+
+    // whether the body lives in a file mapping
+    bool isMapped() const;
+
+    // Bodies larger than this many bytes are moved to a file mapping; 0,
+    // the default, for never.
+    void setSpillThreshold(size_t);
+    size_t getSpillThreshold() const;
+
+    // Makes room for a body of the given length, e.g. from Content-Length,
+    // mapping it at once if it is past the threshold. Both throw Exception
+    // if the temporary file cannot be created or grown.
+    void reserve(size_t);
+    void append(const char*, size_t);
+
+    // Empties the buffer, keeping the capacity of a body held in memory and
+    // dropping a mapping.
+    void clear();
+
+    void swap(ResponseBuffer&);
+
+    // Exchanges a body held in memory with the string, without copying.
+    // Returns false, leaving both alone, if the body is mapped.
+    bool swap(std::string&);
+
+private:
+    void map(size_t);
+    void unmap();
+
+    std::string text;
+    char        *mapped;
+    size_t      mappedSize;
+    size_t      length;
+    size_t      threshold;
+    int         fd;
+};
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_STREAM_PARSER_HPP__
+#define __COUCH_DB_STREAM_PARSER_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include "couchdb/Value.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+class ValueBuilder;
+
+// Receives the events of a StreamParser. Strings and keys are only valid
+// for the duration of the call. Every event does nothing by default.
+class COUCHDB_API JSONHandler
+{
+public:
+    virtual ~JSONHandler();
+
+    virtual void null();
+    virtual void boolean(bool);
+    virtual void integer(::boost::int64_t);
+    virtual void real(double);
+    virtual void string(const char*, size_t);
+    virtual void key(const char*, size_t);
+    virtual void startObject();
+    virtual void endObject();
+    virtual void startArray();
+    virtual void endArray();
+};
+
+// Handler building the same Value tree parseValue() would.
+class COUCHDB_API ValueHandler : public JSONHandler, boost::noncopyable
+{
+public:
+    ValueHandler();
+    ~ValueHandler();
+
+    // root of the document, once the parser has finished it
+    Value& getRoot();
+
+    void null();
+    void boolean(bool);
+    void integer(::boost::int64_t);
+    void real(double);
+    void string(const char*, size_t);
+    void key(const char*, size_t);
+    void startObject();
+    void endObject();
+    void startArray();
+    void endArray();
+
+private:
+    boost::scoped_ptr<ValueBuilder> builder;
+};
+
+// Resumable JSON parser: the document can be fed in chunks of any size, as
+// they arrive, and events are reported to the handler as soon as each value
+// is complete. Only a token split across two chunks is ever copied.
+class COUCHDB_API StreamParser : boost::noncopyable
+{
+public:
+    StreamParser(JSONHandler&);
+
+    // Returns false as soon as the input is known to be invalid; later
+    // calls are then ignored.
+    bool feed(const char*, size_t);
+    bool feed(const std::string&);
+
+    // Call at the end of the input; returns true if exactly one complete
+    // document was read.
+    bool finish();
+
+    // prepares the parser for another document
+    void reset();
+
+private:
+    enum Expect
+    {
+        EXPECT_VALUE,
+        EXPECT_FIRST_VALUE,  // just after '['
+        EXPECT_KEY,
+        EXPECT_FIRST_KEY,    // just after '{'
+        EXPECT_COLON,
+        EXPECT_NEXT,         // ',' or the end of the container
+        EXPECT_NOTHING       // the document is complete
+    };
+
+    enum Token
+    {
+        TOKEN_NONE,
+        TOKEN_STRING,
+        TOKEN_KEY,
+        TOKEN_NUMBER,
+        TOKEN_LITERAL
+    };
+
+    bool startToken(Token, const char*&, const char*);
+    bool resumeToken(const char*&, const char*);
+    bool endToken(Token, const char*, const char*);
+    const char* findQuote(const char*, const char*);
+    void endContainer();
+    void endValue();
+    bool fail();
+
+    JSONHandler       &handler;
+    std::vector<char> scopes;
+    Expect            expect;
+    Token             token;
+    bool              escaped;  // the last byte of a pending string was an escaping backslash
+    bool              failed;
+    std::string       pending;  // token split across chunks
+    std::string       scratch;
+};
+
+} //namespace CouchDB
+
+#endif
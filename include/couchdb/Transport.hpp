@@ -0,0 +1,118 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_TRANSPORT_HPP__
+#define __COUCH_DB_TRANSPORT_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "couchdb/BodySource.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Carries the blocking requests of a Communication in place of libcurl,
+// which remains the default (see Communication::setTransport).
+// Implementations must take concurrent perform() calls, one per thread.
+class COUCHDB_API Transport : boost::noncopyable
+{
+public:
+    typedef std::map<std::string, std::string> HeaderMap;
+
+    // Receives the response body as it arrives, with the length given as
+    // size times count; returning anything else aborts the request. Same
+    // shape as libcurl's write callback.
+    typedef size_t (*Writer)(char*, size_t, size_t, void*);
+
+    struct COUCHDB_API Request
+    {
+        Request(const std::string &url, const std::string &method,
+                const HeaderMap&, BodySource*, const std::string &unixSocket,
+                bool acceptEncoded);
+
+        const std::string &url;          // absolute
+        const std::string &method;
+        const HeaderMap   &headers;
+        BodySource        *body;         // NULL for none
+        const std::string &unixSocket;   // to connect to instead, if set
+        bool              acceptEncoded; // compressed responses may be asked
+                                         // for, and are then decoded
+    };
+
+    struct COUCHDB_API Response
+    {
+        Response(Writer, void *target);
+
+        Writer write;
+        void   *target;
+        Writer header;         // given each header line with its CRLF, with
+        void   *headerTarget;  // the same contract as write, if set
+        long   status;
+        size_t length;         // announced body length, 0 if none; set
+                               // before the body is first written
+    };
+
+    virtual ~Transport();
+
+    // Sends the request, sets the status of the response and hands its body
+    // to the writer. Throws TransportException if the connection fails, and
+    // Exception if no complete response could be had for another reason,
+    // such as a writer aborting.
+    virtual void perform(const Request&, Response&) = 0;
+};
+
+#ifdef __linux__
+
+// Lean HTTP/1.1 client for http:// URLs and Unix domain sockets. It keeps
+// connections alive on non-blocking sockets waited on with epoll, writes a
+// request and a small body with one send, and parses responses in its
+// receive buffer, handing the body over from there. Compressed responses
+// are never asked for; there is no TLS, proxy or redirect support.
+class COUCHDB_API EpollTransport : public Transport
+{
+public:
+    // Keeps up to `maxIdle` connections open between requests. A request
+    // fails with Exception once its connection has been silent, in both
+    // directions, for `timeout` milliseconds; 0 waits for ever.
+    explicit EpollTransport(size_t maxIdle = 8, int timeout = 0);
+    ~EpollTransport();
+
+    void perform(const Request&, Response&);
+
+private:
+    struct Socket;
+
+    Socket* acquire(const std::string &origin, const std::string &unixSocket);
+    void release(Socket*);
+    bool exchange(Socket*, const Request&, Response&, const std::string &host,
+            const char *path);
+
+    boost::mutex         mutex;
+    std::vector<Socket*> idle;   // guarded by mutex
+    size_t               maxIdle;
+    int                  timeout;
+};
+
+#endif
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_VALUE_HPP__
+#define __COUCH_DB_VALUE_HPP__
+
+#include <boost/config.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <iostream>
+#include <string>
+
+#include "couchdb/Variant.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+class Arena;
+
+// Compact JSON value: 16 bytes with an inline type tag. Null, booleans,
+// numbers and strings of up to 14 bytes are stored inline; longer strings,
+// arrays and objects own a single heap block, or point into an Arena (or
+// into the retained JSON text) when the value belongs to a shared tree
+// (see ValuePtr). Copies are deep and always own their storage.
+class COUCHDB_API Value
+{
+    friend class ValueBuilder;
+
+public:
+    enum Type
+    {
+        TYPE_NULL,
+        TYPE_BOOLEAN,
+        TYPE_INTEGER,
+        TYPE_REAL,
+        TYPE_STRING,
+        TYPE_ARRAY,
+        TYPE_OBJECT
+    };
+
+    struct Member;
+
+    Value();
+    Value(bool);
+    Value(int);
+    Value(::boost::int64_t);
+    Value(double);
+    Value(const char*);
+    Value(const char*, size_t);
+    Value(const std::string&);
+    Value(const Value&);
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+    Value(Value&&) BOOST_NOEXCEPT;
+#endif
+    ~Value();
+
+    Value& operator=(const Value&);
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+    Value& operator=(Value&&) BOOST_NOEXCEPT;
+#endif
+    void swap(Value&);
+
+    static Value createArray(size_t reserve = 0);
+    static Value createObject(size_t reserve = 0);
+
+    Type getType() const;
+    bool isNull() const;
+    bool isBoolean() const;
+    bool isNumber() const;
+    bool isString() const;
+    bool isArray() const;
+    bool isObject() const;
+
+    // typed access, throws Exception if the value has another type
+    bool               getBoolean() const;
+    ::boost::int64_t   getInteger() const;
+    double             getReal() const;
+    boost::string_view getString() const;
+    std::string        asString() const;
+
+    // number of array elements or object members
+    size_t size() const;
+    bool empty() const;
+
+    // arrays
+    const Value& operator[](size_t) const;
+    Value& operator[](size_t);
+    void push_back(const Value&);
+
+    // objects; lookups return NULL or throw if the key is missing
+    const Member& getMember(size_t) const;
+    Member& getMember(size_t);
+    const Value* find(const boost::string_view&) const;
+    Value* find(const boost::string_view&);
+    const Value& get(const boost::string_view&) const;
+    Value& operator[](const boost::string_view&);
+
+    // Adds a member without looking for one of the same name first, for
+    // building an object whose keys are known to differ; returns its
+    // value, null until set.
+    Value& addMember(const boost::string_view&);
+
+private:
+    enum
+    {
+        TYPE_MASK      = 0x0f,
+        FLAG_SMALL     = 0x10,
+        FLAG_EXTERNAL  = 0x20,  // storage belongs to an arena
+        SMALL_CAPACITY = 14
+    };
+
+    struct Container;
+
+    // moves `count` elements (members for objects) into a new container,
+    // allocated from the arena if one is given
+    static Value adopt(Type, Value*, size_t, Arena*);
+    static Value createString(const char*, size_t, Arena*);
+    // refers to the characters without copying them; they must outlive
+    // the value (and are copied by copies of it)
+    static Value borrowString(const char*, size_t);
+
+    unsigned char tag() const;
+    void setTag(unsigned char);
+    void setString(const char*, size_t);
+    void reserve(size_t);
+    Value* items() const;
+    void expect(Type, const char*) const;
+    void release();
+
+    union
+    {
+        struct
+        {
+            char          chars[SMALL_CAPACITY];
+            unsigned char length;
+            unsigned char tag;
+        } small;
+
+        struct
+        {
+            union
+            {
+                bool             boolean;
+                ::boost::int64_t integer;
+                double           real;
+                char             *string;
+                Container        *container;
+            };
+            ::boost::uint32_t length;
+            unsigned char     padding[3];
+            unsigned char     tag;
+        } large;
+    } data;
+};
+
+struct Value::Member
+{
+    Value key;
+    Value value;
+};
+
+// Handle to a parsed tree. Arena backed trees are released in one go when
+// the last handle to the root or to any node inside it goes away.
+typedef boost::shared_ptr<const Value> ValuePtr;
+
+// adapters to and from the boost::any based tree
+COUCHDB_API Value toValue(const Variant&);
+COUCHDB_API Variant toVariant(const Value&);
+
+} //namespace CouchDB
+
+#endif
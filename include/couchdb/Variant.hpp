@@ -0,0 +1,87 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_VARIANT_HPP__
+#define __COUCH_DB_VARIANT_HPP__
+
+#include <boost/shared_ptr.hpp>
+#include <boost/any.hpp>
+#include <boost/container/flat_map.hpp>
+
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// some data helpers aligned with TinyJSON implementation; arrays and
+// objects are contiguous (objects keep their members sorted by key, so
+// iteration order and lookups match std::map, but inserting or erasing a
+// member costs O(n) and invalidates iterators and references to the others;
+// see NEWS for the differences from the former deque and map)
+typedef boost::shared_ptr<boost::any>                     Variant;
+typedef std::vector<Variant>                              Array;
+typedef boost::container::flat_map<std::string, Variant> Object;
+
+// convenience template
+template<typename T>
+Variant createVariant(T value)
+{
+    return Variant(new boost::any(value));
+}
+
+template<>
+COUCHDB_API Variant createVariant<const char*>(const char *value);
+
+// Throws Exception naming the type `var` holds and the one expected; used by
+// as<T>().
+COUCHDB_API void throwUnexpectedType(const Variant &var, const std::type_info &expected);
+
+// Reference to the value held by `var`, without copying it. Throws
+// Exception if the variant is empty or holds another type.
+template<typename T>
+T& as(const Variant &var)
+{
+    T *value = var ? boost::any_cast<T>(var.get()) : NULL;
+    if(!value)
+        throwUnexpectedType(var, typeid(T));
+    return *value;
+}
+
+// Member lookups; find returns NULL and get throws Exception if the key is
+// missing. The Variant overloads expect an Object.
+COUCHDB_API const Variant* find(const Object&, const std::string&);
+COUCHDB_API const Variant* find(const Variant&, const std::string&);
+COUCHDB_API const Variant& get(const Object&, const std::string&);
+COUCHDB_API const Variant& get(const Variant&, const std::string&);
+
+template<typename T>
+T& get(const Object &obj, const std::string &key)
+{
+    return as<T>(get(obj, key));
+}
+
+template<typename T>
+T& get(const Variant &var, const std::string &key)
+{
+    return as<T>(get(var, key));
+}
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,55 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_WRITER_HPP__
+#define __COUCH_DB_WRITER_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+
+#include "couchdb/Variant.hpp"
+#include "couchdb/Value.hpp"
+#include "couchdb/export.hpp"
+
+namespace CouchDB
+{
+
+// Compact JSON serializer. Every function appends to `out`, so a buffer
+// that is cleared between documents keeps its capacity. Strings are
+// escaped, doubles are written with the fewest digits that read back to
+// the same value (non-finite ones as null) and integers keep all 64 bits.
+// Throws Exception for a Variant holding a type JSON cannot represent.
+COUCHDB_API void writeJSON(const Variant&, std::string &out);
+COUCHDB_API void writeJSON(const Value&, std::string &out);
+
+COUCHDB_API std::string toJSON(const Variant&);
+COUCHDB_API std::string toJSON(const Value&);
+
+// building blocks for writing documents piece by piece
+COUCHDB_API void writeJSONString(const char*, size_t, std::string &out);
+COUCHDB_API void writeJSONString(const std::string&, std::string &out);
+COUCHDB_API void writeJSONNumber(::boost::int64_t, std::string &out);
+COUCHDB_API void writeJSONNumber(::boost::uint64_t, std::string &out);
+
+// Writes the shortest text that reads back as the same double when built
+// as C++17 with to_chars; otherwise the fewest of 15, 16 and 17 significant
+// digits that do, which is the shortest too except for some subnormals.
+// NaN and infinities are written as null.
+COUCHDB_API void writeJSONNumber(double, std::string &out);
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cstdlib>
+#include <new>
+
+#include "couchdb/Arena.hpp"
+
+namespace CouchDB
+{
+
+// chunk header, padded so the storage that follows stays aligned
+struct Arena::Chunk
+{
+    Chunk  *next;
+    size_t size;
+};
+
+Arena::Arena(size_t firstChunk)
+    : chunks(NULL)
+    , cursor(NULL)
+    , limit(NULL)
+    , nextChunk(firstChunk < 256 ? 256 : firstChunk)
+    , reserved(0)
+{
+}
+
+Arena::~Arena()
+{
+    while(chunks)
+    {
+        Chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+}
+
+size_t Arena::getReserved() const
+{
+    return reserved;
+}
+
+void* Arena::allocateChunk(size_t bytes)
+{
+    size_t size = nextChunk;
+    if(size < bytes)
+        size = bytes;
+
+    Chunk *chunk = (Chunk*)malloc(sizeof(Chunk) + size);
+    if(!chunk)
+        throw std::bad_alloc();
+
+    chunk->next = chunks;
+    chunk->size = size;
+    chunks      = chunk;
+    reserved   += size;
+
+    // grow geometrically so big responses need few chunks
+    if(nextChunk < 64 * 1024 * 1024)
+        nextChunk *= 2;
+
+    char *block = (char*)(chunk + 1);
+    cursor = block + bytes;
+    limit  = block + size;
+    return block;
+}
+
+} //namespace CouchDB
@@ -0,0 +1,211 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "couchdb/Exception.hpp"
+
+#include "AsioEngine.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+AsioEngine::AsioEngine(boost::asio::io_context &_io, const EngineOptions &options)
+    : AsyncEngine(options)
+    , io(_io)
+    , strand(_io.get_executor())
+    , timer(_io)
+    , token(new AsioEngine*(this))
+{
+    if(curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, onSocket) != CURLM_OK ||
+       curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this) != CURLM_OK ||
+       curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, onTimer) != CURLM_OK ||
+       curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this) != CURLM_OK)
+    {
+        throw Exception("Unable to set socket callbacks");
+    }
+}
+
+AsioEngine::~AsioEngine()
+{
+    // handlers still queued on the io_context find the token cleared
+    *token = NULL;
+    timer.cancel();
+
+    // closes the sockets through closeSocket, which must still find them
+    shutdown();
+    sockets.clear();
+}
+
+void AsioEngine::setupSockets(CURL *curl)
+{
+    // curl opens and closes its sockets through us, so a descriptor is
+    // never left watching a socket curl has already closed
+    curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, openSocket);
+    curl_easy_setopt(curl, CURLOPT_OPENSOCKETDATA, this);
+    curl_easy_setopt(curl, CURLOPT_CLOSESOCKETFUNCTION, closeSocket);
+    curl_easy_setopt(curl, CURLOPT_CLOSESOCKETDATA, this);
+}
+
+void AsioEngine::wakeup()
+{
+    boost::asio::post(strand, boost::bind(&AsioEngine::onQueued, token));
+}
+
+void AsioEngine::onQueued(Token token)
+{
+    if(*token)
+        (*token)->startQueued();
+}
+
+curl_socket_t AsioEngine::openSocket(void *data, curlsocktype purpose,
+        struct curl_sockaddr *address)
+{
+    AsioEngine *engine = static_cast<AsioEngine*>(data);
+    if(purpose != CURLSOCKTYPE_IPCXN)
+        return CURL_SOCKET_BAD;
+
+    curl_socket_t fd = socket(address->family, address->socktype, address->protocol);
+    if(fd == CURL_SOCKET_BAD)
+        return CURL_SOCKET_BAD;
+
+    SocketPtr socket(new Socket(engine->io));
+    boost::system::error_code error;
+    socket->descriptor.assign(fd, error);
+    if(error)
+    {
+        close(fd);
+        return CURL_SOCKET_BAD;
+    }
+
+    engine->sockets[fd] = socket;
+    return fd;
+}
+
+int AsioEngine::closeSocket(void *data, curl_socket_t fd)
+{
+    AsioEngine *engine = static_cast<AsioEngine*>(data);
+
+    map<curl_socket_t, SocketPtr>::iterator socket = engine->sockets.find(fd);
+    if(socket == engine->sockets.end())
+        return close(fd);
+
+    // pending waits complete with operation_aborted
+    boost::system::error_code error;
+    socket->second->wanted = 0;
+    socket->second->descriptor.close(error);
+    engine->sockets.erase(socket);
+    return error ? -1 : 0;
+}
+
+int AsioEngine::onSocket(CURL*, curl_socket_t fd, int what, void *data, void*)
+{
+    AsioEngine *engine = static_cast<AsioEngine*>(data);
+
+    map<curl_socket_t, SocketPtr>::iterator socket = engine->sockets.find(fd);
+    if(socket == engine->sockets.end())
+        return 0;
+
+    // a wait no longer wanted is left to complete and not renewed
+    socket->second->wanted = what == CURL_POLL_REMOVE ? 0 : what;
+    engine->arm(socket->second);
+    return 0;
+}
+
+int AsioEngine::onTimer(CURLM*, long timeout, void *data)
+{
+    AsioEngine *engine = static_cast<AsioEngine*>(data);
+
+    // never acted upon from inside the callback, even for a zero timeout
+    if(timeout == 0)
+    {
+        // frequent, so posted rather than paid for with a timer reset; a
+        // timer still pending only causes a spare timeout action
+        boost::asio::post(engine->strand, boost::bind(&AsioEngine::onTimeout,
+                engine->token, boost::system::error_code()));
+    }
+    else if(timeout > 0)
+    {
+        engine->timer.expires_from_now(boost::posix_time::milliseconds(timeout));
+        engine->timer.async_wait(boost::asio::bind_executor(engine->strand,
+                boost::bind(&AsioEngine::onTimeout, engine->token, _1)));
+    }
+    else
+    {
+        engine->timer.cancel();
+    }
+    return 0;
+}
+
+void AsioEngine::arm(SocketPtr socket)
+{
+    if((socket->wanted & CURL_POLL_IN) && !socket->reading)
+    {
+        socket->reading = true;
+        socket->descriptor.async_wait(Descriptor::wait_read,
+                boost::asio::bind_executor(strand, boost::bind(&AsioEngine::onReady,
+                        token, socket, (int)CURL_CSELECT_IN, _1)));
+    }
+
+    if((socket->wanted & CURL_POLL_OUT) && !socket->writing)
+    {
+        socket->writing = true;
+        socket->descriptor.async_wait(Descriptor::wait_write,
+                boost::asio::bind_executor(strand, boost::bind(&AsioEngine::onReady,
+                        token, socket, (int)CURL_CSELECT_OUT, _1)));
+    }
+}
+
+void AsioEngine::onReady(Token token, SocketPtr socket, int direction,
+        const boost::system::error_code &error)
+{
+    if(direction == CURL_CSELECT_IN)
+        socket->reading = false;
+    else
+        socket->writing = false;
+
+    int wanted = direction == CURL_CSELECT_IN ? CURL_POLL_IN : CURL_POLL_OUT;
+    if(!*token || error || !socket->descriptor.is_open() || !(socket->wanted & wanted))
+        return;
+
+    (*token)->action(socket->descriptor.native_handle(), direction);
+
+    // curl may have closed the socket or changed what it waits for
+    if(*token && socket->descriptor.is_open())
+        (*token)->arm(socket);
+}
+
+void AsioEngine::onTimeout(Token token, const boost::system::error_code &error)
+{
+    if(*token && !error)
+        (*token)->action(CURL_SOCKET_TIMEOUT, 0);
+}
+
+void AsioEngine::action(curl_socket_t fd, int direction)
+{
+    int stillRunning = 0;
+    curl_multi_socket_action(multi, fd, direction, &stillRunning);
+    readMessages();
+}
+
+} //namespace CouchDB
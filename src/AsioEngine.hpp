@@ -0,0 +1,100 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_ASIO_ENGINE_HPP__
+#define __COUCH_DB_ASIO_ENGINE_HPP__
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <map>
+
+#include "AsyncEngine.hpp"
+
+namespace CouchDB
+{
+
+// Drives the multi handle from the caller's io_context: curl reports the
+// sockets it waits on and its timeout through curl_multi_socket_action's
+// callbacks, and those are waited on with Asio, so no thread is added. All
+// curl calls are made on a strand, so the io_context may be run by several
+// threads.
+//
+// Like other Asio I/O objects, it must not be destroyed while the
+// io_context is running one of its handlers.
+class AsioEngine : public AsyncEngine
+{
+public:
+    typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
+
+    AsioEngine(boost::asio::io_context&, const EngineOptions&);
+
+    // Requests still running are cancelled and their handlers called with
+    // an error.
+    ~AsioEngine();
+
+protected:
+    void wakeup();
+    void setupSockets(CURL*);
+
+private:
+    typedef boost::asio::posix::stream_descriptor Descriptor;
+
+    // A socket curl has opened, and the waits pending on it.
+    struct Socket
+    {
+        Socket(boost::asio::io_context &io)
+            : descriptor(io)
+            , wanted(0)
+            , reading(false)
+            , writing(false)
+        {
+        }
+
+        Descriptor descriptor;
+        int        wanted;    // CURL_POLL_* last asked for by curl
+        bool       reading;
+        bool       writing;
+    };
+
+    typedef boost::shared_ptr<Socket>       SocketPtr;
+    typedef boost::shared_ptr<AsioEngine*>  Token;  // NULL once destroyed
+
+    static curl_socket_t openSocket(void*, curlsocktype, struct curl_sockaddr*);
+    static int closeSocket(void*, curl_socket_t);
+    static int onSocket(CURL*, curl_socket_t, int, void*, void*);
+    static int onTimer(CURLM*, long, void*);
+
+    static void onQueued(Token);
+    static void onReady(Token, SocketPtr, int, const boost::system::error_code&);
+    static void onTimeout(Token, const boost::system::error_code&);
+
+    void arm(SocketPtr);
+    void action(curl_socket_t, int);
+
+    boost::asio::io_context                   &io;
+    Strand                                    strand;
+    boost::asio::deadline_timer               timer;
+    std::map<curl_socket_t, SocketPtr>        sockets;
+    Token                                     token;
+};
+
+} //namespace CouchDB
+
+#endif
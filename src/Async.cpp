@@ -0,0 +1,34 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include "couchdb/Async.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+AsyncResponse::AsyncResponse()
+    : status(0)
+{
+}
+
+void AsyncResponse::check() const
+{
+    if(error.size() > 0)
+        throw Exception(error);
+}
+
+} //namespace CouchDB
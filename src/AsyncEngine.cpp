@@ -0,0 +1,431 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <iostream>
+
+#include "couchdb/Exception.hpp"
+
+#include "AsyncEngine.hpp"
+#include "Request.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+// longest wait for activity; submit() and the destructor cut it short
+#define ASYNC_POLL_TIMEOUT_MS 1000
+
+// without curl_multi_wakeup (curl < 7.68) new requests wait for this long
+#define ASYNC_FALLBACK_TIMEOUT_MS 5
+
+EngineOptions::EngineOptions()
+    : httpVersion(CURL_HTTP_VERSION_NONE)
+    , multiplex(false)
+    , maxConnections(0)
+    , headerWriter(NULL)
+    , headerTarget(NULL)
+{
+}
+
+struct AsyncEngine::Transfer
+{
+    Transfer()
+        : curl(NULL)
+        , headerList(NULL)
+        , acceptEncoded(false)
+        , external(false)
+        , result(CURLE_OK)
+    {
+    }
+
+    string            method;
+    string            data;
+    MemorySource      body;     // upload cursor over data
+    HeaderMap         headers;
+    AsyncHandler      handler;
+    AsyncResponse     response;
+    CURL              *curl;
+    struct curl_slist *headerList;
+    bool              acceptEncoded;
+    bool              external;  // the caller's handle, set up by the caller
+    CURLcode          result;    // of libcurl, once the transfer has run
+};
+
+// Completion of a blocking perform().
+struct PerformWait
+{
+    PerformWait()
+        : done(false)
+        , result(CURLE_OK)
+    {
+    }
+
+    static void complete(PerformWait *wait, const CURLcode *result, AsyncResponse &response)
+    {
+        boost::lock_guard<boost::mutex> lock(wait->mutex);
+        wait->error  = response.error;
+        wait->result = *result;
+        wait->done   = true;
+        wait->finished.notify_one();
+    }
+
+    boost::mutex              mutex;
+    boost::condition_variable finished;
+    bool                      done;
+    string                    error;
+    CURLcode                  result;
+};
+
+AsyncEngine::AsyncEngine(const EngineOptions &_options)
+    : multi(curl_multi_init())
+    , options(_options)
+{
+    if(!multi)
+        throw Exception("Unable to create CURL multi object");
+
+    // transfers to the same host share one HTTP/2 connection when they can
+    if((options.multiplex &&
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX) != CURLM_OK) ||
+       curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)options.maxConnections) != CURLM_OK)
+    {
+        curl_multi_cleanup(multi);
+        throw Exception("Unable to set connection options");
+    }
+}
+
+AsyncEngine::~AsyncEngine()
+{
+    shutdown();
+}
+
+void AsyncEngine::setupSockets(CURL*)
+{
+}
+
+void AsyncEngine::setupHandle(CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, options.httpVersion);
+
+    // rather than open a connection of its own, a transfer waits to learn
+    // whether the one being opened can be multiplexed
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, options.multiplex ? 1L : 0L);
+
+    if(options.unixSocket.size() > 0)
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, options.unixSocket.c_str());
+
+    if(options.headerWriter)
+    {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, options.headerWriter);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, options.headerTarget);
+    }
+
+    setupSockets(curl);
+}
+
+string AsyncEngine::perform(CURL *curl, CURLcode &result)
+{
+    PerformWait wait;
+
+    Transfer *transfer = new Transfer();
+    transfer->curl     = curl;
+    transfer->external = true;
+    transfer->handler  = boost::bind(PerformWait::complete, &wait, &transfer->result, _1);
+
+    enqueue(transfer);
+
+    boost::unique_lock<boost::mutex> lock(wait.mutex);
+    while(!wait.done)
+        wait.finished.wait(lock);
+
+    result = wait.result;
+    return wait.error;
+}
+
+void AsyncEngine::submit(const string &url, const string &method,
+        const string &data, const HeaderMap &headers,
+        const AsyncHandler &handler, bool acceptEncoded)
+{
+    Transfer *transfer       = new Transfer();
+    transfer->method         = method;
+    transfer->data           = data;
+    transfer->headers        = headers;
+    transfer->handler        = handler;
+    transfer->response.url   = url;
+    transfer->acceptEncoded  = acceptEncoded;
+
+    enqueue(transfer);
+}
+
+void AsyncEngine::enqueue(Transfer *transfer)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        queued.push_back(transfer);
+    }
+    wakeup();
+}
+
+void AsyncEngine::startQueued()
+{
+    deque<Transfer*> starting;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        starting.swap(queued);
+    }
+
+    for(; !starting.empty(); starting.pop_front())
+        start(starting.front());
+}
+
+void AsyncEngine::readMessages()
+{
+    int      left;
+    CURLMsg *message;
+    while((message = curl_multi_info_read(multi, &left)) != NULL)
+    {
+        if(message->msg != CURLMSG_DONE)
+            continue;
+
+        Transfer *transfer = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+        finish(transfer, message->data.result);
+    }
+}
+
+void AsyncEngine::shutdown()
+{
+    if(!multi)
+        return;
+
+    // cancel whatever is left, running or not yet started
+    deque<Transfer*> starting;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        starting.swap(queued);
+    }
+    while(!running.empty())
+    {
+        Transfer *transfer = *running.begin();
+        transfer->response.error = "Request cancelled: " + transfer->response.url;
+        finish(transfer, CURLE_OK);
+    }
+    for(; !starting.empty(); starting.pop_front())
+    {
+        starting.front()->response.error = "Request cancelled: " + starting.front()->response.url;
+        complete(starting.front());
+    }
+
+    for(size_t i = 0; i < idle.size(); ++i)
+        curl_easy_cleanup(idle[i]);
+    idle.clear();
+
+    curl_multi_cleanup(multi);
+    multi = NULL;
+}
+
+// Sets up an easy handle for the transfer and adds it to the multi handle.
+void AsyncEngine::start(Transfer *transfer)
+{
+    if(transfer->external)
+    {
+        setupHandle(transfer->curl);
+        add(transfer);
+        return;
+    }
+
+    CURL *curl;
+    if(!idle.empty())
+    {
+        curl = idle.back();
+        idle.pop_back();
+    }
+    else if((curl = createHandle()) != NULL)
+    {
+        setupHandle(curl);
+    }
+    else
+    {
+        transfer->response.error = "Unable to create CURL object";
+        complete(transfer);
+        return;
+    }
+
+    try
+    {
+        transfer->body       = MemorySource(transfer->data);
+        transfer->headerList = prepareRequest(curl, transfer->response.url,
+                transfer->method, &transfer->body, transfer->headers,
+                receive, transfer, transfer->acceptEncoded);
+    }
+    catch(const Exception &e)
+    {
+        idle.push_back(curl);
+        transfer->response.error = e.what();
+        complete(transfer);
+        return;
+    }
+
+    transfer->curl = curl;
+    add(transfer);
+}
+
+void AsyncEngine::add(Transfer *transfer)
+{
+    CURL *curl = transfer->curl;
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+
+    if(curl_multi_add_handle(multi, curl) != CURLM_OK)
+    {
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+        if(!transfer->external)
+        {
+            resetRequest(curl, transfer->headerList);
+            idle.push_back(curl);
+        }
+        transfer->response.error = "Unable to start request: " + transfer->response.url;
+        complete(transfer);
+        return;
+    }
+
+    running.insert(transfer);
+}
+
+// Takes a started transfer off the multi handle and reports it.
+void AsyncEngine::finish(Transfer *transfer, CURLcode result)
+{
+    CURL *curl = transfer->curl;
+    curl_multi_remove_handle(multi, curl);
+    running.erase(transfer);
+
+    AsyncResponse &response = transfer->response;
+    transfer->result = result;
+    if(result != CURLE_OK)
+        response.error = "Unable to load URL: " + response.url;
+    else if(response.error.empty() &&
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status) != CURLE_OK)
+        response.error = "Unable to get response code";
+
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, NULL);
+    if(!transfer->external)
+    {
+        resetRequest(curl, transfer->headerList);
+        idle.push_back(curl);
+    }
+
+    complete(transfer);
+}
+
+void AsyncEngine::complete(Transfer *transfer)
+{
+#ifdef COUCH_DB_DEBUG
+    cout << "Async response: " << transfer->response.url << " ["
+         << transfer->response.status << "]" << endl;
+#endif
+
+    try
+    {
+        transfer->handler(transfer->response);
+    }
+    catch(...)
+    {
+        // nowhere to report it; the other transfers must go on
+    }
+
+    delete transfer;
+}
+
+// Write callback appending to the response body, sized up front from the
+// Content-Length when the server sends one.
+size_t AsyncEngine::receive(char *data, size_t size, size_t nmemb, void *_transfer)
+{
+    Transfer *transfer = static_cast<Transfer*>(_transfer);
+    string   &body     = transfer->response.body;
+
+    try
+    {
+        if(body.empty())
+            body.reserve(getContentLength(transfer->curl));
+        body.append(data, size * nmemb);
+    }
+    catch(const std::exception&)
+    {
+        return 0;
+    }
+
+    return size * nmemb;
+}
+
+ThreadEngine::ThreadEngine(const EngineOptions &options)
+    : AsyncEngine(options)
+    , stopping(false)
+{
+    try
+    {
+        thread = boost::thread(boost::bind(&ThreadEngine::run, this));
+    }
+    catch(const boost::thread_resource_error&)
+    {
+        throw Exception("Unable to start the I/O thread");
+    }
+}
+
+ThreadEngine::~ThreadEngine()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    wakeup();
+    thread.join();
+
+    shutdown();
+}
+
+void ThreadEngine::wakeup()
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(multi);
+#endif
+}
+
+bool ThreadEngine::isStopping()
+{
+    boost::lock_guard<boost::mutex> lock(stopMutex);
+    return stopping;
+}
+
+void ThreadEngine::run()
+{
+    while(!isStopping())
+    {
+        startQueued();
+
+        int stillRunning = 0;
+        curl_multi_perform(multi, &stillRunning);
+        readMessages();
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(multi, NULL, 0, ASYNC_POLL_TIMEOUT_MS, NULL);
+#else
+        curl_multi_wait(multi, NULL, 0, ASYNC_FALLBACK_TIMEOUT_MS, NULL);
+#endif
+    }
+}
+
+} //namespace CouchDB
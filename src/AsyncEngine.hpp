@@ -0,0 +1,138 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_ASYNC_ENGINE_HPP__
+#define __COUCH_DB_ASYNC_ENGINE_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "couchdb/Async.hpp"
+
+namespace CouchDB
+{
+
+// Connection settings, fixed for the life of an engine.
+struct EngineOptions
+{
+    EngineOptions();
+
+    long                httpVersion;     // CURL_HTTP_VERSION_*
+    bool                multiplex;       // wait for and share HTTP/2 connections
+    size_t              maxConnections;  // per host, 0 for no limit
+    std::string         unixSocket;      // socket to connect to instead, if any
+    curl_write_callback headerWriter;    // given the response headers of
+    void                *headerTarget;   // every transfer, if set
+};
+
+// Runs requests on a curl multi handle, so any number of them can be in
+// flight without a thread each. Subclasses decide where the multi handle
+// is driven from; handlers are called there as the responses complete.
+class AsyncEngine : boost::noncopyable
+{
+public:
+    typedef std::map<std::string, std::string> HeaderMap;
+
+    virtual ~AsyncEngine();
+
+    // Queues a request; the URL is absolute. Safe to call from any thread,
+    // handlers included.
+    void submit(const std::string &url, const std::string &method,
+            const std::string &data, const HeaderMap&, const AsyncHandler&,
+            bool acceptEncoded);
+
+    // Runs a request already set up on the caller's easy handle, sharing
+    // the engine's connections, and waits for it. Returns an error message,
+    // empty on success, and sets `result` to libcurl's result for the
+    // transfer, CURLE_OK if it never ran. Deadlocks if called from a
+    // handler.
+    std::string perform(CURL*, CURLcode &result);
+
+protected:
+    struct Transfer;
+
+    // Throws Exception if the multi handle cannot be created.
+    explicit AsyncEngine(const EngineOptions&);
+
+    // Called by submit() once the request is queued, so that the driver
+    // calls startQueued() soon.
+    virtual void wakeup() = 0;
+
+    // Called on every easy handle before it is first added.
+    virtual void setupSockets(CURL*);
+
+    // The rest is for the driver only, never to be called concurrently.
+    void startQueued();
+    void readMessages();
+
+    // Cancels whatever is left, frees the handles and the multi handle;
+    // to be called from the subclass destructor once driving has stopped.
+    void shutdown();
+
+    CURLM *multi;
+
+private:
+    void setupHandle(CURL*);
+    void enqueue(Transfer*);
+    void start(Transfer*);
+    void add(Transfer*);
+    void finish(Transfer*, CURLcode);
+    static void complete(Transfer*);
+    static size_t receive(char*, size_t, size_t, void*);
+
+    EngineOptions         options;
+
+    boost::mutex          mutex;
+    std::deque<Transfer*> queued;   // guarded by mutex
+
+    std::set<Transfer*>   running;
+    std::vector<CURL*>    idle;
+};
+
+// Drives the multi handle from a background thread of its own.
+class ThreadEngine : public AsyncEngine
+{
+public:
+    // Throws Exception if the thread cannot be started.
+    explicit ThreadEngine(const EngineOptions&);
+
+    // Stops the thread; requests still running are cancelled and their
+    // handlers called with an error.
+    ~ThreadEngine();
+
+protected:
+    void wakeup();
+
+private:
+    void run();
+    bool isStopping();
+
+    boost::mutex  stopMutex;
+    bool          stopping;
+    boost::thread thread;
+};
+
+} //namespace CouchDB
+
+#endif
@@ -15,6 +15,8 @@
 **/
 #include "couchdb/Attachment.hpp"
 #include "couchdb/Exception.hpp"
+#include "couchdb/Parser.hpp"
+#include "couchdb/Projection.hpp"
 
 using namespace std;
 
@@ -48,7 +50,6 @@ Attachment::~Attachment()
 
 Attachment& Attachment::operator=(Attachment &attachment)
 {
-   comm     = attachment.comm;
    db       = attachment.db;
    document = attachment.document;
    id       = attachment.id;
@@ -72,6 +73,16 @@ const string& Attachment::getContentType() const
    return contentType;
 }
 
+string Attachment::getURL() const
+{
+   string url = "/" + db + "/" + document + "/" + id;
+   if(revision.size() > 0)
+   {
+      url += "?rev=" + revision;
+   }
+   return url;
+}
+
 string Attachment::getData()
 {
    string data;
@@ -82,21 +93,20 @@ string Attachment::getData()
    }
    else
    {
-      string url = "/" + db + "/" + document + "/" + id;
-      if(revision.size() > 0)
-      {
-         url += "?rev=" + revision;
-      }
-      data = comm.getRawData(url);
+      data = comm.getRawData(getURL());
 
       if(data.size() > 0 && data[0] == '{')
       {
          // check to make sure we did not receive an error
-         Object obj = boost::any_cast<Object>(*comm.getData(url));
-         if(obj.find("error") != obj.end() && obj.find("reason") != obj.end())
+         Variant var = parseJSON(data);
+         if(const Object *obj = boost::any_cast<Object>(var.get()))
          {
-            throw Exception("Could not retrieve data for attachment '" + id + "': " +
-                    boost::any_cast<string>(*obj["reason"]));
+            const Variant *reason = find(*obj, "reason");
+            if(find(*obj, "error") && reason)
+            {
+               throw Exception("Could not retrieve data for attachment '" + id + "': " +
+                       as<string>(*reason));
+            }
          }
       }
    }
@@ -104,6 +114,28 @@ string Attachment::getData()
    return data;
 }
 
+void Attachment::getData(ResponseBuffer &buffer)
+{
+   if(rawData.size() > 0)
+   {
+      buffer.clear();
+      buffer.append(rawData.data(), rawData.size());
+      return;
+   }
+
+   long status;
+   comm.getRawData(getURL(), buffer, status);
+
+   if(status >= 400)
+   {
+      string reason;
+      Projection error;
+      error.bind("reason", reason, Projection::BIND_OPTIONAL);
+      error.apply(buffer.data(), buffer.size());
+      throw Exception("Could not retrieve data for attachment '" + id + "': " + reason);
+   }
+}
+
 } //namespace CouchDB
 
 ostream& operator<<(ostream &out, const CouchDB::Attachment &attachment)
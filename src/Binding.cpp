@@ -0,0 +1,229 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <sstream>
+
+#include "couchdb/Binding.hpp"
+#include "couchdb/Parser.hpp"
+
+#include "JSONScalars.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+using ::boost::uint64_t;
+
+namespace CouchDB
+{
+
+JSONCursor::JSONCursor(const char *data, size_t size)
+    : start(data)
+    , cur(data)
+    , end(data + size)
+{
+}
+
+char JSONCursor::peek()
+{
+    while(cur < end && (*cur == ' ' || *cur == '\n' || *cur == '\r' || *cur == '\t'))
+        ++cur;
+    return cur < end ? *cur : 0;
+}
+
+bool JSONCursor::consume(char c)
+{
+    if(peek() != c || cur == end)
+        return false;
+    ++cur;
+    return true;
+}
+
+void JSONCursor::expect(char c)
+{
+    if(!consume(c))
+    {
+        char expected[] = { '\'', c, '\'', 0 };
+        fail(expected);
+    }
+}
+
+void JSONCursor::finish()
+{
+    if(peek() != 0 || cur != end)
+        fail("the end of the document");
+}
+
+bool JSONCursor::readNull()
+{
+    if(peek() != 'n')
+        return false;
+    if(!readJSONLiteral(cur, end, "null", 4))
+        fail("null");
+    return true;
+}
+
+bool JSONCursor::readBoolean()
+{
+    char c = peek();
+    if(c == 't' && readJSONLiteral(cur, end, "true", 4))
+        return true;
+    if(c == 'f' && readJSONLiteral(cur, end, "false", 5))
+        return false;
+    fail("a boolean");
+    return false;
+}
+
+int64_t JSONCursor::readInteger()
+{
+    JSONNumber number;
+    peek();
+
+    const char *pos = cur;
+    if(!readJSONNumber(pos, end, number) || number.isReal)
+        fail("an integer");
+    cur = pos;
+    return number.integer;
+}
+
+// Scanned here rather than by readJSONNumber(), which keeps 19 digits and
+// turns anything past INT64_MAX into a real.
+uint64_t JSONCursor::readUnsigned()
+{
+    peek();
+
+    const char *pos  = cur;
+    uint64_t   value = 0;
+    while(pos < end && *pos >= '0' && *pos <= '9')
+    {
+        unsigned digit = *pos - '0';
+        if(value > (numeric_limits<uint64_t>::max() - digit) / 10)
+            fail("an integer in range");
+        value = value * 10 + digit;
+        ++pos;
+    }
+    if(pos == cur || (*cur == '0' && pos - cur > 1) || !isJSONDelimiter(pos, end))
+        fail("a non-negative integer");
+    cur = pos;
+    return value;
+}
+
+double JSONCursor::readReal()
+{
+    JSONNumber number;
+    peek();
+    if(!readJSONNumber(cur, end, number))
+        fail("a number");
+    return number.isReal ? number.real : (double)number.integer;
+}
+
+void JSONCursor::readString(string &value)
+{
+    const char *str;
+    size_t     length;
+
+    if(!consume('"') || !readJSONString(cur, end, scratch, str, length))
+        fail("a string");
+    value.assign(str, length);
+}
+
+boost::string_view JSONCursor::readKey()
+{
+    const char *str;
+    size_t     length;
+
+    if(!consume('"') || !readJSONString(cur, end, scratch, str, length))
+        fail("a member name");
+    expect(':');
+    return boost::string_view(str, length);
+}
+
+Value JSONCursor::readValue()
+{
+    peek();
+    const char *value = cur;
+    skip();
+    return parseValue(value, cur - value);
+}
+
+Variant JSONCursor::readVariant()
+{
+    peek();
+    const char *value = cur;
+    skip();
+    return parseJSON(value, cur - value);
+}
+
+void JSONCursor::skip()
+{
+    JSONNumber number;
+
+    switch(peek())
+    {
+    case '"':
+        ++cur;
+        if(!skipJSONString(cur, end))
+            fail("a string");
+        return;
+
+    case '{':
+        ++cur;
+        if(consume('}'))
+            return;
+        do
+        {
+            readKey();
+            skip();
+        }
+        while(consume(','));
+        expect('}');
+        return;
+
+    case '[':
+        ++cur;
+        if(consume(']'))
+            return;
+        do
+        {
+            skip();
+        }
+        while(consume(','));
+        expect(']');
+        return;
+
+    case 't':
+    case 'f':
+        readBoolean();
+        return;
+
+    case 'n':
+        readNull();
+        return;
+
+    default:
+        if(!readJSONNumber(cur, end, number))
+            fail("a value");
+        return;
+    }
+}
+
+void JSONCursor::fail(const char *expected)
+{
+    ostringstream message;
+    message << "Invalid JSON document: expected " << expected
+            << " at offset " << (cur - start);
+    throw Exception(message.str());
+}
+
+} //namespace CouchDB
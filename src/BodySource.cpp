@@ -0,0 +1,250 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include "couchdb/BodySource.hpp"
+#include "couchdb/Exception.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+const boost::uint64_t BodySource::UNKNOWN_SIZE;
+
+BodySource::~BodySource()
+{
+}
+
+MemorySource::MemorySource()
+    : data(NULL)
+    , length(0)
+    , position(0)
+{
+}
+
+MemorySource::MemorySource(const char *_data, size_t _length)
+    : data(_data)
+    , length(_length)
+    , position(0)
+{
+}
+
+MemorySource::MemorySource(const string &_data)
+    : data(_data.data())
+    , length(_data.size())
+    , position(0)
+{
+}
+
+boost::uint64_t MemorySource::size() const
+{
+    return length;
+}
+
+size_t MemorySource::read(char *buffer, size_t wanted)
+{
+    size_t copied = length - position;
+    if(copied > wanted)
+        copied = wanted;
+
+    memcpy(buffer, data + position, copied);
+    position += copied;
+    return copied;
+}
+
+bool MemorySource::seek(boost::uint64_t offset)
+{
+    if(offset > length)
+        return false;
+
+    position = (size_t)offset;
+    return true;
+}
+
+FileSource::FileSource(const string &_path)
+    : path(_path)
+    , length(0)
+    , position(0)
+    , mapped(NULL)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw Exception("Unable to open file: " + path);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw Exception("Unable to open file: " + path);
+    }
+    length = info.st_size;
+
+    // the mapping stays valid once the descriptor is closed
+    if(length > 0 && length == (size_t)length)
+    {
+        void *address = mmap(NULL, (size_t)length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(address != MAP_FAILED)
+        {
+            mapped = static_cast<const char*>(address);
+            madvise(address, (size_t)length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+
+    if(mapped || length == 0)
+        return;
+#endif
+
+    // no address space for it, or no mmap: read it as it is sent
+    file.open(path.c_str(), ios::in | ios::binary);
+    if(!file)
+        throw Exception("Unable to open file: " + path);
+
+    file.seekg(0, ios::end);
+    length = file.tellg();
+    file.seekg(0, ios::beg);
+}
+
+FileSource::~FileSource()
+{
+#ifndef _WIN32
+    if(mapped)
+        munmap(const_cast<char*>(mapped), (size_t)length);
+#endif
+}
+
+boost::uint64_t FileSource::size() const
+{
+    return length;
+}
+
+size_t FileSource::read(char *buffer, size_t wanted)
+{
+    if(wanted > length - position)
+        wanted = (size_t)(length - position);
+
+    if(mapped)
+        memcpy(buffer, mapped + position, wanted);
+    else if(wanted > 0 && !file.read(buffer, wanted))
+        throw Exception("Unable to read file: " + path);
+
+    position += wanted;
+    return wanted;
+}
+
+bool FileSource::seek(boost::uint64_t offset)
+{
+    if(offset > length)
+        return false;
+
+    if(!mapped && length > 0)
+    {
+        file.clear();
+        if(!file.seekg((streamoff)offset, ios::beg))
+            return false;
+    }
+
+    position = offset;
+    return true;
+}
+
+BulkDocsSource::BulkDocsSource(const Generator &_generator)
+    : generator(_generator)
+    , state(STATE_OPENING)
+    , offset(0)
+    , count(0)
+    , position(0)
+{
+}
+
+boost::uint64_t BulkDocsSource::size() const
+{
+    return UNKNOWN_SIZE;
+}
+
+size_t BulkDocsSource::read(char *buffer, size_t length)
+{
+    // fills the whole buffer, however many documents that takes
+    size_t copied = 0;
+    while(copied < length)
+    {
+        if(offset == pending.size() && !refill())
+            break;
+
+        size_t chunk = pending.size() - offset;
+        if(chunk > length - copied)
+            chunk = length - copied;
+
+        memcpy(buffer + copied, pending.data() + offset, chunk);
+        offset += chunk;
+        copied += chunk;
+    }
+
+    position += copied;
+    return copied;
+}
+
+// Replaces the text sent with the next piece of the body. Returns false at
+// the end of the body.
+bool BulkDocsSource::refill()
+{
+    // the buffer keeps its capacity, sized by the largest document
+    pending.clear();
+    offset = 0;
+
+    switch(state)
+    {
+    case STATE_OPENING:
+        pending += "{\"docs\":[";
+        state = STATE_WRITING;
+        return true;
+    case STATE_WRITING:
+        if(count > 0)
+            pending += ',';
+        if(generator(pending))
+        {
+            ++count;
+            return true;
+        }
+        pending.assign("]}");
+        state = STATE_CLOSED;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool BulkDocsSource::seek(boost::uint64_t target)
+{
+    // what has been sent is gone
+    return target == position;
+}
+
+size_t BulkDocsSource::getCount() const
+{
+    return count;
+}
+
+} //namespace CouchDB
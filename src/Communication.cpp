@@ -13,12 +13,23 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  **/
+#include <boost/bind.hpp>
 #include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "couchdb/Communication.hpp"
 #include "couchdb/Exception.hpp"
+#include "couchdb/Parser.hpp"
+#include "couchdb/Writer.hpp"
 
-#include "tinyjson/tinyjson.hpp"
+#include "AsioEngine.hpp"
+#include "AsyncEngine.hpp"
+#include "Compression.hpp"
+#include "HandlePool.hpp"
+#include "Request.hpp"
+#include "RequestTracker.hpp"
+#include "Session.hpp"
 
 using namespace std;
 
@@ -26,6 +37,31 @@ namespace CouchDB
 {
 
 #define DEFAULT_COUCHDB_URL "http://localhost:5984"
+#define DEFAULT_MAX_HANDLES 8
+
+CompressionOptions::CompressionOptions()
+    : acceptEncoded(true)
+    , minimumSize(0)
+    , level(1)
+{
+}
+
+RequestPolicy::RequestPolicy()
+    : maxRetries(0)
+    , retryWrites(false)
+    , backoff(100)
+    , maxBackoff(5000)
+    , hedgePercentile(0)
+{
+}
+
+RequestMetrics::RequestMetrics()
+    : requests(0)
+    , retries(0)
+    , hedged(0)
+    , hedgesWon(0)
+{
+}
 
 template<>
 Variant createVariant<const char*>(const char *value)
@@ -33,9 +69,9 @@ Variant createVariant<const char*>(const char *value)
     return createVariant<std::string>(std::string(value));
 }
 
-static Variant parseData(const string &buffer)
+static Variant parseData(const char *data, size_t size)
 {
-    Variant var = ::json::parse(buffer.begin(), buffer.end());
+    Variant var = parseJSON(data, size);
 
 #ifdef COUCH_DB_DEBUG
     cout << "Data:" << endl
@@ -45,72 +81,266 @@ static Variant parseData(const string &buffer)
     return var;
 }
 
-static size_t writer(char *data, size_t size, size_t nmemb, string *dest)
+// Response state of a streamed request. Exceptions must not cross curl, so
+// one thrown by the handler is kept here and rethrown once curl returns.
+struct StreamTarget
 {
-    size_t written = 0;
-    if(dest != NULL)
+    StreamTarget(JSONHandler &handler)
+        : parser(handler)
+        , invalid(false)
+        , thrown(false)
     {
-        written = size * nmemb;
-        dest->append(data, written);
     }
 
-    return written;
+    StreamParser parser;
+    bool         invalid;
+    bool         thrown;
+    string       error;
+};
+
+static size_t streamWriter(char *data, size_t size, size_t nmemb, void *_target)
+{
+    StreamTarget *target = static_cast<StreamTarget*>(_target);
+
+    try
+    {
+        if(!target->parser.feed(data, size * nmemb))
+        {
+            target->invalid = true;
+            return 0;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        target->thrown = true;
+        target->error  = e.what();
+        return 0;
+    }
+
+    return size * nmemb;
 }
 
-static size_t reader(void *ptr, size_t size, size_t nmemb, string *stream)
+// Write callback filling the handle's buffer, sized up front from the
+// Content-Length when the server sends one so that it is not copied as it
+// grows. Failing to map a temporary file aborts the transfer.
+static size_t bufferResponse(char *data, size_t size, size_t nmemb, void *_handle)
 {
-    size_t actual  = stream->size();
-    size_t written = size * nmemb;
-    if(written > actual)
+    PooledHandle *handle = static_cast<PooledHandle*>(_handle);
+
+    try
+    {
+        if(handle->buffer.empty())
+            handle->buffer.reserve(handle->response ? handle->response->length
+                                                    : getContentLength(handle->curl));
+        handle->buffer.append(data, size * nmemb);
+    }
+    catch(const std::exception&)
     {
-        written = actual;
+        return 0;
     }
-    memcpy(ptr, stream->c_str(), written);
-    stream->erase(0, written);
-    return written;
+
+    return size * nmemb;
 }
 
-Communication::Communication()
+// Response state of a request made during a session: the body of a 401
+// that is going to be retried is dropped rather than handed over.
+struct SignedTarget
 {
-    init(DEFAULT_COUCHDB_URL);
+    SignedTarget(PooledHandle &_handle, curl_write_callback _write, void *_target,
+            bool _retry)
+        : handle(_handle)
+        , write(_write)
+        , target(_target)
+        , retry(_retry)
+    {
+    }
+
+    PooledHandle        &handle;
+    curl_write_callback write;
+    void                *target;
+    bool                retry;
+};
+
+// status of the response the handle is receiving
+static long getStatus(PooledHandle &handle)
+{
+    long status = 0;
+    if(handle.response)
+        status = handle.response->status;
+    else
+        curl_easy_getinfo(handle.curl, CURLINFO_RESPONSE_CODE, &status);
+    return status;
 }
 
-Communication::Communication(const string &url)
+static size_t writeSigned(char *data, size_t size, size_t nmemb, void *_target)
 {
-    init(url);
+    SignedTarget *target = static_cast<SignedTarget*>(_target);
+
+    if(target->retry && getStatus(target->handle) == 401)
+        return size * nmemb;
+
+    return target->write(data, size, nmemb, target->target);
 }
 
-void Communication::init(const string &url)
+static bool isRetriable(const string &method, const RequestPolicy &policy)
 {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    if(method == "GET" || method == "HEAD")
+        return true;
+    return policy.retryWrites && (method == "PUT" || method == "DELETE");
+}
 
-    curl = curl_easy_init();
-    if(!curl)
+// Failures of the connection rather than of the request as made, such as a
+// writer aborting, which would only fail the same way again.
+static bool isConnectionFailure(CURLcode result)
+{
+    switch(result)
     {
-        throw Exception("Unable to create CURL object");
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_HTTP2:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
     }
+}
+
+static void checkLoaded(CURLcode result, const string &url)
+{
+    if(result == CURLE_OK)
+        return;
+    if(isConnectionFailure(result))
+        throw TransportException("Unable to load URL: " + url);
+    throw Exception("Unable to load URL: " + url);
+}
 
-    //curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
+// answers of a server, or a proxy in front of it, that is overloaded or
+// briefly away
+static bool isTransient(long status)
+{
+    return status == 502 || status == 503 || status == 504;
+}
 
-    if(curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writer) != CURLE_OK)
+// Response state of a request that may be sent again: the body of a
+// transient failure about to be retried is dropped, and whether any of a
+// response has been handed over is noted, as it cannot be taken back.
+struct RetryTarget
+{
+    RetryTarget(PooledHandle &_handle, curl_write_callback _write, void *_target)
+        : handle(_handle)
+        , write(_write)
+        , target(_target)
+        , retry(false)
+        , delivered(false)
     {
-        throw Exception("Unable to set writer function");
     }
 
-    if(curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer) != CURLE_OK)
+    PooledHandle        &handle;
+    curl_write_callback write;
+    void                *target;
+    bool                retry;
+    bool                delivered;
+};
+
+static size_t writeRetried(char *data, size_t size, size_t nmemb, void *_target)
+{
+    RetryTarget *target = static_cast<RetryTarget*>(_target);
+
+    if(target->retry && isTransient(getStatus(target->handle)))
+        return size * nmemb;
+
+    target->delivered = true;
+    return target->write(data, size, nmemb, target->target);
+}
+
+// An asynchronous request made during a session, kept until it completes
+// so that it can be sent again after logging in.
+struct SignedRequest
+{
+    string                   url;
+    string                   method;
+    string                   data;
+    Communication::HeaderMap headers;
+    AsyncHandler             handler;
+    bool                     acceptEncoded;
+    string                   cookie;    // sent with it
+    bool                     retried;   // after logging in for it
+};
+
+static Variant decodeData(AsyncResponse &response)
+{
+    response.check();
+    return parseData(response.body.data(), response.body.size());
+}
+
+static string decodeRawData(AsyncResponse &response)
+{
+    response.check();
+    return response.body;
+}
+
+// Undoes what a request set on its handle, even when it failed, so the
+// handle goes back to the pool ready for the next one.
+class RequestScope
+{
+public:
+    RequestScope(PooledHandle &_handle)
+        : handle(_handle)
+        , headers(NULL)
+    {
+    }
+
+    ~RequestScope()
     {
-        throw Exception("Unable to set write buffer");
+        resetRequest(handle.curl, headers);
     }
+
+    PooledHandle      &handle;
+    struct curl_slist *headers;
+};
+
+Communication::Communication()
+    : session(new Session())
+    , loggingIn(false)
+    , ioContext(NULL)
+    , httpVersion(HTTP_DEFAULT)
+    , maxConnections(0)
+    , spillThreshold(0)
+{
+    init(DEFAULT_COUCHDB_URL);
+}
+
+Communication::Communication(const string &url)
+    : session(new Session())
+    , loggingIn(false)
+    , ioContext(NULL)
+    , httpVersion(HTTP_DEFAULT)
+    , maxConnections(0)
+    , spillThreshold(0)
+{
+    init(url);
+}
+
+void Communication::init(const string &url)
+{
+    initCurl();
+
+    pool.reset(new HandlePool(DEFAULT_MAX_HANDLES));
+    tracker.reset(new RequestTracker());
     baseURL = url;
 }
 
 Communication::~Communication()
 {
-    if(curl)
-    {
-        curl_easy_cleanup(curl);
-    }
-    curl_global_cleanup();
+    engine.reset();
+    pool.reset();
 }
 
 Variant Communication::getData(const string &url, const string &method, const string &data)
@@ -124,192 +354,890 @@ Variant Communication::getData(const string &url, const HeaderMap &headers,
     return getData(url, method, data, headers);
 }
 
+ValuePtr Communication::getValue(const string &url, const string &method, const string &data)
+{
+    HeaderMap headers;
+    return getValue(url, headers, method, data);
+}
+
+ValuePtr Communication::getValue(const string &url, const HeaderMap &headers,
+        const string &method, const string &data)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, data, headers, bufferResponse, &*handle);
+
+    // a borrowing tree takes a buffer held in memory over rather than
+    // copying it
+    string text;
+    if(parseOptions.borrowStrings && handle->buffer.swap(text))
+        return parseTreeSwap(text, parseOptions);
+    return parseTree(handle->buffer.data(), handle->buffer.size(), parseOptions);
+}
+
+void Communication::getProjection(const string &url, Projection &projection,
+        const string &method, const string &data)
+{
+    HeaderMap headers;
+    getProjection(url, headers, projection, method, data);
+}
+
+void Communication::getProjection(const string &url, const HeaderMap &headers,
+        Projection &projection, const string &method, const string &data)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, data, headers, bufferResponse, &*handle);
+    if(!projection.apply(handle->buffer.data(), handle->buffer.size()))
+        throw Exception("Invalid JSON document");
+}
+
+void Communication::getReply(const string &url, WriteReply &reply,
+        const string &method, const string &data)
+{
+    HeaderMap headers;
+    getReply(url, headers, reply, method, data);
+}
+
+void Communication::getReply(const string &url, const HeaderMap &headers,
+        WriteReply &reply, const string &method, const string &data)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, data, headers, bufferResponse, &*handle);
+    readWriteReply(handle->buffer.data(), handle->buffer.size(), reply);
+}
+
+void Communication::getReply(const string &url, const HeaderMap &headers,
+        WriteReply &reply, const string &method, BodySource &body)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, &body, headers, bufferResponse, &*handle);
+    readWriteReply(handle->buffer.data(), handle->buffer.size(), reply);
+}
+
+void Communication::getReply(const string &url, const HeaderMap &headers,
+        vector<WriteReply> &replies, const string &method, BodySource &body)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, &body, headers, bufferResponse, &*handle);
+    readWriteReplies(handle->buffer.data(), handle->buffer.size(), replies);
+}
+
+void Communication::getReply(const string &url, DocumentList &list)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, "GET", "", HeaderMap(), bufferResponse, &*handle);
+    readDocumentList(handle->buffer.data(), handle->buffer.size(), list);
+}
+
+void Communication::streamData(const string &url, JSONHandler &handler,
+        const string &method, const string &data)
+{
+    HeaderMap headers;
+    streamData(url, headers, handler, method, data);
+}
+
+void Communication::streamData(const string &url, const HeaderMap &headers,
+        JSONHandler &handler, const string &method, const string &data)
+{
+    StreamTarget target(handler);
+    HandleLease  handle(*pool);
+
+    try
+    {
+        perform(*handle, url, method, data, headers, streamWriter, &target);
+    }
+    catch(const Exception&)
+    {
+        if(!target.invalid && !target.thrown)
+            throw;
+    }
+
+    if(target.thrown)
+        throw Exception(target.error);
+
+    if(target.invalid || !target.parser.finish())
+        throw Exception("Invalid JSON document");
+}
+
+void Communication::setTransport(const boost::shared_ptr<Transport> &_transport)
+{
+    transport = _transport;
+}
+
+const boost::shared_ptr<Transport>& Communication::getTransport() const
+{
+    return transport;
+}
+
+void Communication::setParseOptions(const ParseOptions &options)
+{
+    parseOptions = options;
+}
+
+const ParseOptions& Communication::getParseOptions() const
+{
+    return parseOptions;
+}
+
+void Communication::setCompression(const CompressionOptions &options)
+{
+    compression = options;
+}
+
+const CompressionOptions& Communication::getCompression() const
+{
+    return compression;
+}
+
+void Communication::setRequestPolicy(const RequestPolicy &_policy)
+{
+    policy = _policy;
+}
+
+const RequestPolicy& Communication::getRequestPolicy() const
+{
+    return policy;
+}
+
+RequestMetrics Communication::getRequestMetrics() const
+{
+    return tracker->getMetrics();
+}
+
+void Communication::setSpillThreshold(size_t bytes)
+{
+    spillThreshold = bytes;
+}
+
+size_t Communication::getSpillThreshold() const
+{
+    return spillThreshold;
+}
+
+// Gzips a request body long enough to be worth it, unless the caller has
+// encoded it already. Returns whether it did, leaving the compressed body
+// in `compressed` and a copy of the headers naming the encoding in
+// `encoded`.
+bool Communication::encodeBody(const string &data, const HeaderMap &headers,
+        string &compressed, HeaderMap &encoded) const
+{
+    if(compression.minimumSize == 0 || data.size() < compression.minimumSize ||
+       headers.find("Content-Encoding") != headers.end())
+        return false;
+
+    compressed = gzipCompress(data, compression.level);
+
+    encoded = headers;
+    encoded["Content-Encoding"] = "gzip";
+    return true;
+}
+
 string Communication::getRawData(const string &url)
+{
+    long responseCode;
+    return getRawData(url, responseCode);
+}
+
+string Communication::getRawData(const string &url, long &responseCode)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, "GET", "", HeaderMap(), bufferResponse, &*handle);
+    responseCode = handle->responseCode;
+
+    // hand the body over instead of copying it, unless it is mapped
+    string data;
+    if(!handle->buffer.swap(data))
+        data.assign(handle->buffer.data(), handle->buffer.size());
+    return data;
+}
+
+void Communication::getRawData(const string &url, ResponseBuffer &buffer)
+{
+    long responseCode;
+    getRawData(url, buffer, responseCode);
+}
+
+void Communication::getRawData(const string &url, ResponseBuffer &buffer,
+        long &responseCode)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, "GET", "", HeaderMap(), bufferResponse, &*handle);
+    responseCode = handle->responseCode;
+
+    // the handle keeps nothing of the caller's previous body
+    buffer.swap(handle->buffer);
+    handle->buffer.clear();
+}
+
+Async<Variant>::Future Communication::getDataAsync(const string &url,
+        const string &method, const string &data,
+        const Async<Variant>::Callback &callback)
+{
+    return requestAsync<Variant>(url, decodeData, callback, method, data);
+}
+
+Async<string>::Future Communication::getRawDataAsync(const string &url,
+        const string &method, const string &data,
+        const Async<string>::Callback &callback)
+{
+    return requestAsync<string>(url, decodeRawData, callback, method, data);
+}
+
+void Communication::requestAsync(const string &url, const AsyncHandler &handler,
+        const string &method, const string &data)
 {
     HeaderMap headers;
-    getRawData(url, "GET", "", headers);
-    return buffer;
+    requestAsync(url, headers, handler, method, data);
 }
 
-Variant Communication::getData(const string &url, const string &method,
-        string data, const HeaderMap &headers)
+void Communication::requestAsync(const string &url, const HeaderMap &headers,
+        const AsyncHandler &handler, const string &method, const string &data)
 {
-    getRawData(url, method, data, headers);
-    return parseData(buffer);
+    // compressed here rather than on the I/O thread, which serves everyone
+    string    compressed;
+    HeaderMap encoded;
+    bool      gzipped = encodeBody(data, headers, compressed, encoded);
+
+    if(session->isOpen())
+    {
+        boost::shared_ptr<SignedRequest> request(new SignedRequest());
+        request->url           = baseURL + url;
+        request->method        = method;
+        request->data          = gzipped ? compressed : data;
+        request->headers       = gzipped ? encoded : headers;
+        request->handler       = handler;
+        request->acceptEncoded = compression.acceptEncoded;
+        request->retried       = false;
+
+        // renewed in the background while the current cookie still works
+        if(session->isDue())
+            renewSessionAsync(boost::shared_ptr<SignedRequest>());
+        submitSigned(request);
+        return;
+    }
+
+    if(gzipped)
+        getEngine().submit(baseURL + url, method, compressed, encoded, handler,
+                compression.acceptEncoded);
+    else
+        getEngine().submit(baseURL + url, method, data, headers, handler,
+                compression.acceptEncoded);
 }
 
-void Communication::getRawData(const string &_url, const string &method,
-        string data, const HeaderMap &headers)
+void Communication::submitSigned(const boost::shared_ptr<SignedRequest> &request)
 {
-    string url = baseURL + _url;
+    session->getCookie(request->cookie);
+    request->headers["Cookie"] = request->cookie;
+    getEngine().submit(request->url, request->method, request->data, request->headers,
+            boost::bind(&Communication::completeSigned, this, request, _1),
+            request->acceptEncoded);
+}
 
-#ifdef COUCH_DB_DEBUG
-    cout << "Getting data: " << url << " [" << method << "]" << endl;
-#endif
+// Logs in without blocking, unless a login is already on its way; the
+// request, if any, is sent again once it completes.
+void Communication::renewSessionAsync(const boost::shared_ptr<SignedRequest> &request)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(awaitingMutex);
+        if(request)
+            awaitingLogin.push_back(request);
+        if(loggingIn)
+            return;
+        loggingIn = true;
+    }
 
-    buffer.clear();
+    getEngine().submit(baseURL + SESSION_PATH, "POST", session->getLoginBody(),
+            HeaderMap(), boost::bind(&Communication::completeLogin, this,
+                                     session->getRenewals(), _1), false);
+}
 
-    if(curl_easy_setopt(curl, CURLOPT_URL, url.c_str()) != CURLE_OK)
+// Runs on the I/O thread: a request refused with the cookie it was sent is
+// sent again straight away if the cookie has been renewed meanwhile, and
+// once more after logging in otherwise.
+void Communication::completeSigned(const boost::shared_ptr<SignedRequest> &request,
+        AsyncResponse &response)
+{
+    if(response.error.empty() && response.status == 401 && !request->retried)
     {
-        throw Exception("Unable to set URL: " + url);
+        string cookie;
+        session->getCookie(cookie);
+        if(cookie != request->cookie)
+            submitSigned(request);
+        else
+            renewSessionAsync(request);
+        return;
     }
 
-    if(data.size() > 0)
+    request->handler(response);
+}
+
+void Communication::completeLogin(size_t renewals, AsyncResponse &response)
+{
+    vector<boost::shared_ptr<SignedRequest> > waiting;
     {
-#ifdef COUCH_DB_DEBUG
-        cout << "Sending data: " << data << endl;
-#endif
+        boost::lock_guard<boost::mutex> lock(awaitingMutex);
+        waiting.swap(awaitingLogin);
+        loggingIn = false;
+    }
 
-        if(curl_easy_setopt(curl, CURLOPT_READFUNCTION, reader) != CURLE_OK)
-            throw Exception("Unable to set read function");
+    bool renewed = response.error.empty() && response.status == 200 &&
+                   session->getRenewals() > renewals;
 
-        if(curl_easy_setopt(curl, CURLOPT_READDATA, &data) != CURLE_OK)
-            throw Exception("Unable to set data: " + data);
+    AsyncResponse failed;
+    failed.error = response.error.size() > 0 ? response.error
+                                             : "Unable to log in: " + response.body;
 
-        if(curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L) != CURLE_OK)
-            throw Exception("Unable to set upload request");
+    for(size_t i = 0; i < waiting.size(); ++i)
+    {
+        try
+        {
+            if(renewed)
+            {
+                waiting[i]->retried = true;
+                submitSigned(waiting[i]);
+            }
+            else
+            {
+                failed.url = waiting[i]->url;
+                waiting[i]->handler(failed);
+            }
+        }
+        catch(...)
+        {
+            // as for any handler; the other requests must go on
+        }
+    }
+}
 
-        if(curl_easy_setopt(curl, CURLOPT_INFILESIZE, (long)data.size()) != CURLE_OK)
-            throw Exception("Unable to set content size: " + data.size());
+void Communication::setIOContext(boost::asio::io_context &io)
+{
+    boost::lock_guard<boost::mutex> lock(engineMutex);
+    if(engine)
+        throw Exception("Asynchronous requests have already been made");
+    ioContext = &io;
+}
+
+void Communication::setHTTPVersion(HTTPVersion version)
+{
+    if(version == HTTP_2 || version == HTTP_2_PRIOR_KNOWLEDGE)
+    {
+        if(!(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+            throw Exception("libcurl was built without HTTP/2 support");
     }
 
-    if(headers.size() > 0 || data.size() > 0)
+    boost::lock_guard<boost::mutex> lock(engineMutex);
+    if(engine)
+        throw Exception("Asynchronous requests have already been made");
+    httpVersion = version;
+}
+
+void Communication::setUnixSocket(const string &path)
+{
+    if(path.size() > 0 &&
+       !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_UNIX_SOCKETS))
+        throw Exception("libcurl was built without Unix socket support");
+
+    boost::lock_guard<boost::mutex> lock(engineMutex);
+    if(engine)
+        throw Exception("Asynchronous requests have already been made");
+    unixSocket = path;
+}
+
+const string& Communication::getUnixSocket() const
+{
+    return unixSocket;
+}
+
+Communication::HTTPVersion Communication::getHTTPVersion() const
+{
+    return httpVersion;
+}
+
+void Communication::setMaxConnections(size_t connections)
+{
+    boost::lock_guard<boost::mutex> lock(engineMutex);
+    if(engine)
+        throw Exception("Asynchronous requests have already been made");
+    maxConnections = connections;
+}
+
+static long curlHTTPVersion(Communication::HTTPVersion version)
+{
+    switch(version)
     {
-        struct curl_slist *chunk = NULL;
+    case Communication::HTTP_1_1:
+        return CURL_HTTP_VERSION_1_1;
+    case Communication::HTTP_2:
+        return CURL_HTTP_VERSION_2TLS;
+    case Communication::HTTP_2_PRIOR_KNOWLEDGE:
+        return CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+    default:
+        return CURL_HTTP_VERSION_NONE;
+    }
+}
+
+bool Communication::isMultiplexed() const
+{
+    return httpVersion == HTTP_2 || httpVersion == HTTP_2_PRIOR_KNOWLEDGE;
+}
 
-        HeaderMap::const_iterator header = headers.begin();
-        const HeaderMap::const_iterator &headerEnd = headers.end();
-        for(; header != headerEnd; ++header){
-            string headerStr = header->first + ": " + header->second;
-            chunk = curl_slist_append(chunk, headerStr.c_str());
+AsyncEngine& Communication::getEngine()
+{
+    boost::lock_guard<boost::mutex> lock(engineMutex);
+    if(!engine)
+    {
+        EngineOptions options;
+        options.httpVersion    = curlHTTPVersion(httpVersion);
+        options.multiplex      = isMultiplexed();
+        options.maxConnections = maxConnections;
+        options.unixSocket     = unixSocket;
+        options.headerWriter   = Session::readHeader;
+        options.headerTarget   = session.get();
+
+        if(ioContext)
+            engine.reset(new AsioEngine(*ioContext, options));
+        else
+            engine.reset(new ThreadEngine(options));
+    }
+    return *engine;
+}
+
+long Communication::getResponseCode() const
+{
+    return pool->getLastResponseCode();
+}
+
+void Communication::setMaxHandles(size_t maxHandles)
+{
+    pool->setMaxHandles(maxHandles);
+}
+
+size_t Communication::getMaxHandles() const
+{
+    return pool->getMaxHandles();
+}
+
+Variant Communication::getData(const string &url, const string &method,
+        const string &data, const HeaderMap &headers)
+{
+    HandleLease handle(*pool);
+    perform(*handle, url, method, data, headers, bufferResponse, &*handle);
+    return parseData(handle->buffer.data(), handle->buffer.size());
+}
+
+void Communication::perform(PooledHandle &handle, const string &url,
+        const string &method, const string &data, const HeaderMap &headers,
+        curl_write_callback write, void *target)
+{
+    string    compressed;
+    HeaderMap encoded;
+    bool      gzipped = encodeBody(data, headers, compressed, encoded);
+
+    // sent straight from the caller's string, or the compressed copy
+    MemorySource body(gzipped ? compressed : data);
+    perform(handle, url, method, &body, gzipped ? encoded : headers, write, target);
+}
+
+// Sends the request again, after a random wait, while it fails in a way
+// the policy allows retrying.
+void Communication::perform(PooledHandle &handle, const string &url,
+        const string &method, BodySource *body, const HeaderMap &headers,
+        curl_write_callback write, void *target)
+{
+    tracker->countRequest();
+
+    // the handle's buffer is cleared for every attempt, whatever reached
+    // another target stays there; a body of unknown size is generated as
+    // it is sent
+    bool     buffered = write == bufferResponse && target == &handle;
+    unsigned retries  = isRetriable(method, policy) &&
+                        (!body || body->size() != BodySource::UNKNOWN_SIZE) ? policy.maxRetries : 0;
+    bool     hedging  = policy.hedgePercentile > 0 && method == "GET" && buffered &&
+                        (!body || body->size() == 0) && !transport && !isMultiplexed();
+
+    RetryTarget retryTarget(handle, write, target);
+    for(unsigned attempt = 0;; ++attempt)
+    {
+        retryTarget.retry = attempt < retries;
+        try
+        {
+            performSigned(handle, url, method, body, headers, writeRetried, &retryTarget, hedging);
+            if(!retryTarget.retry || !isTransient(handle.responseCode))
+                return;
+        }
+        catch(const TransportException&)
+        {
+            if(!retryTarget.retry || (retryTarget.delivered && !buffered))
+                throw;
         }
 
-        if(data.size() > 0 && headers.find("Content-Type") == headers.end())
-            chunk = curl_slist_append(chunk, "Content-Type: application/json");
+        tracker->countRetry();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(
+                tracker->getBackoff(attempt + 1, policy.backoff, policy.maxBackoff)));
+        if(body && !body->seek(0))
+            throw Exception("Unable to send request body again: " + url);
+    }
+}
 
-        if(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk) != CURLE_OK)
-            throw Exception("Unable to set custom headers");
+void Communication::performSigned(PooledHandle &handle, const string &url,
+        const string &method, BodySource *body, const HeaderMap &headers,
+        curl_write_callback write, void *target, bool hedging)
+{
+    string cookie;
+    if(!session->getCookie(cookie))
+    {
+        send(handle, url, method, body, headers, write, target, false, hedging);
+        return;
     }
 
-    if(curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str()) != CURLE_OK)
-        throw Exception("Unable to set HTTP method: " + method);
+    // an expired cookie would only be refused
+    if(session->isDue())
+        renewSession(handle, cookie);
+
+    // a body of unknown size is generated as it is sent, so it cannot be
+    // sent again
+    SignedTarget signedTarget(handle, write, target,
+                              !body || body->size() != BodySource::UNKNOWN_SIZE);
+    HeaderMap    signedHeaders(headers);
+    for(;;)
+    {
+        signedHeaders["Cookie"] = cookie;
+        send(handle, url, method, body, signedHeaders, writeSigned, &signedTarget, true, hedging);
+        if(handle.responseCode != 401 || !signedTarget.retry)
+            return;
 
-    if(curl_easy_perform(curl) != CURLE_OK)
-        throw Exception("Unable to load URL: " + url);
+        // a cookie renewed by another request may have been refused as
+        // well; only a refusal right after logging in is final
+        signedTarget.retry = !renewSession(handle, cookie);
+        if(body && !body->seek(0))
+            throw Exception("Unable to send request body again: " + url);
+    }
+}
 
-    if(data.size() > 0 || headers.size() > 0){
-        if(curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L) != CURLE_OK)
-            throw Exception("Unable to reset upload request");
+// Logs in with the handle; the cookie is picked up from the response
+// headers. Throws Exception if the server refuses.
+void Communication::openSession(PooledHandle &handle)
+{
+    string       body     = session->getLoginBody();
+    size_t       renewals = session->getRenewals();
+    MemorySource source(body);
+    send(handle, SESSION_PATH, "POST", &source, HeaderMap(), bufferResponse, &handle, true, false);
 
-        if(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL) != CURLE_OK)
-            throw Exception("Unable to reset custom headers");
+    if(handle.responseCode != 200)
+    {
+        string reason;
+        Projection error;
+        error.bind("reason", reason, Projection::BIND_OPTIONAL);
+        error.apply(handle.buffer.data(), handle.buffer.size());
+        throw Exception("Unable to log in: " + reason);
     }
 
-#ifdef COUCH_DB_DEBUG
-    long responseCode;
-    if(curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) != CURLE_OK)
-        throw Exception("Unable to get response code");
+    if(session->getRenewals() == renewals)
+        throw Exception("Unable to log in: no session cookie in the response");
+}
 
-    cout << "Response code: " << responseCode << endl;
-    cout << "Raw buffer: " << buffer;
-#endif
+// Replaces the refused cookie with the one to send from now on, logging in
+// again unless the cookie was renewed while this thread waited. Returns
+// whether it logged in.
+bool Communication::renewSession(PooledHandle &handle, string &cookie)
+{
+    boost::mutex::scoped_lock lock(session->loginMutex);
+
+    string refused(cookie);
+    session->getCookie(cookie);
+    if(cookie != refused)
+        return false;
+
+    openSession(handle);
+    session->getCookie(cookie);
+    return true;
 }
 
-static void printHelper(ostream &out, const boost::any &value, string indent)
+void Communication::login(const string &name, const string &password)
 {
-    string childIndent = indent + "   ";
+    session->open(name, password);
 
-    if(value.empty())
+    try
     {
-        out << "null";
+        HandleLease handle(*pool);
+        boost::mutex::scoped_lock lock(session->loginMutex);
+        openSession(*handle);
     }
-    else
+    catch(...)
     {
-        const type_info &type = value.type();
-        if(type == typeid(string))
-            out << '"' << boost::any_cast<string>(value) << '"';
-        else if(type == typeid(bool))
-            out << boost::any_cast<bool>(value);
-        else if(type == typeid(::boost::int32_t))
-            out << boost::any_cast< ::boost::int32_t>(value);
-        else if(type == typeid(::boost::int64_t))
-            out << boost::any_cast< ::boost::int64_t >(value);
-        else if(type == typeid(double))
-            out << boost::any_cast<double>(value);
-        else if(type == typeid(Object)){
-            Object obj = boost::any_cast<Object>(value);
-
-            out << "{";
-#ifdef COUCH_DB_DEBUG
-            out << endl;
-#endif
+        session->close();
+        throw;
+    }
+}
 
-            bool addComma = false;
-            Object::iterator        data     = obj.begin();
-            const Object::iterator &data_end = obj.end();
-            for(; data != data_end; ++data){
-                if(addComma)
-                    out << ",";
-                else
-                    addComma = true;
-#ifdef COUCH_DB_DEBUG
-                out << childIndent;
-#endif
-                out << '"' << data->first << "\": ";
-                printHelper(out, *data->second, childIndent);
-#ifdef COUCH_DB_DEBUG
-                out << endl;
-#endif
-            }
+void Communication::logout()
+{
+    string cookie;
+    if(!session->getCookie(cookie))
+        return;
+    session->close();
 
-#ifdef COUCH_DB_DEBUG
-            out << indent;
-#endif
-            out << "}";
+    HeaderMap headers;
+    headers["Cookie"] = cookie;
+
+    HandleLease handle(*pool);
+    send(*handle, SESSION_PATH, "DELETE", NULL, headers, bufferResponse, &*handle, false, false);
+}
+
+void Communication::setSessionRefresh(unsigned seconds)
+{
+    session->setRefresh(seconds);
+}
+
+unsigned Communication::getSessionRefresh() const
+{
+    return session->getRefresh();
+}
+
+void Communication::send(PooledHandle &handle, const string &_url,
+        const string &method, BodySource *body, const HeaderMap &headers,
+        curl_write_callback write, void *target, bool signing, bool hedging)
+{
+    string url = baseURL + _url;
+
+    RequestScope scope(handle);
+    handle.buffer.clear();
+    handle.buffer.setSpillThreshold(spillThreshold);
+    handle.responseCode = 0;
+
+    if(transport)
+    {
+        Transport::Request  request(url, method, headers, body, unixSocket,
+                                    compression.acceptEncoded);
+        Transport::Response response(write, target);
+        if(signing)
+        {
+            response.header       = Session::readHeader;
+            response.headerTarget = session.get();
         }
-        else if(type == typeid(Array)){
-            Array array = boost::any_cast<Array>(value);
 
-            out << "[";
-#ifdef COUCH_DB_DEBUG
-            out << endl;
-#endif
+        handle.response = &response;
+        try
+        {
+            transport->perform(request, response);
+        }
+        catch(...)
+        {
+            handle.response = NULL;
+            throw;
+        }
+        handle.response     = NULL;
+        handle.responseCode = response.status;
+        return;
+    }
 
-            bool addComma = false;
-            Array::iterator        data     = array.begin();
-            const Array::iterator &data_end = array.end();
-            for(; data != data_end; ++data){
-                if(addComma)
-                    out << ",";
-                else
-                    addComma = true;
-#ifdef COUCH_DB_DEBUG
-                out << childIndent;
-#endif
-                printHelper(out, **data, childIndent);
-#ifdef COUCH_DB_DEBUG
-                out << endl;
-#endif
-            }
+    scope.headers = prepareHandle(handle, url, method, body, headers, write, target, signing);
+
+    if(isMultiplexed())
+    {
+        // shares the I/O thread's connections with every other request
+        CURLcode result;
+        if(getEngine().perform(handle.curl, result).size() > 0)
+        {
+            checkLoaded(result, url);
+            throw Exception("Unable to load URL: " + url);
+        }
+    }
+    else if(hedging)
+    {
+        // the response code is that of whichever copy answered
+        performHedged(handle, url, headers, signing);
+        return;
+    }
+    else
+        checkLoaded(curl_easy_perform(handle.curl), url);
+
+    if(curl_easy_getinfo(handle.curl, CURLINFO_RESPONSE_CODE, &handle.responseCode) != CURLE_OK)
+        throw Exception("Unable to get response code");
 
 #ifdef COUCH_DB_DEBUG
-            out << indent;
+    cout << "Response code: " << handle.responseCode << endl;
+    cout << "Raw buffer: ";
+    cout.write(handle.buffer.data(), handle.buffer.size());
 #endif
-            out << "]";
+}
+
+// Sets the handle up for a request through libcurl and returns the header
+// list, to be freed once it is done.
+struct curl_slist* Communication::prepareHandle(PooledHandle &handle, const string &url,
+        const string &method, BodySource *body, const HeaderMap &headers,
+        curl_write_callback write, void *target, bool signing)
+{
+    // a handle run on its own takes its connection from the shared cache
+    CURLSH *share = getSharedCaches(!isMultiplexed());
+    if(handle.share != share)
+    {
+        if(curl_easy_setopt(handle.curl, CURLOPT_SHARE, share) != CURLE_OK)
+            throw Exception("Unable to set shared caches");
+        handle.share = share;
+    }
+
+    // keeps the cookie the server renews in its responses
+    if(curl_easy_setopt(handle.curl, CURLOPT_HEADERFUNCTION,
+                        signing ? Session::readHeader : NULL) != CURLE_OK ||
+       curl_easy_setopt(handle.curl, CURLOPT_HEADERDATA,
+                        signing ? session.get() : NULL) != CURLE_OK)
+        throw Exception("Unable to set header function");
+
+    struct curl_slist *list = prepareRequest(handle.curl, url, method, body, headers,
+            write, target, compression.acceptEncoded);
+
+    if(curl_easy_setopt(handle.curl, CURLOPT_UNIX_SOCKET_PATH,
+                        unixSocket.size() > 0 ? unixSocket.c_str() : NULL) != CURLE_OK)
+    {
+        resetRequest(handle.curl, list);
+        throw Exception("Unable to set Unix socket: " + unixSocket);
+    }
+
+    if(!isMultiplexed())
+        curl_easy_setopt(handle.curl, CURLOPT_HTTP_VERSION, curlHTTPVersion(httpVersion));
+    return list;
+}
+
+// The request and, once it is late, its hedge, racing on a multi handle of
+// their own. Whichever is still running at the end is dropped, and the
+// spare handle goes back to the pool.
+struct HedgeScope
+{
+    HedgeScope(HandlePool &_pool, PooledHandle &_handle)
+        : pool(_pool)
+        , handle(_handle)
+        , multi(curl_multi_init())
+        , spare(NULL)
+        , spareHeaders(NULL)
+    {
+    }
+
+    ~HedgeScope()
+    {
+        if(multi)
+        {
+            curl_multi_remove_handle(multi, handle.curl);
+            if(spare)
+                curl_multi_remove_handle(multi, spare->curl);
+            curl_multi_cleanup(multi);
         }
-        else
+        if(spare)
         {
-            //out << "unrecognized type (" << type.name() << ")";
-            throw Exception(string("Unrecognized type: ") + type.name());
+            resetRequest(spare->curl, spareHeaders);
+            pool.release(spare);
         }
     }
+
+    HandlePool        &pool;
+    PooledHandle      &handle;
+    CURLM             *multi;
+    PooledHandle      *spare;
+    struct curl_slist *spareHeaders;
+};
+
+// Runs a GET read into the handle's buffer. Still unanswered past the
+// hedging percentile of the recent ones, it is sent again on a spare
+// handle, if one is idle, and the first answer is kept.
+void Communication::performHedged(PooledHandle &handle, const string &url,
+        const HeaderMap &headers, bool signing)
+{
+    using boost::posix_time::microsec_clock;
+    using boost::posix_time::ptime;
+
+    ptime         start = microsec_clock::universal_time();
+    unsigned long delay;
+    if(!tracker->getHedgeDelay(policy.hedgePercentile, delay))
+    {
+        // too few timed yet to tell a late one
+        checkLoaded(curl_easy_perform(handle.curl), url);
+        tracker->addLatency((microsec_clock::universal_time() - start).total_microseconds());
+        if(curl_easy_getinfo(handle.curl, CURLINFO_RESPONSE_CODE, &handle.responseCode) != CURLE_OK)
+            throw Exception("Unable to get response code");
+        return;
+    }
+
+    HedgeScope race(*pool, handle);
+    if(!race.multi || curl_multi_add_handle(race.multi, handle.curl) != CURLM_OK)
+        throw Exception("Unable to start request: " + url);
+
+    ptime    hedgeTime = start + boost::posix_time::microseconds(delay);
+    bool     hedgeDue  = true;
+    int      running   = 1;
+    CURL     *answered = NULL;
+    CURLcode failure   = CURLE_OK;
+    while(!answered)
+    {
+        int still;
+        if(curl_multi_perform(race.multi, &still) != CURLM_OK)
+            throw Exception("Unable to load URL: " + url);
+
+        int      left;
+        CURLMsg *message;
+        while((message = curl_multi_info_read(race.multi, &left)) != NULL)
+        {
+            if(message->msg != CURLMSG_DONE)
+                continue;
+            --running;
+            if(message->data.result != CURLE_OK)
+                failure = message->data.result;
+            else if(!answered)
+                answered = message->easy_handle;
+        }
+        if(answered)
+            break;
+
+        // failed before the hedge went out, or both failed
+        if(running == 0)
+            checkLoaded(failure, url);
+
+        long wait = 1000;
+        if(hedgeDue)
+        {
+            // curl_multi_wait() counts in milliseconds, rounded up here
+            long remaining = (hedgeTime - microsec_clock::universal_time()).total_microseconds();
+            wait = (remaining + 999) / 1000;
+            if(remaining <= 0)
+            {
+                hedgeDue   = false;
+                race.spare = pool->tryAcquire();
+                if(race.spare)
+                {
+                    race.spare->buffer.clear();
+                    race.spare->buffer.setSpillThreshold(spillThreshold);
+                    race.spare->responseCode = 0;
+                    race.spareHeaders = prepareHandle(*race.spare, url, "GET", NULL, headers,
+                            bufferResponse, race.spare, signing);
+                    if(curl_multi_add_handle(race.multi, race.spare->curl) == CURLM_OK)
+                    {
+                        tracker->countHedge();
+                        ++running;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if(curl_multi_wait(race.multi, NULL, 0, wait, NULL) != CURLM_OK)
+            throw Exception("Unable to load URL: " + url);
+    }
+
+    tracker->addLatency((microsec_clock::universal_time() - start).total_microseconds());
+    if(curl_easy_getinfo(answered, CURLINFO_RESPONSE_CODE, &handle.responseCode) != CURLE_OK)
+        throw Exception("Unable to get response code");
+
+    if(answered != handle.curl)
+    {
+        tracker->countHedgeWon();
+        handle.buffer.swap(race.spare->buffer);
+    }
 }
 
 } //namespace CouchDB
 
 ostream& operator<<(ostream &out, const CouchDB::Variant &value)
 {
-    CouchDB::printHelper(out, *value, "");
-    return out;
+    string json;
+    CouchDB::writeJSON(value, json);
+    return out << json;
 }
 
@@ -0,0 +1,57 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cstring>
+
+#include <zlib.h>
+
+#include "couchdb/Exception.hpp"
+
+#include "Compression.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+// window bits selecting the gzip wrapper rather than zlib's own
+#define GZIP_WINDOW_BITS (MAX_WBITS + 16)
+
+string gzipCompress(const string &data, int level)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+        throw Exception("Unable to start compression");
+
+    // the bound covers the whole stream, so one call finishes it
+    string compressed(deflateBound(&stream, data.size()), '\0');
+    stream.next_in   = (Bytef*)data.data();
+    stream.avail_in  = data.size();
+    stream.next_out  = (Bytef*)&compressed[0];
+    stream.avail_out = compressed.size();
+
+    int result = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if(result != Z_STREAM_END)
+        throw Exception("Unable to compress request body");
+
+    return compressed;
+}
+
+} //namespace CouchDB
@@ -0,0 +1,30 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_COMPRESSION_HPP__
+#define __COUCH_DB_COMPRESSION_HPP__
+
+#include <string>
+
+namespace CouchDB
+{
+
+// Compresses `data` into a gzip stream at the given zlib level, from 1
+// (fastest) to 9 (smallest). Throws Exception if zlib fails.
+std::string gzipCompress(const std::string &data, int level);
+
+} //namespace CouchDB
+
+#endif
@@ -13,6 +13,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  **/
+#include <boost/bind.hpp>
+
 #include <iostream>
 
 #include "couchdb/Connection.hpp"
@@ -24,20 +26,43 @@ namespace CouchDB
 
 Connection::Connection()
 {
-    getInfo();
 }
 
 Connection::Connection(const string &url) : comm(url)
 {
-    getInfo();
 }
 
-void Connection::getInfo()
+Connection::Connection(const string &url, const string &unixSocket) : comm(url)
+{
+    comm.setUnixSocket(unixSocket);
+}
+
+Connection::Connection(boost::asio::io_context &io)
 {
-    Variant var = comm.getData("");
-    Object  obj = boost::any_cast<Object>(*var);
+    comm.setIOContext(io);
+}
 
-    couchDBVersion = boost::any_cast<string>(*obj["version"]);
+Connection::Connection(boost::asio::io_context &io, const string &url) : comm(url)
+{
+    comm.setIOContext(io);
+}
+
+// Reads the version on first use rather than on construction, so that a
+// Connection costs nothing until it makes a request.
+void Connection::getInfo() const
+{
+    boost::mutex::scoped_lock lock(infoMutex);
+    if(couchDBVersion.size() > 0)
+        return;
+
+    string     version;
+    Projection info;
+    info.bind("version", version);
+
+    comm.getProjection("", info);
+    if(!info.found("version"))
+        throw Exception("Unable to read the CouchDB version: none in the welcome reply");
+    couchDBVersion = version;
 }
 
 Connection::~Connection()
@@ -46,24 +71,119 @@ Connection::~Connection()
 
 string Connection::getCouchDBVersion() const
 {
+    getInfo();
     return couchDBVersion;
 }
 
-vector<string> Connection::listDatabases()
+void Connection::setParseOptions(const ParseOptions &options)
 {
-    Variant var = comm.getData("/_all_dbs");
-    Array   arr = boost::any_cast<Array>(*var);
+    comm.setParseOptions(options);
+}
+
+void Connection::setMaxHandles(size_t maxHandles)
+{
+    comm.setMaxHandles(maxHandles);
+}
+
+void Connection::setHTTPVersion(Communication::HTTPVersion version)
+{
+    comm.setHTTPVersion(version);
+}
+
+void Connection::setMaxConnections(size_t connections)
+{
+    comm.setMaxConnections(connections);
+}
+
+void Connection::setCompression(const CompressionOptions &options)
+{
+    comm.setCompression(options);
+}
+
+void Connection::setUnixSocket(const string &path)
+{
+    comm.setUnixSocket(path);
+}
+
+void Connection::login(const string &name, const string &password)
+{
+    comm.login(name, password);
+}
+
+void Connection::logout()
+{
+    comm.logout();
+}
+
+void Connection::setSessionRefresh(unsigned seconds)
+{
+    comm.setSessionRefresh(seconds);
+}
+
+void Connection::setRequestPolicy(const RequestPolicy &policy)
+{
+    comm.setRequestPolicy(policy);
+}
+
+RequestMetrics Connection::getRequestMetrics() const
+{
+    return comm.getRequestMetrics();
+}
+
+void Connection::setTransport(const boost::shared_ptr<Transport> &transport)
+{
+    comm.setTransport(transport);
+}
+
+static vector<string> readDatabases(const Variant &var)
+{
+    const Array &arr = as<Array>(var);
 
     vector<string> dbs;
+    dbs.reserve(arr.size());
 
-    Array::iterator        db     = arr.begin();
-    const Array::iterator &db_end = arr.end();
+    Array::const_iterator        db     = arr.begin();
+    const Array::const_iterator &db_end = arr.end();
     for(; db != db_end; ++db)
-        dbs.push_back(boost::any_cast<string>(**db));
+        dbs.push_back(as<string>(*db));
 
     return dbs;
 }
 
+static bool readDatabaseReply(const WriteReply &reply, const string &db)
+{
+    if(reply.has(WriteReply::MEMBER_ERROR))
+        throw Exception("Unable to create database '" + db + "': " + reply.reason);
+
+    return reply.ok;
+}
+
+static vector<string> decodeDatabases(AsyncResponse &response)
+{
+    response.check();
+    return readDatabases(parseJSON(response.body));
+}
+
+static bool decodeDatabaseReply(const string &db, AsyncResponse &response)
+{
+    response.check();
+
+    WriteReply reply;
+    readWriteReply(response.body, reply);
+    return readDatabaseReply(reply, db);
+}
+
+vector<string> Connection::listDatabases()
+{
+    return readDatabases(comm.getData("/_all_dbs"));
+}
+
+Async<vector<string> >::Future Connection::listDatabasesAsync(
+        const Async<vector<string> >::Callback &callback)
+{
+    return comm.requestAsync<vector<string> >("/_all_dbs", decodeDatabases, callback);
+}
+
 Database Connection::getDatabase(const string &db)
 {
     return Database(comm, db);
@@ -71,24 +191,30 @@ Database Connection::getDatabase(const string &db)
 
 bool Connection::createDatabase(const string &db)
 {
-    Variant var = comm.getData("/" + db, "PUT");
-    Object  obj = boost::any_cast<Object>(*var);
-
-    if(obj.find("error") != obj.end())
-        throw Exception("Unable to create database '" + db + "': " + boost::any_cast<string>(*obj["reason"]));
-
-    return boost::any_cast<bool>(*obj["ok"]);
+    WriteReply reply;
+    comm.getReply("/" + db, reply, "PUT");
+    return readDatabaseReply(reply, db);
 }
 
 bool Connection::deleteDatabase(const string &db)
 {
-    Variant var = comm.getData("/" + db, "DELETE");
-    Object  obj = boost::any_cast<Object>(*var);
+    WriteReply reply;
+    comm.getReply("/" + db, reply, "DELETE");
+    return readDatabaseReply(reply, db);
+}
 
-    if(obj.find("error") != obj.end())
-        throw Exception("Unable to create database '" + db + "': " + boost::any_cast<string>(*obj["reason"]));
+Async<bool>::Future Connection::createDatabaseAsync(const string &db,
+        const Async<bool>::Callback &callback)
+{
+    return comm.requestAsync<bool>("/" + db,
+            boost::bind(decodeDatabaseReply, db, _1), callback, "PUT");
+}
 
-    return boost::any_cast<bool>(*obj["ok"]);
+Async<bool>::Future Connection::deleteDatabaseAsync(const string &db,
+        const Async<bool>::Callback &callback)
+{
+    return comm.requestAsync<bool>("/" + db,
+            boost::bind(decodeDatabaseReply, db, _1), callback, "DELETE");
 }
 
 } //namespace CouchDB
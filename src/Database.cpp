@@ -14,10 +14,11 @@
  * limitations under the License.
 **/
 
-#include <sstream>
-#include <typeinfo>
+#include <boost/bind.hpp>
+
 #include "couchdb/Database.hpp"
 #include "couchdb/Exception.hpp"
+#include "couchdb/Writer.hpp"
 
 namespace CouchDB{
 
@@ -49,64 +50,79 @@ const std::string& Database::getName() const
 
 std::vector<Document> Database::listDocuments()
 {
-   Variant var = comm.getData("/" + name + "/_all_docs");
-   Object  obj = boost::any_cast<Object>(*var);
-   Variant total_rows = obj["total_rows"];
+   DocumentList list;
+   comm.getReply("/" + name + "/_all_docs", list);
 
-   const std::type_info &type = total_rows->type();
-   int numRows = boost::any_cast<int>(*total_rows);
+   if(list.error.size() > 0)
+      throw Exception("Unable to list documents in '" + name + "': " + list.error);
 
    std::vector<Document> docs;
+   docs.reserve(list.rows.size());
 
-   if(numRows > 0)
+   std::vector<DocumentRow>::const_iterator row = list.rows.begin();
+   const std::vector<DocumentRow>::const_iterator &rowEnd = list.rows.end();
+   for(; row != rowEnd; ++row)
    {
-      Array rows = boost::any_cast<Array>(*obj["rows"]);
-
-      Array::iterator        row     = rows.begin();
-      const Array::iterator &row_end = rows.end();
-      for(; row != row_end; ++row)
-      {
-         Object docObj = boost::any_cast<Object>(**row);
-         Object values = boost::any_cast<Object>(*docObj["value"]);
-
-         Document doc(comm, name,
-                      ::boost::any_cast<std::string>(*docObj["id"]),
-                      ::boost::any_cast<std::string>(*docObj["key"]),
-                      ::boost::any_cast<std::string>(*values["rev"]));
-
-         docs.push_back(doc);
-      }
+      if(row->error.empty())
+         docs.push_back(Document(comm, name, row->id, row->key, row->rev));
    }
 
    return docs;
 }
 
 Document Database::getDocument(const std::string &id, const std::string &rev)
+{
+   long        status;
+   std::string json = comm.getRawData(getDocumentURL(id, rev), status);
+   return readDocument(&comm, name, id, rev, json);
+}
+
+Async<Document>::Future Database::getDocumentAsync(const std::string &id,
+                                                   const std::string &rev,
+                                                   const Async<Document>::Callback &callback)
+{
+   return comm.requestAsync<Document>(getDocumentURL(id, rev),
+         boost::bind(&Database::decodeDocument, &comm, name, id, rev, _1),
+         callback);
+}
+
+std::string Database::getDocumentURL(const std::string &id, const std::string &rev) const
 {
    std::string url = "/" + name + "/" + id;
    if(rev.size() > 0)
       url += "?rev=" + rev;
+   return url;
+}
+
+// Handle of the document in a GET reply.
+Document Database::readDocument(Communication *comm, const std::string &db,
+                                const std::string &id, const std::string &rev,
+                                const std::string &json)
+{
+   // only _id and _rev are needed, so the body of the document is never read
+   std::string docId, docRev, error;
 
-   Variant var = comm.getData(url);
-   Object  obj = boost::any_cast<Object>(*var);
+   Projection doc;
+   doc.bind("_id", docId)
+      .bind("_rev", docRev)
+      .bind("error", error, Projection::BIND_OPTIONAL);
 
-   if(obj.find("error") != obj.end())
-      throw Exception("Document " + id + " (v" + rev + ") not found: " + ::boost::any_cast<std::string>(*obj["error"]));
+   doc.apply(json);
 
-   Document doc(comm, name,
-                ::boost::any_cast<std::string>(*obj["_id"]),
-                "", // no key returned here
-                ::boost::any_cast<std::string>(*obj["_rev"])
-               );
+   if(doc.found("error") || !doc.found("_id") || !doc.found("_rev"))
+      throw Exception("Document " + id + " (v" + rev + ") not found: " + error);
 
-   return doc;
+   return Document(*comm, db, docId,
+                   "", // no key returned here
+                   docRev);
 }
 
-static std::string createJSON(const Variant &data)
+Document Database::decodeDocument(Communication *comm, const std::string &db,
+                                  const std::string &id, const std::string &rev,
+                                  AsyncResponse &response)
 {
-    std::ostringstream ostr;
-    ostr << data;
-    return ostr.str();
+   response.check();
+   return readDocument(comm, db, id, rev, response.body);
 }
 
 Document Database::createDocument(const Variant &data, const std::string &id)
@@ -133,31 +149,94 @@ Document Database::createDocument(Variant data,
          attachmentObj[attachment->getID()] = createVariant(attachmentData);
       }
 
-      Object obj          = ::boost::any_cast<Object>(*data);
-      obj["_attachments"] = createVariant(attachmentObj);
-      data                = createVariant(obj);
+      // add them to a copy, the caller's data is left alone
+      Variant copy = createVariant(as<Object>(data));
+      as<Object>(copy)["_attachments"] = createVariant(attachmentObj);
+      data = copy;
    }
 
-   std::string json = createJSON(data);
+   body.clear();
+   writeJSON(data, body);
 
-   Variant var;
+   return storeDocument(id);
+}
+
+Async<Document>::Future Database::createDocumentAsync(const Variant &data,
+                                                      const std::string &id,
+                                                      const Async<Document>::Callback &callback)
+{
+   // serialized apart from `body`, which belongs to the blocking calls
+   std::string json;
+   writeJSON(data, json);
+
+   return comm.requestAsync<Document>("/" + name + "/" + id,
+         boost::bind(&Database::decodeStored, &comm, name, _1),
+         callback, id.size() > 0 ? "PUT" : "POST", json);
+}
+
+std::string Database::getDocumentJSON(const std::string &id, const std::string &rev)
+{
+   long        status;
+   std::string json = comm.getRawData(getDocumentURL(id, rev), status);
+   if(status >= 400)
+   {
+      std::string error;
+      Projection result;
+      result.bind("error", error, Projection::BIND_OPTIONAL);
+      result.apply(json);
+      throw Exception("Document " + id + " (v" + rev + ") not found: " + error);
+   }
+
+   return json;
+}
+
+// Sends the serialized document in `body` and returns its handle.
+Document Database::storeDocument(const std::string &id)
+{
+   WriteReply reply;
    if(id.size() > 0)
-      var = comm.getData("/" + name + "/" + id, "PUT", json);
+      comm.getReply("/" + name + "/" + id, reply, "PUT", body);
    else
-      var = comm.getData("/" + name + "/", "POST", json);
+      comm.getReply("/" + name + "/", reply, "POST", body);
 
-   Object  obj = boost::any_cast<Object>(*var);
+   return readStored(&comm, name, reply);
+}
 
-   if(obj.find("error") != obj.end())
-      throw Exception("Document could not be created: " + ::boost::any_cast<std::string>(*obj["reason"]));
+std::vector<WriteReply> Database::writeDocuments(const BulkDocsSource::Generator &generator)
+{
+   BulkDocsSource source(generator);
 
-   Document doc(comm, name,
-                ::boost::any_cast<std::string>(*obj["id"]),
-                "", // no key returned here
-                ::boost::any_cast<std::string>(*obj["rev"])
-               );
+   std::vector<WriteReply> replies;
+   comm.getReply("/" + name + "/_bulk_docs", Communication::HeaderMap(), replies, "POST", source);
+
+   // a failed document names itself, a refused request does not
+   if(replies.size() == 1 && replies[0].has(WriteReply::MEMBER_ERROR) &&
+      !replies[0].has(WriteReply::MEMBER_ID))
+      throw Exception("Documents could not be written: " + replies[0].reason);
+
+   return replies;
+}
+
+// Handle of the document a write reply is about.
+Document Database::readStored(Communication *comm, const std::string &db,
+                              const WriteReply &reply)
+{
+   if(!reply.has(WriteReply::MEMBER_ID) || !reply.has(WriteReply::MEMBER_REV))
+      throw Exception("Document could not be created: " + reply.reason);
+
+   return Document(*comm, db, reply.id,
+                   "", // no key returned here
+                   reply.rev);
+}
+
+Document Database::decodeStored(Communication *comm, const std::string &db,
+                                AsyncResponse &response)
+{
+   response.check();
 
-   return doc;
+   WriteReply reply;
+   readWriteReply(response.body, reply);
+   return readStored(comm, db, reply);
 }
 
 } //namespace CouchDB
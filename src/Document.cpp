@@ -13,6 +13,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
 **/
+#include <boost/bind.hpp>
+
 #include "couchdb/Document.hpp"
 #include "couchdb/Exception.hpp"
 
@@ -44,7 +46,7 @@ Document::~Document()
 {
 }
 
-Document& Document::operator=(Document& doc)
+Document& Document::operator=(const Document &doc)
 {
    db       = doc.getDatabase();
    id       = doc.getID();
@@ -97,94 +99,158 @@ vector<Revision> Document::getAllRevisions()
    vector<Revision> revisions;
 
    Variant var = comm.getData(getURL(false) + "?revs_info=true");
-   Object  obj = boost::any_cast<Object>(*var);
 
-   Array revInfo = boost::any_cast<Array>(*obj["_revs_info"]);
+   const Array &revInfo = get<Array>(var, "_revs_info");
+   revisions.reserve(revInfo.size());
 
-   Array::iterator        revInfoItr = revInfo.begin();
-   const Array::iterator &revInfoEnd = revInfo.end();
+   Array::const_iterator        revInfoItr = revInfo.begin();
+   const Array::const_iterator &revInfoEnd = revInfo.end();
    for(; revInfoItr != revInfoEnd; ++revInfoItr)
    {
-      Object revObj    = boost::any_cast<Object>(**revInfoItr);
-      revisions.push_back(Revision(boost::any_cast<string>(*revObj["rev"]),
-                                   boost::any_cast<string>(*revObj["status"])));
+      const Object &revObj = as<Object>(*revInfoItr);
+      revisions.push_back(Revision(get<string>(revObj, "rev"),
+                                   get<string>(revObj, "status")));
    }
 
    return revisions;
 }
 
+// Throws if the document data is an error reply instead.
+static void checkData(const Variant &var, const string &id)
+{
+   const Object &obj = as<Object>(var);
+
+   const Variant *reason = find(obj, "reason");
+   if(!find(obj, "_id") && !find(obj, "_rev") && find(obj, "error") && reason)
+      throw Exception("Document '" + id + "' not found: " + as<string>(*reason));
+}
+
+static Variant decodeData(const string &id, AsyncResponse &response)
+{
+   response.check();
+
+   Variant var = parseJSON(response.body);
+   checkData(var, id);
+   return var;
+}
+
 Variant Document::getData()
 {
    Variant var = comm.getData(getURL(false));
-   Object  obj = boost::any_cast<Object>(*var);
+   checkData(var, getID());
+   return var;
+}
 
-   if(obj.find("_id") == obj.end() && obj.find("_rev") == obj.end() &&
-      obj.find("error") != obj.end() && obj.find("reason") != obj.end())
+Async<Variant>::Future Document::getDataAsync(const Async<Variant>::Callback &callback)
+{
+   return comm.requestAsync<Variant>(getURL(false),
+         boost::bind(decodeData, getID(), _1), callback);
+}
+
+string Document::getJSON()
+{
+   long   status;
+   string json = comm.getRawData(getURL(false), status);
+   if(status >= 400)
    {
-      throw Exception("Document '" + getID() + "' not found: " + boost::any_cast<string>(*obj["reason"]));
+      string reason;
+      Projection result;
+      result.bind("reason", reason, Projection::BIND_OPTIONAL);
+      result.apply(json);
+      throw Exception("Document '" + getID() + "' not found: " + reason);
    }
 
-   return var;
+   return json;
 }
 
-bool Document::addAttachment(const string &attachmentId,
-                             const string &contentType,
-                             const string &data)
+string Document::getAttachmentURL(const string &attachmentId) const
 {
    string url = getURL(false) + "/" + attachmentId;
    if(revision.size() > 0)
       url += "?rev=" + revision;
+   return url;
+}
+
+bool Document::readAttachmentReply(const string &attachmentId,
+                                   const WriteReply &reply)
+{
+   if(reply.has(WriteReply::MEMBER_ERROR) && reply.has(WriteReply::MEMBER_REASON))
+      throw Exception("Could not create attachment '" + attachmentId + "': " + reply.reason);
+
+   if(reply.has(WriteReply::MEMBER_REV))
+      revision = reply.rev;
+
+   return reply.ok;
+}
 
+bool Document::addAttachment(const string &attachmentId,
+                             const string &contentType,
+                             const string &data)
+{
    Communication::HeaderMap headers;
    headers["Content-Type"] = contentType;
 
-   Variant var = comm.getData(url, headers, "PUT", data);
-   Object  obj = boost::any_cast<Object>(*var);
+   WriteReply reply;
+   comm.getReply(getAttachmentURL(attachmentId), headers, reply, "PUT", data);
+   return readAttachmentReply(attachmentId, reply);
+}
 
-   if(obj.find("error") != obj.end() && obj.find("reason") != obj.end())
-      throw Exception("Could not create attachment '" + attachmentId + "': " + boost::any_cast<string>(*obj["reason"]));
+bool Document::addAttachment(const string &attachmentId,
+                             const string &contentType,
+                             BodySource &data)
+{
+   Communication::HeaderMap headers;
+   headers["Content-Type"] = contentType;
 
-   revision = boost::any_cast<string>(*obj["rev"]);
+   WriteReply reply;
+   comm.getReply(getAttachmentURL(attachmentId), headers, reply, "PUT", data);
+   return readAttachmentReply(attachmentId, reply);
+}
 
-   return boost::any_cast<bool>(*obj["ok"]);
+bool Document::addAttachmentFile(const string &attachmentId,
+                                 const string &contentType,
+                                 const string &path)
+{
+   FileSource file(path);
+   return addAttachment(attachmentId, contentType, file);
 }
 
 Attachment Document::getAttachment(const string &attachmentId)
 {
-   Object data = boost::any_cast<Object>(*getData());
+   Variant data = getData();
 
-   if(data.find("_attachments") == data.end())
+   const Variant *attachments = find(data, "_attachments");
+   if(!attachments)
       throw Exception("No attachments");
 
-   Object attachments = boost::any_cast<Object>(*data["_attachments"]);
-   if(attachments.find(attachmentId) == attachments.end())
+   const Variant *attachment = find(*attachments, attachmentId);
+   if(!attachment)
       throw Exception("No attachment found with id '" + attachmentId + "'");
 
-   Object attachment = boost::any_cast<Object>(*attachments[attachmentId]);
-
-   return Attachment(comm, db, id, attachmentId, "", boost::any_cast<string>(*attachment["content_type"]));
+   return Attachment(comm, db, id, attachmentId, "", get<string>(*attachment, "content_type"));
 }
 
 vector<Attachment> Document::getAllAttachments()
 {
-   Object data = boost::any_cast<Object>(*getData());
+   Variant data = getData();
 
-   if(data.find("_attachments") == data.end())
+   const Variant *attachmentsVar = find(data, "_attachments");
+   if(!attachmentsVar)
       throw Exception("No attachments");
 
    vector<Attachment> vAttachments;
 
-   Object attachments = boost::any_cast<Object>(*data["_attachments"]);
+   const Object &attachments = as<Object>(*attachmentsVar);
+   vAttachments.reserve(attachments.size());
 
-   Object::iterator attachmentItr = attachments.begin();
-   const Object::iterator &attachmentEnd = attachments.end();
+   Object::const_iterator attachmentItr = attachments.begin();
+   const Object::const_iterator &attachmentEnd = attachments.end();
    for(; attachmentItr != attachmentEnd; ++attachmentItr)
    {
       const string &attachmentId = attachmentItr->first;
-      Object attachment = boost::any_cast<Object>(*attachmentItr->second);
 
       vAttachments.push_back(Attachment(comm, db, id, attachmentId, "",
-                                        boost::any_cast<string>(*attachment["content_type"])));
+                                        get<string>(attachmentItr->second, "content_type")));
    }
 
    return vAttachments;
@@ -196,15 +262,15 @@ bool Document::removeAttachment(const string &attachmentId)
    if(revision.size() > 0)
       url += "?rev=" + revision;
 
-   Variant var = comm.getData(url, "DELETE");
-   Object  obj = boost::any_cast<Object>(*var);
+   WriteReply reply;
+   comm.getReply(url, reply, "DELETE");
 
-   if(obj.find("error") != obj.end() && obj.find("reason") != obj.end())
-      throw Exception("Could not delete attachment '" + attachmentId + "': " + boost::any_cast<string>(*obj["reason"]));
+   if(reply.has(WriteReply::MEMBER_ERROR) && reply.has(WriteReply::MEMBER_REASON))
+      throw Exception("Could not delete attachment '" + attachmentId + "': " + reply.reason);
 
-   revision = boost::any_cast<string>(*obj["rev"]);
+   revision = reply.rev;
 
-   return boost::any_cast<bool>(*obj["ok"]);
+   return reply.ok;
 }
 
 Document Document::copy(const string &targetId, const string &targetRev)
@@ -215,25 +281,24 @@ Document Document::copy(const string &targetId, const string &targetRev)
    else
       headers["Destination"] = targetId;
 
-   Variant var = comm.getData(getURL(true), headers, "COPY");
-   Object  obj = boost::any_cast<Object>(*var);
+   WriteReply reply;
+   comm.getReply(getURL(true), headers, reply, "COPY");
 
-   if(obj.find("error") != obj.end() && obj.find("reason") != obj.end())
-      throw Exception("Could not copy document '" + getID() + "' to '" + targetId + "': " + boost::any_cast<string>(*obj["reason"]));
+   if(reply.has(WriteReply::MEMBER_ERROR) && reply.has(WriteReply::MEMBER_REASON))
+      throw Exception("Could not copy document '" + getID() + "' to '" + targetId + "': " + reply.reason);
 
    string newId = targetId;
-   if(obj.find("id") != obj.end())
-      newId = boost::any_cast<string>(*obj["id"]);
+   if(reply.has(WriteReply::MEMBER_ID))
+      newId = reply.id;
 
-   return Document(comm, db, newId, "", boost::any_cast<string>(*obj["rev"]));
+   return Document(comm, db, newId, "", reply.rev);
 }
 
 bool Document::remove()
 {
-   Variant var = comm.getData(getURL(true), "DELETE");
-   Object  obj = boost::any_cast<Object>(*var);
-
-   return boost::any_cast<bool>(*obj["ok"]);
+   WriteReply reply;
+   comm.getReply(getURL(true), reply, "DELETE");
+   return reply.ok;
 }
 
 } //namespace CouchDB
@@ -0,0 +1,651 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifdef __linux__
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "couchdb/Exception.hpp"
+#include "couchdb/Transport.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+#define RECEIVE_BUFFER_SIZE (64 * 1024)
+#define SEND_CHUNK_SIZE     (64 * 1024)   // also the largest body sent inline
+#define MAX_HEADER_SIZE     (1024 * 1024)
+#define CHUNK_PREFIX_SIZE   18            // hex length of 64 bits and CRLF
+
+// A keep-alive connection, with its own epoll instance since each is only
+// ever waited on by the thread making the request. The response is read
+// into `input`, of which [start, end) is yet to be parsed.
+struct EpollTransport::Socket : boost::noncopyable
+{
+    Socket(const string &origin, const string &unixSocket, int timeout);
+    ~Socket();
+
+    void connectTo(const struct sockaddr*, socklen_t);
+    void wait();
+    void send(const char*, size_t);
+    size_t receive();
+    size_t findLine(const char *delimiter, size_t delimiterSize);
+    void fail(const string&);
+
+    string         origin;
+    string         unixSocket;
+    int            fd;
+    int            poller;
+    int            timeout;    // milliseconds per wait, -1 for none
+    vector<char>   input;
+    size_t         start;
+    size_t         end;
+    string         output;
+    size_t         requests;   // completed on this connection
+    bool           answered;   // response bytes seen for the current one
+    bool           broken;     // connection failed rather than the request
+};
+
+EpollTransport::Socket::Socket(const string &_origin, const string &_unixSocket,
+        int _timeout)
+    : origin(_origin)
+    , unixSocket(_unixSocket)
+    , fd(-1)
+    , poller(epoll_create1(EPOLL_CLOEXEC))
+    , timeout(_timeout > 0 ? _timeout : -1)
+    , input(RECEIVE_BUFFER_SIZE)
+    , start(0)
+    , end(0)
+    , requests(0)
+    , answered(false)
+    , broken(false)
+{
+    if(poller < 0)
+        throw Exception("Unable to create epoll instance");
+
+    try
+    {
+        if(unixSocket.size() > 0)
+        {
+            struct sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            if(unixSocket.size() >= sizeof(address.sun_path))
+                throw Exception("Unix socket path too long: " + unixSocket);
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, unixSocket.data(), unixSocket.size());
+
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd < 0)
+                throw Exception("Unable to create socket");
+            connectTo((const struct sockaddr*)&address, sizeof(address));
+            return;
+        }
+
+        // host, [IPv6 address] or either followed by :port
+        string host = origin, port = "80";
+        size_t colon = origin.rfind(':');
+        if(colon != string::npos && origin.find(']', colon) == string::npos)
+        {
+            host = origin.substr(0, colon);
+            port = origin.substr(colon + 1);
+        }
+        if(host.size() > 1 && host[0] == '[' && host[host.size() - 1] == ']')
+            host = host.substr(1, host.size() - 2);
+
+        struct addrinfo hints, *addresses;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+            throw TransportException("Unable to resolve host: " + host);
+
+        for(struct addrinfo *address = addresses; address; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        address->ai_protocol);
+            if(fd < 0)
+                continue;
+
+            try
+            {
+                connectTo(address->ai_addr, address->ai_addrlen);
+            }
+            catch(const Exception&)
+            {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            break;
+        }
+        freeaddrinfo(addresses);
+
+        if(fd < 0)
+            throw TransportException("Unable to connect to: " + origin);
+    }
+    catch(...)
+    {
+        if(fd >= 0)
+            close(fd);
+        close(poller);
+        throw;
+    }
+}
+
+EpollTransport::Socket::~Socket()
+{
+    close(fd);
+    close(poller);
+}
+
+// Registers the socket, edge-triggered for both directions so that it is
+// never modified again, and waits for a connection in progress.
+void EpollTransport::Socket::connectTo(const struct sockaddr *address, socklen_t length)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.fd = fd;
+    if(epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event) != 0)
+        throw Exception("Unable to register socket");
+
+    if(connect(fd, address, length) == 0)
+        return;
+    if(errno != EINPROGRESS && errno != EAGAIN)
+        throw TransportException("Unable to connect to: " + origin);
+
+    wait();
+
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) != 0 || error != 0)
+        throw TransportException("Unable to connect to: " + origin);
+}
+
+// Blocks until the next edge in either direction; callers retry whatever
+// would have blocked, so a wakeup for the other direction is harmless.
+// A timeout leaves `broken` alone: the server may still be working on the
+// request, so it must not be sent again as if the connection were stale.
+void EpollTransport::Socket::wait()
+{
+    struct epoll_event event;
+    for(;;)
+    {
+        int ready = epoll_wait(poller, &event, 1, timeout);
+        if(ready > 0)
+            return;
+        if(ready == 0)
+            throw TransportException("Timed out on connection to: " + origin);
+        if(errno != EINTR)
+            fail("Unable to wait for socket");
+    }
+}
+
+void EpollTransport::Socket::fail(const string &message)
+{
+    broken = true;
+    throw TransportException(message + ": " + origin);
+}
+
+void EpollTransport::Socket::send(const char *data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if(sent > 0)
+        {
+            data += sent;
+            size -= sent;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            wait();
+        else if(errno != EINTR)
+            fail("Unable to send request");
+    }
+}
+
+// Reads what has arrived after `end`, first moving the unparsed part to
+// the front of the buffer, or growing it if that part fills it. Returns
+// the number of bytes read, 0 once the server has closed the connection.
+size_t EpollTransport::Socket::receive()
+{
+    if(start == end)
+        start = end = 0;
+    else if(end == input.size())
+    {
+        if(start > 0)
+        {
+            memmove(&input[0], &input[start], end - start);
+            end -= start;
+            start = 0;
+        }
+        else
+            input.resize(input.size() * 2);
+    }
+
+    for(;;)
+    {
+        ssize_t received = recv(fd, &input[end], input.size() - end, 0);
+        if(received > 0)
+        {
+            end += received;
+            answered = true;
+            return received;
+        }
+        if(received == 0)
+        {
+            broken = true;
+            return 0;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            wait();
+        else if(errno != EINTR)
+            fail("Unable to receive response");
+    }
+}
+
+// Length from `start` of the text before the delimiter, receiving until
+// it has arrived.
+size_t EpollTransport::Socket::findLine(const char *delimiter, size_t delimiterSize)
+{
+    size_t scanned = 0;
+    for(;;)
+    {
+        const char *first = &input[0] + start;
+        const char *last  = &input[0] + end;
+        const char *found = std::search(first + scanned, last,
+                                        delimiter, delimiter + delimiterSize);
+        if(found != last)
+            return found - first;
+
+        if(end - start >= delimiterSize)
+            scanned = end - start - delimiterSize + 1;
+        if(end - start > MAX_HEADER_SIZE)
+            throw Exception("Response header too large: " + origin);
+        if(receive() == 0)
+            fail("Connection closed before the end of the response");
+    }
+}
+
+static void deliver(Transport::Response &response, char *data, size_t size)
+{
+    if(size > 0 && response.write(data, 1, size, response.target) != size)
+        throw Exception("Response aborted by its writer");
+}
+
+// Copies up to `size` bytes of the body, as many as the source gives.
+static size_t readBody(BodySource *body, char *buffer, size_t size)
+{
+    size_t filled = 0;
+    try
+    {
+        while(filled < size)
+        {
+            size_t read = body->read(buffer + filled, size - filled);
+            if(read == 0)
+                break;
+            filled += read;
+        }
+    }
+    catch(const Exception&)
+    {
+        throw;
+    }
+    catch(const std::exception &e)
+    {
+        throw Exception(string("Unable to read request body: ") + e.what());
+    }
+    return filled;
+}
+
+static bool hasToken(const char *value, size_t size, const char *token)
+{
+    size_t length = strlen(token);
+    for(size_t i = 0; i + length <= size; ++i)
+    {
+        if(strncasecmp(value + i, token, length) == 0)
+            return true;
+    }
+    return false;
+}
+
+EpollTransport::EpollTransport(size_t _maxIdle, int _timeout)
+    : maxIdle(_maxIdle)
+    , timeout(_timeout)
+{
+}
+
+EpollTransport::~EpollTransport()
+{
+    for(size_t i = 0; i < idle.size(); ++i)
+        delete idle[i];
+}
+
+EpollTransport::Socket* EpollTransport::acquire(const string &origin,
+        const string &unixSocket)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        for(size_t i = idle.size(); i-- > 0;)
+        {
+            if(idle[i]->origin == origin && idle[i]->unixSocket == unixSocket)
+            {
+                Socket *socket = idle[i];
+                idle[i] = idle.back();
+                idle.pop_back();
+                return socket;
+            }
+        }
+    }
+
+    return new Socket(origin, unixSocket, timeout);
+}
+
+void EpollTransport::release(Socket *socket)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if(idle.size() < maxIdle)
+        {
+            idle.push_back(socket);
+            return;
+        }
+    }
+
+    delete socket;
+}
+
+void EpollTransport::perform(const Request &request, Response &response)
+{
+    const string &url = request.url;
+    if(url.compare(0, 7, "http://") != 0)
+        throw Exception("Unsupported URL: " + url);
+
+    size_t slash = url.find('/', 7);
+    string origin = url.substr(7, slash == string::npos ? string::npos : slash - 7);
+    const char *path = slash == string::npos ? "/" : url.c_str() + slash;
+
+    // a connection the server closed while idle fails before any response;
+    // the request is then sent once more on a new one
+    for(int attempt = 0;; ++attempt)
+    {
+        Socket *socket = acquire(origin, request.unixSocket);
+        bool reused = socket->requests > 0;
+        bool keepAlive;
+
+        try
+        {
+            keepAlive = exchange(socket, request, response, origin, path);
+        }
+        catch(const Exception&)
+        {
+            bool retry = reused && attempt == 0 && socket->broken && !socket->answered;
+            delete socket;
+            if(!retry || (request.body && !request.body->seek(0)))
+                throw;
+            continue;
+        }
+
+        if(keepAlive)
+            release(socket);
+        else
+            delete socket;
+        return;
+    }
+}
+
+// Sends the request and reads its response. Returns whether the connection
+// can take another request.
+bool EpollTransport::exchange(Socket *socket, const Request &request,
+        Response &response, const string &host, const char *path)
+{
+    socket->answered = false;
+    socket->broken   = false;
+    response.status  = 0;
+    response.length  = 0;
+
+    string &output = socket->output;
+    output.clear();
+    output += request.method;
+    output += ' ';
+    output += path;
+    output += " HTTP/1.1\r\nHost: ";
+    output += host;
+    output += "\r\n";
+
+    HeaderMap::const_iterator header = request.headers.begin();
+    for(; header != request.headers.end(); ++header)
+    {
+        output += header->first;
+        output += ": ";
+        output += header->second;
+        output += "\r\n";
+    }
+
+    BodySource *body = request.body;
+    boost::uint64_t size = body ? body->size() : 0;
+    bool chunked = size == BodySource::UNKNOWN_SIZE;
+
+    if(size > 0 && request.headers.find("Content-Type") == request.headers.end())
+        output += "Content-Type: application/json\r\n";
+    if(chunked)
+        output += "Transfer-Encoding: chunked\r\n";
+    else if(size > 0 || (request.method != "GET" && request.method != "HEAD"))
+        output += "Content-Length: " + boost::lexical_cast<string>(size) + "\r\n";
+    output += "\r\n";
+
+    if(!chunked && size <= SEND_CHUNK_SIZE)
+    {
+        // request line, headers and body in a single send
+        size_t headerSize = output.size();
+        output.resize(headerSize + (size_t)size);
+        if(size > 0 && readBody(body, &output[headerSize], (size_t)size) != size)
+            throw Exception("Request body shorter than its size");
+        socket->send(output.data(), output.size());
+    }
+    else
+    {
+        socket->send(output.data(), output.size());
+
+        // each piece read after room for its chunk header
+        output.resize(CHUNK_PREFIX_SIZE + SEND_CHUNK_SIZE + 2);
+        char *buffer = &output[CHUNK_PREFIX_SIZE];
+        boost::uint64_t sent = 0;
+        for(;;)
+        {
+            size_t read = readBody(body, buffer, SEND_CHUNK_SIZE);
+            if(!chunked)
+            {
+                if(read == 0)
+                    break;
+                socket->send(buffer, read);
+                sent += read;
+                continue;
+            }
+
+            char prefix[CHUNK_PREFIX_SIZE + 1];
+            int prefixSize = snprintf(prefix, sizeof(prefix), "%lx\r\n", (unsigned long)read);
+            memcpy(buffer - prefixSize, prefix, prefixSize);
+            memcpy(buffer + read, "\r\n", 2);
+            if(read == 0)
+            {
+                socket->send(buffer - prefixSize, prefixSize + 2);
+                break;
+            }
+            socket->send(buffer - prefixSize, prefixSize + read + 2);
+        }
+
+        if(!chunked && sent != size)
+            throw Exception("Request body shorter than its size");
+    }
+
+    // status line and headers, skipping interim 1xx responses
+    size_t headerSize;
+    bool keepAlive, chunkedReply = false, sized = false;
+    boost::uint64_t length = 0;
+    for(;;)
+    {
+        headerSize = socket->findLine("\r\n\r\n", 4);
+        const char *text = &socket->input[socket->start];
+        if(headerSize < 12 || strncmp(text, "HTTP/1.", 7) != 0)
+            throw Exception("Invalid response from: " + socket->origin);
+
+        response.status = strtol(text + 9, NULL, 10);
+        keepAlive = text[7] != '0';
+        if(response.status >= 100 && response.status < 200)
+        {
+            socket->start += headerSize + 4;
+            continue;
+        }
+
+        const char *last = text + headerSize;
+        const char *line = (const char*)memchr(text, '\n', headerSize);
+        line = line ? line + 1 : last;
+        while(line < last)
+        {
+            const char *lineEnd = (const char*)memchr(line, '\r', last - line);
+            if(!lineEnd)
+                lineEnd = last;
+            if(response.header)
+            {
+                size_t lineSize = lineEnd + 2 - line;
+                if(response.header((char*)line, 1, lineSize, response.headerTarget) != lineSize)
+                    throw Exception("Response aborted by its header writer");
+            }
+            const char *colon = (const char*)memchr(line, ':', lineEnd - line);
+            if(colon)
+            {
+                size_t nameSize = colon - line;
+                const char *value = colon + 1;
+                size_t valueSize = lineEnd - value;
+                if(nameSize == 14 && strncasecmp(line, "Content-Length", 14) == 0)
+                {
+                    length = strtoull(value, NULL, 10);
+                    sized  = true;
+                }
+                else if(nameSize == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0)
+                    chunkedReply = hasToken(value, valueSize, "chunked");
+                else if(nameSize == 10 && strncasecmp(line, "Connection", 10) == 0)
+                {
+                    if(hasToken(value, valueSize, "close"))
+                        keepAlive = false;
+                    else if(hasToken(value, valueSize, "keep-alive"))
+                        keepAlive = true;
+                }
+            }
+            line = lineEnd + 2;
+        }
+        break;
+    }
+    socket->start += headerSize + 4;
+
+    bool bodiless = request.method == "HEAD" || response.status == 204 ||
+                    response.status == 304;
+    if(!bodiless && !chunkedReply && sized && (boost::uint64_t)(size_t)length == length)
+        response.length = (size_t)length;
+
+    if(bodiless)
+    {
+        // none whatever the headers say
+    }
+    else if(chunkedReply)
+    {
+        for(;;)
+        {
+            size_t lineSize = socket->findLine("\r\n", 2);
+            boost::uint64_t chunk = strtoull(&socket->input[socket->start], NULL, 16);
+            socket->start += lineSize + 2;
+            if(chunk == 0)
+                break;
+
+            while(chunk > 0)
+            {
+                if(socket->start == socket->end && socket->receive() == 0)
+                    socket->fail("Connection closed before the end of the response");
+                size_t available = socket->end - socket->start;
+                size_t taken = chunk < available ? (size_t)chunk : available;
+                deliver(response, &socket->input[socket->start], taken);
+                socket->start += taken;
+                chunk -= taken;
+            }
+
+            if(socket->findLine("\r\n", 2) != 0)
+                throw Exception("Invalid chunk in response from: " + socket->origin);
+            socket->start += 2;
+        }
+
+        // trailers, up to an empty line
+        for(;;)
+        {
+            size_t lineSize = socket->findLine("\r\n", 2);
+            socket->start += lineSize + 2;
+            if(lineSize == 0)
+                break;
+        }
+    }
+    else if(sized)
+    {
+        while(length > 0)
+        {
+            if(socket->start == socket->end && socket->receive() == 0)
+                socket->fail("Connection closed before the end of the response");
+            size_t available = socket->end - socket->start;
+            size_t taken = length < available ? (size_t)length : available;
+            deliver(response, &socket->input[socket->start], taken);
+            socket->start += taken;
+            length -= taken;
+        }
+    }
+    else if(!sized)
+    {
+        // delimited by the end of the connection
+        keepAlive = false;
+        for(;;)
+        {
+            deliver(response, &socket->input[socket->start], socket->end - socket->start);
+            socket->start = socket->end;
+            if(socket->receive() == 0)
+                break;
+        }
+    }
+
+    ++socket->requests;
+
+    // anything left over means the connection is out of step
+    return keepAlive && socket->start == socket->end;
+}
+
+} //namespace CouchDB
+
+#endif
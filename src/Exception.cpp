@@ -34,4 +34,9 @@ const char* Exception::what() const throw()
     return message.c_str();
 }
 
+TransportException::TransportException(const string &message)
+    : Exception(message)
+{
+}
+
 } //namespace CouchDB
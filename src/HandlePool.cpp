@@ -0,0 +1,142 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include "couchdb/Exception.hpp"
+
+#include "HandlePool.hpp"
+#include "Request.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+HandlePool::HandlePool(size_t _maxHandles)
+    : created(0)
+    , maxHandles(_maxHandles > 0 ? _maxHandles : 1)
+    , lastResponseCode(0)
+{
+}
+
+HandlePool::~HandlePool()
+{
+    // every lease has ended by now, so all handles are idle
+    for(size_t i = 0; i < idle.size(); ++i)
+        destroy(idle[i]);
+}
+
+PooledHandle* HandlePool::acquire()
+{
+    return take(true);
+}
+
+PooledHandle* HandlePool::tryAcquire()
+{
+    return take(false);
+}
+
+PooledHandle* HandlePool::take(bool wait)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while(idle.empty() && created >= maxHandles)
+        {
+            if(!wait)
+                return NULL;
+            available.wait(lock);
+        }
+
+        if(!idle.empty())
+        {
+            PooledHandle *handle = idle.back();
+            idle.pop_back();
+            return handle;
+        }
+
+        // reserve the slot, the handle itself is made outside the lock
+        ++created;
+    }
+
+    PooledHandle *handle = new PooledHandle();
+    handle->curl         = createHandle();
+    handle->share        = getSharedCaches(false);
+    handle->responseCode = 0;
+    handle->response     = NULL;
+
+    if(!handle->curl)
+    {
+        destroy(handle);
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        --created;
+        available.notify_one();
+        throw Exception("Unable to create CURL object");
+    }
+
+    return handle;
+}
+
+void HandlePool::release(PooledHandle *handle)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    lastResponseCode = handle->responseCode;
+
+    // drop handles beyond a lowered limit
+    if(created > maxHandles)
+    {
+        --created;
+        destroy(handle);
+        return;
+    }
+
+    idle.push_back(handle);
+    available.notify_one();
+}
+
+void HandlePool::setMaxHandles(size_t _maxHandles)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    maxHandles = _maxHandles > 0 ? _maxHandles : 1;
+
+    while(created > maxHandles && !idle.empty())
+    {
+        destroy(idle.back());
+        idle.pop_back();
+        --created;
+    }
+
+    available.notify_all();
+}
+
+size_t HandlePool::getMaxHandles() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return maxHandles;
+}
+
+long HandlePool::getLastResponseCode() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return lastResponseCode;
+}
+
+void HandlePool::destroy(PooledHandle *handle)
+{
+    if(handle->curl)
+        curl_easy_cleanup(handle->curl);
+    delete handle;
+}
+
+} //namespace CouchDB
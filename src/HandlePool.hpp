@@ -0,0 +1,115 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_HANDLE_POOL_HPP__
+#define __COUCH_DB_HANDLE_POOL_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "couchdb/ResponseBuffer.hpp"
+#include "couchdb/Transport.hpp"
+
+namespace CouchDB
+{
+
+// An easy handle and the response of the request it is running.
+struct PooledHandle
+{
+    CURL           *curl;
+    CURLSH         *share;
+    ResponseBuffer buffer;
+    long           responseCode;
+
+    // that of the request while a Transport runs it in place of the handle
+    const Transport::Response *response;
+};
+
+// Bounded set of easy handles shared by the threads using one
+// Communication. Run on their own, the handles of every pool share one
+// connection cache, so a connection left open by one request, on any
+// Communication to the same server, serves the next.
+class HandlePool : boost::noncopyable
+{
+public:
+    explicit HandlePool(size_t maxHandles);
+    ~HandlePool();
+
+    // Returns an idle handle, creating one while under the limit and
+    // waiting for one to be released otherwise. Throws Exception if a new
+    // handle cannot be created.
+    PooledHandle* acquire();
+    void release(PooledHandle*);
+
+    // Same, but returns NULL rather than wait when all handles are busy.
+    PooledHandle* tryAcquire();
+
+    void setMaxHandles(size_t);
+    size_t getMaxHandles() const;
+
+    // status of the most recently released handle
+    long getLastResponseCode() const;
+
+private:
+    PooledHandle* take(bool wait);
+    static void destroy(PooledHandle*);
+
+    mutable boost::mutex       mutex;
+    boost::condition_variable  available;
+    std::vector<PooledHandle*> idle;
+    size_t                     created;
+    size_t                     maxHandles;
+    long                       lastResponseCode;
+};
+
+// Checks a handle out of the pool for the duration of a request.
+class HandleLease : boost::noncopyable
+{
+public:
+    explicit HandleLease(HandlePool &_pool)
+        : pool(_pool)
+        , handle(_pool.acquire())
+    {
+    }
+
+    ~HandleLease()
+    {
+        pool.release(handle);
+    }
+
+    PooledHandle& operator*() const
+    {
+        return *handle;
+    }
+
+    PooledHandle* operator->() const
+    {
+        return handle;
+    }
+
+private:
+    HandlePool   &pool;
+    PooledHandle *handle;
+};
+
+} //namespace CouchDB
+
+#endif
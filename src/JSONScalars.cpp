@@ -0,0 +1,400 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "JSONScalars.hpp"
+#include "StringKernels.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+using ::boost::uint64_t;
+
+namespace CouchDB
+{
+
+static const double powersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int hexValue(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void appendCodePoint(string &out, unsigned code)
+{
+    char   bytes[4];
+    size_t length;
+
+    if(code < 0x80)
+    {
+        bytes[0] = (char)code;
+        length   = 1;
+    }
+    else if(code < 0x800)
+    {
+        bytes[0] = (char)(0xc0 | (code >> 6));
+        bytes[1] = (char)(0x80 | (code & 0x3f));
+        length   = 2;
+    }
+    else if(code < 0x10000)
+    {
+        bytes[0] = (char)(0xe0 | (code >> 12));
+        bytes[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+        bytes[2] = (char)(0x80 | (code & 0x3f));
+        length   = 3;
+    }
+    else
+    {
+        bytes[0] = (char)(0xf0 | (code >> 18));
+        bytes[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+        bytes[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+        bytes[3] = (char)(0x80 | (code & 0x3f));
+        length   = 4;
+    }
+    out.append(bytes, length);
+}
+
+// Reads the four hex digits of a \u escape, `cur` pointing at the 'u'.
+static bool readHex4(const char *cur, const char *end, unsigned &code)
+{
+    if(end - cur < 5)
+        return false;
+
+    code = 0;
+    for(int i = 1; i <= 4; ++i)
+    {
+        int digit = hexValue(cur[i]);
+        if(digit < 0)
+            return false;
+        code = (code << 4) | digit;
+    }
+    return true;
+}
+
+// Decodes a \u escape, `cur` pointing at the 'u', and leaves `cur` on its
+// last digit. A surrogate pair becomes one 4-byte sequence; a surrogate
+// without its other half becomes U+FFFD, as it has no UTF-8 encoding.
+static bool readUnicodeEscape(const char *&cur, const char *end, string &out)
+{
+    unsigned code;
+    if(!readHex4(cur, end, code))
+        return false;
+    cur += 4;
+
+    if(code >= 0xd800 && code <= 0xdbff)
+    {
+        unsigned low;
+        if(end - cur > 2 && cur[1] == '\\' && cur[2] == 'u' &&
+           readHex4(cur + 2, end, low) && low >= 0xdc00 && low <= 0xdfff)
+        {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            cur += 6;
+        }
+        else
+        {
+            code = 0xfffd;
+        }
+    }
+    else if(code >= 0xdc00 && code <= 0xdfff)
+    {
+        code = 0xfffd;
+    }
+
+    appendCodePoint(out, code);
+    return true;
+}
+
+bool readJSONNumber(const char *&pos, const char *end, JSONNumber &number)
+{
+    const char *start = pos;
+    const char *cur   = pos;
+
+    bool negative = false;
+    if(cur < end && *cur == '-')
+    {
+        negative = true;
+        ++cur;
+    }
+
+    // 1: integer part...
+    const char *digits = cur;
+    uint64_t mantissa = 0;
+    int      digitCount = 0;
+    while(cur < end && *cur >= '0' && *cur <= '9')
+    {
+        if(digitCount < 19)
+            mantissa = mantissa * 10 + (*cur - '0');
+        ++digitCount;
+        ++cur;
+    }
+    if(cur == digits || (*digits == '0' && cur - digits > 1))
+        return false;
+
+    // 2: fraction and exponent make it a real...
+    bool isReal   = false;
+    int  exponent = 0;
+    if(cur < end && *cur == '.')
+    {
+        isReal = true;
+        const char *fraction = ++cur;
+        while(cur < end && *cur >= '0' && *cur <= '9')
+        {
+            if(digitCount < 19)
+            {
+                mantissa = mantissa * 10 + (*cur - '0');
+                --exponent;
+            }
+            ++digitCount;
+            ++cur;
+        }
+        if(cur == fraction)
+            return false;
+    }
+
+    if(cur < end && (*cur == 'e' || *cur == 'E'))
+    {
+        isReal = true;
+        ++cur;
+
+        bool negativeExponent = false;
+        if(cur < end && (*cur == '+' || *cur == '-'))
+            negativeExponent = (*cur++ == '-');
+
+        const char *expDigits = cur;
+        int value = 0;
+        while(cur < end && *cur >= '0' && *cur <= '9')
+        {
+            if(value < 100000)
+                value = value * 10 + (*cur - '0');
+            ++cur;
+        }
+        if(cur == expDigits)
+            return false;
+
+        exponent += negativeExponent ? -value : value;
+    }
+
+    if(!isJSONDelimiter(cur, end))
+        return false;
+    pos = cur;
+
+    // 3: integers...
+    if(!isReal && digitCount <= 19)
+    {
+        const uint64_t maxInt = (uint64_t)numeric_limits<int64_t>::max();
+        if(!negative && mantissa <= maxInt)
+        {
+            number.isReal  = false;
+            number.integer = (int64_t)mantissa;
+            return true;
+        }
+        if(negative && mantissa <= maxInt + 1)
+        {
+            number.isReal  = false;
+            number.integer = (int64_t)(0 - mantissa);
+            return true;
+        }
+    }
+
+    // 4: reals that can be computed exactly, everything else by strtod...
+    number.isReal = true;
+    if(digitCount <= 19 && mantissa <= ((uint64_t)1 << 53) &&
+       exponent >= -22 && exponent <= 22)
+    {
+        number.real = (double)mantissa;
+        if(exponent < 0)
+            number.real /= powersOfTen[-exponent];
+        else
+            number.real *= powersOfTen[exponent];
+        if(negative)
+            number.real = -number.real;
+    }
+    else
+    {
+        string text(start, cur);
+        number.real = strtod(text.c_str(), NULL);
+    }
+
+    return true;
+}
+
+bool readJSONLiteral(const char *&cur, const char *end,
+        const char *literal, size_t length)
+{
+    if((size_t)(end - cur) < length || memcmp(cur, literal, length) != 0 ||
+       !isJSONDelimiter(cur + length, end))
+        return false;
+
+    cur += length;
+    return true;
+}
+
+bool readJSONString(const char *&pos, const char *end, string &scratch,
+        const char *&str, size_t &length)
+{
+    const char *start    = pos;
+    bool       nonASCII = false;
+
+    // 1: fast path, no escapes...
+    const char *cur = findQuoteOrEscape(pos, end, nonASCII);
+    if(cur == end)
+        return false;
+
+    if(*cur == '"')
+    {
+        if(nonASCII && !isValidUTF8(start, cur))
+            return false;
+
+        str    = start;
+        length = cur - start;
+        pos    = cur + 1;
+        return true;
+    }
+
+    // 2: copy clean runs in bulk and decode the escapes between them...
+    scratch.assign(start, cur);
+    while(*cur == '\\')
+    {
+        if(++cur == end)
+            return false;
+
+        switch(*cur)
+        {
+        case '"':  scratch.push_back('"');  break;
+        case '\\': scratch.push_back('\\'); break;
+        case '/':  scratch.push_back('/');  break;
+        case 'b':  scratch.push_back('\b'); break;
+        case 'f':  scratch.push_back('\f'); break;
+        case 'n':  scratch.push_back('\n'); break;
+        case 'r':  scratch.push_back('\r'); break;
+        case 't':  scratch.push_back('\t'); break;
+        case 'u':
+            if(!readUnicodeEscape(cur, end, scratch))
+                return false;
+            break;
+        default:
+            return false;
+        }
+        ++cur;
+
+        const char *run = cur;
+        cur = findQuoteOrEscape(cur, end, nonASCII);
+        if(cur == end)
+            return false;
+        scratch.append(run, cur - run);
+    }
+
+    // control characters must be escaped
+    if(*cur != '"')
+        return false;
+
+    // escapes are plain ASCII, so checking the raw text is enough
+    if(nonASCII && !isValidUTF8(start, cur))
+        return false;
+
+    str    = scratch.data();
+    length = scratch.size();
+    pos    = cur + 1;
+    return true;
+}
+
+bool skipJSONString(const char *&pos, const char *end)
+{
+    const char *cur = pos;
+    for(;;)
+    {
+        const char *quote = (const char*)memchr(cur, '"', end - cur);
+        if(!quote)
+            return false;
+
+        // the quote is escaped if an odd number of backslashes precede it
+        const char *slash = quote;
+        while(slash > pos && slash[-1] == '\\')
+            --slash;
+
+        cur = quote + 1;
+        if(((quote - slash) & 1) == 0)
+        {
+            pos = cur;
+            return true;
+        }
+    }
+}
+
+// Skips over nested arrays and objects by counting brackets; strings are
+// jumped over so brackets inside them do not count.
+static bool skipContainer(const char *&cur, const char *end)
+{
+    size_t depth = 0;
+    while(cur < end)
+    {
+        switch(*cur++)
+        {
+        case '"':
+            if(!skipJSONString(cur, end))
+                return false;
+            break;
+
+        case '{':
+        case '[':
+            ++depth;
+            break;
+
+        case '}':
+        case ']':
+            if(--depth == 0)
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
+bool skipJSONValue(const char *&cur, const char *end)
+{
+    skipJSONSpace(cur, end);
+    if(cur == end)
+        return false;
+
+    JSONNumber number;
+    switch(*cur)
+    {
+    case '"':
+        ++cur;
+        return skipJSONString(cur, end);
+    case '{':
+    case '[':
+        return skipContainer(cur, end);
+    case 't':
+        return readJSONLiteral(cur, end, "true", 4);
+    case 'f':
+        return readJSONLiteral(cur, end, "false", 5);
+    case 'n':
+        return readJSONLiteral(cur, end, "null", 4);
+    default:
+        return readJSONNumber(cur, end, number);
+    }
+}
+
+} //namespace CouchDB
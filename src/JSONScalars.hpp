@@ -0,0 +1,89 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_JSON_SCALARS_HPP__
+#define __COUCH_DB_JSON_SCALARS_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+
+namespace CouchDB
+{
+
+// Decoding of JSON strings, numbers and literals, shared by the tree
+// parsers and the on-demand scanner.
+
+struct JSONNumber
+{
+    bool             isReal;
+    ::boost::int64_t integer;
+    double           real;
+};
+
+// true for the characters that may follow a number or literal
+inline bool isJSONDelimiter(const char *pos, const char *end)
+{
+    if(pos == end)
+        return true;
+
+    switch(*pos)
+    {
+    case ' ': case '\t': case '\n': case '\r':
+    case ',': case ':': case ']': case '}': case '[': case '{':
+        return true;
+    }
+    return false;
+}
+
+inline void skipJSONSpace(const char *&cur, const char *end)
+{
+    while(cur < end && (*cur == ' ' || *cur == '\n' || *cur == '\r' || *cur == '\t'))
+        ++cur;
+}
+
+// Skips white space and the expected character; false if another is next.
+inline bool consumeJSONChar(const char *&cur, const char *end, char expected)
+{
+    skipJSONSpace(cur, end);
+    if(cur == end || *cur != expected)
+        return false;
+    ++cur;
+    return true;
+}
+
+// Reads a number starting at `cur`; on success `cur` is moved past it.
+// Integers that fit in 64 bits stay integers, everything else is a real.
+bool readJSONNumber(const char *&cur, const char *end, JSONNumber&);
+
+// Matches `true`, `false` or `null` at `cur` and moves past it.
+bool readJSONLiteral(const char *&cur, const char *end,
+        const char *literal, size_t length);
+
+// Reads a string whose opening quote has already been consumed and moves
+// `cur` past the closing quote. `str` points into the input when the string
+// has no escapes and into `scratch` otherwise.
+bool readJSONString(const char *&cur, const char *end, std::string &scratch,
+        const char *&str, size_t &length);
+
+// Moves `cur` past the closing quote without decoding anything.
+bool skipJSONString(const char *&cur, const char *end);
+
+// Skips leading whitespace and one value of any type, without decoding it.
+bool skipJSONValue(const char *&cur, const char *end);
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include "KernelSelection.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+static bool isSupported(KernelLevel level)
+{
+    if(level == KERNEL_SCALAR)
+        return true;
+#ifdef COUCH_DB_X86_KERNELS
+    __builtin_cpu_init();
+    if(level == KERNEL_SSE2)
+        return __builtin_cpu_supports("sse2");
+    if(level == KERNEL_AVX2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return false;
+}
+
+static KernelLevel detectLevel()
+{
+    if(isSupported(KERNEL_AVX2))
+        return KERNEL_AVX2;
+    if(isSupported(KERNEL_SSE2))
+        return KERNEL_SSE2;
+    return KERNEL_SCALAR;
+}
+
+KernelLevel detectKernelLevel()
+{
+    static KernelLevel level = detectLevel();
+    return level;
+}
+
+bool findKernelLevel(const string &name, KernelLevel &level)
+{
+    if(name == "scalar")
+        level = KERNEL_SCALAR;
+    else if(name == "sse2")
+        level = KERNEL_SSE2;
+    else if(name == "avx2")
+        level = KERNEL_AVX2;
+    else
+        return false;
+
+    return isSupported(level);
+}
+
+const char* getKernelName(KernelLevel level)
+{
+    switch(level)
+    {
+    case KERNEL_SSE2:
+        return "sse2";
+    case KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+} //namespace CouchDB
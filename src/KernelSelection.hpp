@@ -0,0 +1,48 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_KERNEL_SELECTION_HPP__
+#define __COUCH_DB_KERNEL_SELECTION_HPP__
+
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define COUCH_DB_X86_KERNELS
+#endif
+
+namespace CouchDB
+{
+
+// Instruction set levels shared by the structural index and the string
+// kernels, so that both always run at the same one.
+enum KernelLevel
+{
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2
+};
+
+// Best level the CPU supports, detected on first use.
+KernelLevel detectKernelLevel();
+
+// Looks up a level by name ("scalar", "sse2" or "avx2"); returns false if
+// the name is unknown or the CPU does not support it.
+bool findKernelLevel(const std::string&, KernelLevel&);
+
+const char* getKernelName(KernelLevel);
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_OBJECT_MEMBERS_HPP__
+#define __COUCH_DB_OBJECT_MEMBERS_HPP__
+
+#include <boost/move/iterator.hpp>
+#include <boost/move/utility_core.hpp>
+
+#include <algorithm>
+
+#include "couchdb/Variant.hpp"
+
+namespace CouchDB
+{
+
+struct MemberKeyLess
+{
+    bool operator()(const Object::value_type &a, const Object::value_type &b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+// Fills `obj` with the members in [first, last), given in document order,
+// with one sort instead of one shifting insert per member. Later duplicates
+// win, as they do when assigning member by member.
+inline void assignMembers(Object &obj, Object::value_type *first,
+        Object::value_type *last)
+{
+    Object::sequence_type members(boost::make_move_iterator(first),
+            boost::make_move_iterator(last));
+    std::stable_sort(members.begin(), members.end(), MemberKeyLess());
+
+    size_t kept = 0;
+    for(size_t i = 0; i < members.size(); ++i)
+    {
+        if(i + 1 < members.size() && members[i].first == members[i + 1].first)
+            continue;
+        if(kept != i)
+            members[kept] = boost::move(members[i]);
+        ++kept;
+    }
+    members.erase(members.begin() + kept, members.end());
+
+    obj.adopt_sequence(boost::container::ordered_unique_range, boost::move(members));
+}
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,462 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/cstdint.hpp>
+
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#include "couchdb/Parser.hpp"
+#include "couchdb/Arena.hpp"
+#include "couchdb/Exception.hpp"
+
+#include "JSONScalars.hpp"
+#include "ObjectMembers.hpp"
+#include "StringKernels.hpp"
+#include "StructuralIndex.hpp"
+#include "ValueBuilder.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+using ::boost::uint32_t;
+
+namespace CouchDB
+{
+
+// ---[ STAGE TWO ]--------------------------------------------------------------
+
+// Walks the structural index and reports every value to a Builder, which
+// provides null(), boolean(), integer(), real(), string(), key(),
+// startObject(), endObject(), startArray() and endArray().
+template<typename Builder>
+class StructuralWalker
+{
+public:
+    StructuralWalker(const char *_data, size_t _size,
+            const vector<uint32_t> &_index, Builder &_builder)
+        : data(_data)
+        , end(_data + _size)
+        , index(_index)
+        , builder(_builder)
+        , pos(0)
+    {
+    }
+
+    bool walk()
+    {
+        vector<char> scopes;
+
+        if(index.empty())
+            return false;
+
+        // 1: read a value...
+    value:
+        if(pos >= index.size())
+            return false;
+
+        switch(current())
+        {
+        case '{':
+            builder.startObject();
+            ++pos;
+            if(pos < index.size() && current() == '}')
+            {
+                ++pos;
+                builder.endObject();
+                goto after_value;
+            }
+            scopes.push_back('{');
+            goto key;
+
+        case '[':
+            builder.startArray();
+            ++pos;
+            if(pos < index.size() && current() == ']')
+            {
+                ++pos;
+                builder.endArray();
+                goto after_value;
+            }
+            scopes.push_back('[');
+            goto value;
+
+        case '"':
+            if(!readString(false))
+                return false;
+            break;
+
+        case 't':
+            if(!readLiteral("true", 4))
+                return false;
+            builder.boolean(true);
+            break;
+
+        case 'f':
+            if(!readLiteral("false", 5))
+                return false;
+            builder.boolean(false);
+            break;
+
+        case 'n':
+            if(!readLiteral("null", 4))
+                return false;
+            builder.null();
+            break;
+
+        default:
+            if(!readNumber())
+                return false;
+            break;
+        }
+        ++pos;
+
+        // 2: a value has been completed, see what encloses it...
+    after_value:
+        if(scopes.empty())
+            return pos == index.size();
+
+        if(pos >= index.size())
+            return false;
+
+        switch(current())
+        {
+        case ',':
+            ++pos;
+            if(scopes.back() == '{')
+                goto key;
+            goto value;
+
+        case '}':
+            if(scopes.back() != '{')
+                return false;
+            builder.endObject();
+            break;
+
+        case ']':
+            if(scopes.back() != '[')
+                return false;
+            builder.endArray();
+            break;
+
+        default:
+            return false;
+        }
+
+        scopes.pop_back();
+        ++pos;
+        goto after_value;
+
+        // 3: read the name of an object member and its colon...
+    key:
+        if(pos + 1 >= index.size() || current() != '"' || !readString(true))
+            return false;
+        ++pos;
+        if(current() != ':')
+            return false;
+        ++pos;
+        goto value;
+    }
+
+private:
+    char current() const
+    {
+        return data[index[pos]];
+    }
+
+    bool readLiteral(const char *literal, size_t length)
+    {
+        const char *cur = data + index[pos];
+        return readJSONLiteral(cur, end, literal, length);
+    }
+
+    bool readString(bool isKey)
+    {
+        const char *cur = data + index[pos] + 1;
+        const char *str;
+        size_t     length;
+
+        if(!readJSONString(cur, end, scratch, str, length))
+            return false;
+
+        if(isKey)
+            builder.key(str, length);
+        else
+            builder.string(str, length);
+        return true;
+    }
+
+    bool readNumber()
+    {
+        const char *cur = data + index[pos];
+        JSONNumber number;
+
+        if(!readJSONNumber(cur, end, number))
+            return false;
+
+        if(number.isReal)
+            builder.real(number.real);
+        else
+            builder.integer(number.integer);
+        return true;
+    }
+
+    const char             *data;
+    const char             *end;
+    const vector<uint32_t> &index;
+    Builder                &builder;
+    size_t                 pos;
+    string                 scratch;
+};
+
+// ---[ VARIANT BUILDER ]--------------------------------------------------------
+
+class VariantBuilder
+{
+public:
+    const Variant& getRoot() const
+    {
+        return root;
+    }
+
+    void null()
+    {
+        add(Variant(new boost::any()));
+    }
+
+    void boolean(bool value)
+    {
+        add(createVariant(value));
+    }
+
+    void integer(int64_t value)
+    {
+        if(value >= INT_MIN && value <= INT_MAX)
+            add(createVariant((int)value));
+        else
+            add(createVariant(value));
+    }
+
+    void real(double value)
+    {
+        add(createVariant(value));
+    }
+
+    void string(const char *str, size_t length)
+    {
+        add(createVariant(std::string(str, length)));
+    }
+
+    void key(const char *str, size_t length)
+    {
+        members.push_back(Object::value_type());
+        members.back().first.assign(str, length);
+    }
+
+    void startObject()
+    {
+        Variant var = createVariant(Object());
+        add(var);
+        frames.push_back(Frame(boost::any_cast<Object>(var.get()), NULL, members.size()));
+    }
+
+    void endObject()
+    {
+        const Frame &frame = frames.back();
+        if(frame.firstMember < members.size())
+        {
+            Object::value_type *first = &members[0] + frame.firstMember;
+            assignMembers(*frame.object, first, first + (members.size() - frame.firstMember));
+            members.resize(frame.firstMember);
+        }
+        frames.pop_back();
+    }
+
+    void startArray()
+    {
+        Variant var = createVariant(Array());
+        add(var);
+        frames.push_back(Frame(NULL, boost::any_cast<Array>(var.get()), 0));
+    }
+
+    void endArray()
+    {
+        frames.pop_back();
+    }
+
+private:
+    // members of the open objects are collected here and moved into their
+    // Object in one go when it closes
+    struct Frame
+    {
+        Frame(Object *_object, Array *_array, size_t _firstMember)
+            : object(_object), array(_array), firstMember(_firstMember) {}
+
+        Object *object;
+        Array  *array;
+        size_t firstMember;
+    };
+
+    void add(const Variant &var)
+    {
+        if(frames.empty())
+            root = var;
+        else if(frames.back().object)
+            members.back().second = var;
+        else
+            frames.back().array->push_back(var);
+    }
+
+    Variant                    root;
+    vector<Frame>              frames;
+    vector<Object::value_type> members;
+};
+
+// Arena backed tree; the root's storage lives in the arena and the text
+// it is declared after.
+struct SharedTree
+{
+    SharedTree(size_t firstChunk) : arena(firstChunk) {}
+
+    Arena       arena;
+    std::string text;
+    Value       root;
+};
+
+// ---[ PUBLIC INTERFACE ]-------------------------------------------------------
+
+Variant parseJSON(const char *data, size_t size)
+{
+    vector<uint32_t> index;
+    index.reserve(size / 8 + 16);
+
+    VariantBuilder builder;
+    if(buildStructuralIndex(data, size, index))
+    {
+        StructuralWalker<VariantBuilder> walker(data, size, index, builder);
+        if(walker.walk())
+            return builder.getRoot();
+    }
+
+    return Variant(new boost::any());
+}
+
+Variant parseJSON(const string &data)
+{
+    return parseJSON(data.data(), data.size());
+}
+
+static bool parseValue(const char *data, size_t size, Arena *arena, bool borrow,
+        Value &root)
+{
+    vector<uint32_t> index;
+    index.reserve(size / 8 + 16);
+
+    if(!buildStructuralIndex(data, size, index))
+        return false;
+
+    ValueBuilder builder(arena);
+    if(borrow)
+        builder.borrowFrom(data, data + size);
+    StructuralWalker<ValueBuilder> walker(data, size, index, builder);
+    if(!walker.walk())
+        return false;
+
+    root.swap(builder.getRoot());
+    return true;
+}
+
+Value parseValue(const char *data, size_t size)
+{
+    Value root;
+    if(!parseValue(data, size, NULL, false, root))
+        throw Exception("Invalid JSON document");
+    return root;
+}
+
+Value parseValue(const string &data)
+{
+    return parseValue(data.data(), data.size());
+}
+
+ParseOptions::ParseOptions()
+    : useArena(false)
+    , borrowStrings(false)
+{
+}
+
+static ValuePtr parseShared(const boost::shared_ptr<SharedTree> &tree,
+        const char *data, size_t size, bool borrow)
+{
+    if(!parseValue(data, size, &tree->arena, borrow, tree->root))
+        throw Exception("Invalid JSON document");
+
+    return ValuePtr(tree, &tree->root);
+}
+
+ValuePtr parseTree(const char *data, size_t size, const ParseOptions &options)
+{
+    if(options.borrowStrings)
+    {
+        string text(data, size);
+        return parseTreeSwap(text, options);
+    }
+
+    if(!options.useArena)
+        return ValuePtr(new Value(parseValue(data, size)));
+
+    // a tree typically needs about twice the bytes of its JSON text
+    boost::shared_ptr<SharedTree> tree(new SharedTree(size * 2));
+    return parseShared(tree, data, size, false);
+}
+
+ValuePtr parseTree(const string &data, const ParseOptions &options)
+{
+    return parseTree(data.data(), data.size(), options);
+}
+
+ValuePtr parseTreeSwap(string &text, const ParseOptions &options)
+{
+    if(!options.borrowStrings)
+    {
+        string data;
+        data.swap(text);
+        return parseTree(data, options);
+    }
+
+    // the strings no longer need arena space, only the containers do
+    boost::shared_ptr<SharedTree> tree(new SharedTree(text.size() + text.size() / 2));
+    tree->text.swap(text);
+    return parseShared(tree, tree->text.data(), tree->text.size(), true);
+}
+
+const char* getParserKernel()
+{
+    return getKernelName(getStructuralKernel());
+}
+
+bool setParserKernel(const string &name)
+{
+    KernelLevel level;
+    if(!findKernelLevel(name, level))
+        return false;
+
+    setStructuralKernel(level);
+    setStringKernel(level);
+    return true;
+}
+
+} //namespace CouchDB
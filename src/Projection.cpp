@@ -0,0 +1,362 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cstring>
+
+#include "couchdb/Projection.hpp"
+#include "couchdb/Exception.hpp"
+#include "couchdb/Parser.hpp"
+
+#include "JSONScalars.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+using ::boost::uint64_t;
+
+namespace CouchDB
+{
+
+static const size_t MAX_BINDINGS = 64;
+
+static void splitPath(const string &path, vector<string> &segments)
+{
+    size_t start = 0;
+    for(;;)
+    {
+        size_t dot = path.find('.', start);
+        segments.push_back(path.substr(start, dot - start));
+        if(dot == string::npos)
+            break;
+        start = dot + 1;
+    }
+}
+
+Projection::Projection()
+    : remaining(0)
+{
+}
+
+Projection& Projection::bind(const string &path, string &target, Presence presence)
+{
+    return add(path, TARGET_STRING, &target, presence);
+}
+
+Projection& Projection::bind(const string &path, bool &target, Presence presence)
+{
+    return add(path, TARGET_BOOLEAN, &target, presence);
+}
+
+Projection& Projection::bind(const string &path, int64_t &target, Presence presence)
+{
+    return add(path, TARGET_INTEGER, &target, presence);
+}
+
+Projection& Projection::bind(const string &path, double &target, Presence presence)
+{
+    return add(path, TARGET_REAL, &target, presence);
+}
+
+Projection& Projection::bind(const string &path, Value &target, Presence presence)
+{
+    return add(path, TARGET_VALUE, &target, presence);
+}
+
+Projection& Projection::each(const string &path, Projection &row,
+        const RowHandler &handler, Presence presence)
+{
+    add(path, TARGET_EACH, NULL, presence);
+    bindings.back().row     = &row;
+    bindings.back().handler = handler;
+    return *this;
+}
+
+Projection& Projection::add(const string &path, TargetType type, void *target,
+        Presence presence)
+{
+    if(bindings.size() == MAX_BINDINGS)
+        throw Exception("Too many bindings in projection");
+
+    Binding binding;
+    binding.path     = path;
+    binding.type     = type;
+    binding.target   = target;
+    binding.row      = NULL;
+    binding.required = (presence == BIND_REQUIRED);
+    binding.found    = false;
+    splitPath(path, binding.segments);
+
+    bindings.push_back(binding);
+    return *this;
+}
+
+bool Projection::found(const string &path) const
+{
+    vector<Binding>::const_iterator binding = bindings.begin();
+    const vector<Binding>::const_iterator &bindingEnd = bindings.end();
+    for(; binding != bindingEnd; ++binding)
+    {
+        if(binding->path == path)
+            return binding->found;
+    }
+    return false;
+}
+
+void Projection::reset()
+{
+    remaining = 0;
+    for(size_t i = 0; i < bindings.size(); ++i)
+    {
+        bindings[i].found = false;
+        if(bindings[i].required)
+            ++remaining;
+    }
+}
+
+bool Projection::apply(const string &data)
+{
+    return apply(data.data(), data.size());
+}
+
+bool Projection::apply(const char *data, size_t size)
+{
+    const char *cur = data;
+    const char *end = data + size;
+
+    reset();
+
+    skipJSONSpace(cur, end);
+    if(cur == end)
+        return false;
+
+    if(*cur != '{')
+    {
+        if(!skipJSONValue(cur, end))
+            return false;
+    }
+    else
+    {
+        uint64_t all = bindings.size() == MAX_BINDINGS ?
+            ~(uint64_t)0 : (((uint64_t)1 << bindings.size()) - 1);
+
+        Status status = readObject(cur, end, 0, all, remaining > 0);
+        if(status == STATUS_COMPLETE)
+            return true;
+        if(status == STATUS_FAILED)
+            return false;
+    }
+
+    skipJSONSpace(cur, end);
+    return cur == end;
+}
+
+// Reads the object at `cur`, matching member names against segment `depth`
+// of the bindings in `candidates`. With `stopWhenComplete` the scan ends as
+// soon as the last required binding has been filled.
+Projection::Status Projection::readObject(const char *&cur, const char *end,
+        size_t depth, uint64_t candidates, bool stopWhenComplete)
+{
+    if(!consumeJSONChar(cur, end, '{'))
+        return STATUS_FAILED;
+
+    skipJSONSpace(cur, end);
+    if(cur < end && *cur == '}')
+    {
+        ++cur;
+        return STATUS_DONE;
+    }
+
+    for(;;)
+    {
+        // 1: member name...
+        const char *key;
+        size_t     keyLength;
+        if(!consumeJSONChar(cur, end, '"') ||
+           !readJSONString(cur, end, scratch, key, keyLength) ||
+           !consumeJSONChar(cur, end, ':'))
+            return STATUS_FAILED;
+
+        // 2: which bindings does it lead to?
+        Binding  *terminal = NULL;
+        uint64_t children  = 0;
+        for(size_t i = 0; i < bindings.size(); ++i)
+        {
+            if(!(candidates & ((uint64_t)1 << i)))
+                continue;
+
+            const string &segment = bindings[i].segments[depth];
+            if(segment.size() != keyLength || memcmp(segment.data(), key, keyLength) != 0)
+                continue;
+
+            if(bindings[i].segments.size() == depth + 1)
+            {
+                if(!terminal && !bindings[i].found)
+                    terminal = &bindings[i];
+            }
+            else
+            {
+                children |= (uint64_t)1 << i;
+            }
+        }
+
+        // 3: read, descend or skip the value...
+        skipJSONSpace(cur, end);
+        if(terminal)
+        {
+            if(!readTarget(*terminal, cur, end))
+                return STATUS_FAILED;
+
+            terminal->found = true;
+            if(terminal->required && --remaining == 0 && stopWhenComplete)
+                return STATUS_COMPLETE;
+        }
+        else if(children && cur < end && *cur == '{')
+        {
+            Status status = readObject(cur, end, depth + 1, children, stopWhenComplete);
+            if(status != STATUS_DONE)
+                return status;
+        }
+        else if(!skipJSONValue(cur, end))
+        {
+            return STATUS_FAILED;
+        }
+
+        // 4: next member or end of object...
+        skipJSONSpace(cur, end);
+        if(cur == end)
+            return STATUS_FAILED;
+        if(*cur == '}')
+        {
+            ++cur;
+            return STATUS_DONE;
+        }
+        if(*cur++ != ',')
+            return STATUS_FAILED;
+    }
+}
+
+bool Projection::readTarget(Binding &binding, const char *&cur, const char *end)
+{
+    if(cur == end)
+        return false;
+
+    const char *str;
+    size_t     length;
+    JSONNumber number;
+
+    switch(binding.type)
+    {
+    case TARGET_STRING:
+        if(*cur != '"')
+            break;
+        ++cur;
+        if(!readJSONString(cur, end, scratch, str, length))
+            return false;
+        static_cast<string*>(binding.target)->assign(str, length);
+        return true;
+
+    case TARGET_BOOLEAN:
+        if(*cur == 't' || *cur == 'f')
+        {
+            bool value = *cur == 't';
+            if(!(value ? readJSONLiteral(cur, end, "true", 4)
+                       : readJSONLiteral(cur, end, "false", 5)))
+                return false;
+            *static_cast<bool*>(binding.target) = value;
+            return true;
+        }
+        break;
+
+    case TARGET_INTEGER:
+    case TARGET_REAL:
+        if(*cur != '-' && (*cur < '0' || *cur > '9'))
+            break;
+        if(!readJSONNumber(cur, end, number))
+            return false;
+        if(binding.type == TARGET_REAL)
+        {
+            *static_cast<double*>(binding.target) =
+                number.isReal ? number.real : (double)number.integer;
+            return true;
+        }
+        if(number.isReal)
+            break;
+        *static_cast<int64_t*>(binding.target) = number.integer;
+        return true;
+
+    case TARGET_VALUE:
+    {
+        const char *start = cur;
+        if(!skipJSONValue(cur, end))
+            return false;
+        *static_cast<Value*>(binding.target) = parseValue(start, cur - start);
+        return true;
+    }
+
+    case TARGET_EACH:
+        if(*cur != '[')
+            break;
+        return readRows(binding, cur, end);
+    }
+
+    throw Exception("Member '" + binding.path + "' has an unexpected type");
+}
+
+bool Projection::readRows(Binding &binding, const char *&cur, const char *end)
+{
+    Projection &row = *binding.row;
+    uint64_t all = row.bindings.size() == MAX_BINDINGS ?
+        ~(uint64_t)0 : (((uint64_t)1 << row.bindings.size()) - 1);
+
+    ++cur;
+    skipJSONSpace(cur, end);
+    if(cur < end && *cur == ']')
+    {
+        ++cur;
+        return true;
+    }
+
+    for(;;)
+    {
+        row.reset();
+
+        skipJSONSpace(cur, end);
+        if(cur < end && *cur == '{')
+        {
+            if(row.readObject(cur, end, 0, all, false) != STATUS_DONE)
+                return false;
+        }
+        else if(!skipJSONValue(cur, end))
+        {
+            return false;
+        }
+
+        if(binding.handler)
+            binding.handler();
+
+        skipJSONSpace(cur, end);
+        if(cur == end)
+            return false;
+        if(*cur == ']')
+        {
+            ++cur;
+            return true;
+        }
+        if(*cur++ != ',')
+            return false;
+    }
+}
+
+} //namespace CouchDB
@@ -0,0 +1,566 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/bind/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/static_assert.hpp>
+
+#include <cstring>
+
+#include "couchdb/Reply.hpp"
+#include "couchdb/Exception.hpp"
+#include "couchdb/Parser.hpp"
+#include "couchdb/Projection.hpp"
+
+#include "JSONScalars.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+
+namespace CouchDB
+{
+
+// ---[ MEMBER NAMES ]-----------------------------------------------------------
+
+enum ReplyKey
+{
+    KEY_UNKNOWN,
+    KEY_OK,
+    KEY_ID,
+    KEY_REV,
+    KEY_ERROR,
+    KEY_REASON,
+    KEY_KEY,
+    KEY_VALUE,
+    KEY_TOTAL_ROWS,
+    KEY_OFFSET,
+    KEY_ROWS
+};
+
+// Perfect hash of the member names above: every one lands in its own slot
+// of the table, so a lookup is one hash and at most one comparison.
+#define REPLY_KEY_HASH(length, first, last) (((length) + (first) * 4 + (last)) & 15)
+
+struct KeyEntry
+{
+    const char *name;
+    size_t     length;
+    ReplyKey   key;
+};
+
+static const KeyEntry keyTable[16] =
+{
+    { "",           0,  KEY_UNKNOWN    },
+    { "rev",        3,  KEY_REV        },
+    { "value",      5,  KEY_VALUE      },
+    { "",           0,  KEY_UNKNOWN    },
+    { "",           0,  KEY_UNKNOWN    },
+    { "",           0,  KEY_UNKNOWN    },
+    { "offset",     6,  KEY_OFFSET     },
+    { "",           0,  KEY_UNKNOWN    },
+    { "key",        3,  KEY_KEY        },
+    { "ok",         2,  KEY_OK         },
+    { "id",         2,  KEY_ID         },
+    { "error",      5,  KEY_ERROR      },
+    { "reason",     6,  KEY_REASON     },
+    { "total_rows", 10, KEY_TOTAL_ROWS },
+    { "",           0,  KEY_UNKNOWN    },
+    { "rows",       4,  KEY_ROWS       }
+};
+
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(3,  'r', 'v') == 1);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(5,  'v', 'e') == 2);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(6,  'o', 't') == 6);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(3,  'k', 'y') == 8);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(2,  'o', 'k') == 9);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(2,  'i', 'd') == 10);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(5,  'e', 'r') == 11);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(6,  'r', 'n') == 12);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(10, 't', 's') == 13);
+BOOST_STATIC_ASSERT(REPLY_KEY_HASH(4,  'r', 's') == 15);
+
+static inline ReplyKey lookupKey(const char *str, size_t length)
+{
+    if(length == 0)
+        return KEY_UNKNOWN;
+
+    const KeyEntry &entry = keyTable[REPLY_KEY_HASH(length, (unsigned char)str[0],
+                                                    (unsigned char)str[length - 1])];
+    if(entry.length == length && memcmp(entry.name, str, length) == 0)
+        return entry.key;
+    return KEY_UNKNOWN;
+}
+
+// ---[ SCANNING ]---------------------------------------------------------------
+
+static bool readString(const char *&cur, const char *end, string &scratch, string &out)
+{
+    const char *str;
+    size_t     length;
+
+    if(!consumeJSONChar(cur, end, '"') || !readJSONString(cur, end, scratch, str, length))
+        return false;
+    out.assign(str, length);
+    return true;
+}
+
+static bool readBoolean(const char *&cur, const char *end, bool &out)
+{
+    skipJSONSpace(cur, end);
+    if(cur == end)
+        return false;
+
+    out = *cur == 't';
+    return out ? readJSONLiteral(cur, end, "true", 4)
+               : readJSONLiteral(cur, end, "false", 5);
+}
+
+static bool readInteger(const char *&cur, const char *end, int64_t &out)
+{
+    JSONNumber number;
+
+    skipJSONSpace(cur, end);
+    if(!readJSONNumber(cur, end, number) || number.isReal)
+        return false;
+    out = number.integer;
+    return true;
+}
+
+// Reads the members of an object, handing each to reader.member(), which
+// reads the value and returns false if it is not what the fast path expects.
+template<typename Reader>
+static bool readObject(const char *&cur, const char *end, string &scratch, Reader &reader)
+{
+    if(!consumeJSONChar(cur, end, '{'))
+        return false;
+
+    skipJSONSpace(cur, end);
+    if(cur < end && *cur == '}')
+    {
+        ++cur;
+        return true;
+    }
+
+    for(;;)
+    {
+        const char *str;
+        size_t     length;
+
+        if(!consumeJSONChar(cur, end, '"') || !readJSONString(cur, end, scratch, str, length) ||
+           !consumeJSONChar(cur, end, ':') || !reader.member(lookupKey(str, length), cur, end))
+            return false;
+
+        skipJSONSpace(cur, end);
+        if(cur == end)
+            return false;
+        if(*cur == '}')
+        {
+            ++cur;
+            return true;
+        }
+        if(*cur++ != ',')
+            return false;
+    }
+}
+
+static bool atEnd(const char *cur, const char *end)
+{
+    skipJSONSpace(cur, end);
+    return cur == end;
+}
+
+// ---[ WRITE REPLIES ]----------------------------------------------------------
+
+class WriteReplyReader
+{
+public:
+    WriteReplyReader(WriteReply &_reply, string &_scratch)
+        : reply(_reply)
+        , scratch(_scratch)
+    {
+    }
+
+    bool member(ReplyKey key, const char *&cur, const char *end)
+    {
+        switch(key)
+        {
+        case KEY_OK:
+            reply.found |= WriteReply::MEMBER_OK;
+            return readBoolean(cur, end, reply.ok);
+        case KEY_ID:
+            reply.found |= WriteReply::MEMBER_ID;
+            return readString(cur, end, scratch, reply.id);
+        case KEY_REV:
+            reply.found |= WriteReply::MEMBER_REV;
+            return readString(cur, end, scratch, reply.rev);
+        case KEY_ERROR:
+            reply.found |= WriteReply::MEMBER_ERROR;
+            return readString(cur, end, scratch, reply.error);
+        case KEY_REASON:
+            reply.found |= WriteReply::MEMBER_REASON;
+            return readString(cur, end, scratch, reply.reason);
+        default:
+            return skipJSONValue(cur, end);
+        }
+    }
+
+private:
+    WriteReply &reply;
+    string     &scratch;
+};
+
+WriteReply::WriteReply()
+    : ok(false)
+    , found(0)
+{
+}
+
+bool WriteReply::has(Member member) const
+{
+    return (found & member) != 0;
+}
+
+bool decodeWriteReply(const char *data, size_t size, WriteReply &reply)
+{
+    const char *cur = data;
+    const char *end = data + size;
+    string     scratch;
+
+    reply = WriteReply();
+    WriteReplyReader reader(reply, scratch);
+    return readObject(cur, end, scratch, reader) && atEnd(cur, end);
+}
+
+static void copyMember(const Object &obj, const char *name, string &target,
+        unsigned &found, WriteReply::Member member)
+{
+    const Variant *value = find(obj, name);
+    if(value && *value)
+    {
+        if(const string *str = boost::any_cast<string>(value->get()))
+        {
+            target = *str;
+            found |= member;
+        }
+    }
+}
+
+static void copyReply(const Object &obj, WriteReply &reply)
+{
+    const Variant *ok = find(obj, "ok");
+    if(ok && *ok)
+    {
+        if(const bool *value = boost::any_cast<bool>(ok->get()))
+        {
+            reply.ok     = *value;
+            reply.found |= WriteReply::MEMBER_OK;
+        }
+    }
+
+    copyMember(obj, "id",     reply.id,     reply.found, WriteReply::MEMBER_ID);
+    copyMember(obj, "rev",    reply.rev,    reply.found, WriteReply::MEMBER_REV);
+    copyMember(obj, "error",  reply.error,  reply.found, WriteReply::MEMBER_ERROR);
+    copyMember(obj, "reason", reply.reason, reply.found, WriteReply::MEMBER_REASON);
+}
+
+void readWriteReply(const string &data, WriteReply &reply)
+{
+    readWriteReply(data.data(), data.size(), reply);
+}
+
+void readWriteReply(const char *data, size_t size, WriteReply &reply)
+{
+    if(decodeWriteReply(data, size, reply))
+        return;
+
+    reply = WriteReply();
+    Variant var = parseJSON(data, size);
+    if(var->empty())
+        throw Exception("Invalid JSON document");
+
+    if(const Object *obj = boost::any_cast<Object>(var.get()))
+        copyReply(*obj, reply);
+}
+
+bool decodeWriteReplies(const char *data, size_t size, vector<WriteReply> &replies)
+{
+    const char *cur = data;
+    const char *end = data + size;
+    string     scratch;
+
+    replies.clear();
+    if(!consumeJSONChar(cur, end, '['))
+        return false;
+
+    skipJSONSpace(cur, end);
+    if(cur < end && *cur == ']')
+        return atEnd(cur + 1, end);
+
+    for(;;)
+    {
+        replies.push_back(WriteReply());
+
+        WriteReplyReader reader(replies.back(), scratch);
+        if(!readObject(cur, end, scratch, reader))
+            return false;
+
+        skipJSONSpace(cur, end);
+        if(cur == end)
+            return false;
+        if(*cur == ']')
+            return atEnd(cur + 1, end);
+        if(*cur++ != ',')
+            return false;
+    }
+}
+
+void readWriteReplies(const string &data, vector<WriteReply> &replies)
+{
+    readWriteReplies(data.data(), data.size(), replies);
+}
+
+void readWriteReplies(const char *data, size_t size, vector<WriteReply> &replies)
+{
+    if(decodeWriteReplies(data, size, replies))
+        return;
+
+    replies.clear();
+    Variant var = parseJSON(data, size);
+    if(var->empty())
+        throw Exception("Invalid JSON document");
+
+    // a request that failed as a whole gets a single error object
+    if(const Object *obj = boost::any_cast<Object>(var.get()))
+    {
+        replies.push_back(WriteReply());
+        copyReply(*obj, replies.back());
+    }
+    else if(const Array *array = boost::any_cast<Array>(var.get()))
+    {
+        for(Array::const_iterator item = array->begin(); item != array->end(); ++item)
+        {
+            replies.push_back(WriteReply());
+            if(const Object *obj = boost::any_cast<Object>(item->get()))
+                copyReply(*obj, replies.back());
+        }
+    }
+}
+
+// ---[ DOCUMENT LISTS ]---------------------------------------------------------
+
+class RevisionReader
+{
+public:
+    RevisionReader(DocumentRow &_row, string &_scratch)
+        : found(false)
+        , row(_row)
+        , scratch(_scratch)
+    {
+    }
+
+    bool member(ReplyKey key, const char *&cur, const char *end)
+    {
+        if(key != KEY_REV)
+            return skipJSONValue(cur, end);
+
+        found = true;
+        return readString(cur, end, scratch, row.rev);
+    }
+
+    bool found;
+
+private:
+    DocumentRow &row;
+    string      &scratch;
+};
+
+class RowReader
+{
+public:
+    RowReader(DocumentRow &_row, string &_scratch)
+        : row(_row)
+        , scratch(_scratch)
+        , found(0)
+    {
+    }
+
+    bool member(ReplyKey key, const char *&cur, const char *end)
+    {
+        switch(key)
+        {
+        case KEY_ID:
+            found |= 1;
+            return readString(cur, end, scratch, row.id);
+        case KEY_KEY:
+            found |= 2;
+            return readString(cur, end, scratch, row.key);
+        case KEY_ERROR:
+            found |= 8;
+            return readString(cur, end, scratch, row.error);
+        case KEY_REASON:
+            return readString(cur, end, scratch, row.reason);
+        case KEY_VALUE:
+        {
+            RevisionReader value(row, scratch);
+            if(!readObject(cur, end, scratch, value) || !value.found)
+                return false;
+            found |= 4;
+            return true;
+        }
+        default:
+            return skipJSONValue(cur, end);
+        }
+    }
+
+    // whether id, key and value.rev were all present, or key and error
+    bool complete() const
+    {
+        return (found & 7) == 7 || (found & 10) == 10;
+    }
+
+private:
+    DocumentRow &row;
+    string      &scratch;
+    unsigned    found;
+};
+
+class DocumentListReader
+{
+public:
+    DocumentListReader(DocumentList &_list, string &_scratch)
+        : list(_list)
+        , scratch(_scratch)
+    {
+    }
+
+    bool member(ReplyKey key, const char *&cur, const char *end)
+    {
+        switch(key)
+        {
+        case KEY_TOTAL_ROWS:
+            return readInteger(cur, end, list.totalRows);
+        case KEY_OFFSET:
+            return readInteger(cur, end, list.offset);
+        case KEY_ROWS:
+            return readRows(cur, end);
+        case KEY_ERROR:
+            return readString(cur, end, scratch, list.error);
+        case KEY_REASON:
+            return readString(cur, end, scratch, list.reason);
+        default:
+            return skipJSONValue(cur, end);
+        }
+    }
+
+private:
+    bool readRows(const char *&cur, const char *end)
+    {
+        if(!consumeJSONChar(cur, end, '['))
+            return false;
+
+        skipJSONSpace(cur, end);
+        if(cur < end && *cur == ']')
+        {
+            ++cur;
+            return true;
+        }
+
+        for(;;)
+        {
+            list.rows.push_back(DocumentRow());
+
+            RowReader row(list.rows.back(), scratch);
+            if(!readObject(cur, end, scratch, row) || !row.complete())
+                return false;
+
+            skipJSONSpace(cur, end);
+            if(cur == end)
+                return false;
+            if(*cur == ']')
+            {
+                ++cur;
+                return true;
+            }
+            if(*cur++ != ',')
+                return false;
+        }
+    }
+
+    DocumentList &list;
+    string       &scratch;
+};
+
+DocumentList::DocumentList()
+    : totalRows(0)
+    , offset(0)
+{
+}
+
+bool decodeDocumentList(const char *data, size_t size, DocumentList &list)
+{
+    const char *cur = data;
+    const char *end = data + size;
+    string     scratch;
+
+    // rows are about 100 bytes each, which saves most reallocations
+    list = DocumentList();
+    list.rows.reserve(size / 128);
+
+    DocumentListReader reader(list, scratch);
+    return readObject(cur, end, scratch, reader) && atEnd(cur, end);
+}
+
+// the projection leaves a target alone when its member is missing, so the
+// row starts out empty again for the next one
+static void addRow(vector<DocumentRow> &rows, DocumentRow &row)
+{
+    rows.push_back(row);
+    row = DocumentRow();
+}
+
+void readDocumentList(const string &data, DocumentList &list)
+{
+    readDocumentList(data.data(), data.size(), list);
+}
+
+void readDocumentList(const char *data, size_t size, DocumentList &list)
+{
+    if(decodeDocumentList(data, size, list))
+        return;
+
+    list = DocumentList();
+
+    DocumentRow row;
+    Projection  rowProjection;
+    rowProjection.bind("id", row.id, Projection::BIND_OPTIONAL)
+                 .bind("key", row.key)
+                 .bind("value.rev", row.rev, Projection::BIND_OPTIONAL)
+                 .bind("error", row.error, Projection::BIND_OPTIONAL)
+                 .bind("reason", row.reason, Projection::BIND_OPTIONAL);
+
+    Projection page;
+    page.bind("total_rows", list.totalRows)
+        .bind("offset", list.offset, Projection::BIND_OPTIONAL)
+        .bind("error", list.error, Projection::BIND_OPTIONAL)
+        .bind("reason", list.reason, Projection::BIND_OPTIONAL)
+        .each("rows", rowProjection, boost::bind(addRow, boost::ref(list.rows),
+                                                 boost::ref(row)));
+
+    if(!page.apply(data, size))
+        throw Exception("Invalid JSON document");
+}
+
+} //namespace CouchDB
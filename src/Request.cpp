@@ -0,0 +1,271 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+
+#include <cstring>
+#include <iostream>
+
+#include "couchdb/Exception.hpp"
+
+#include "Request.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+typedef map<string, string> HeaderMap;
+
+// Connections the shared cache keeps, in use or idle, before it closes the
+// oldest idle ones; libcurl's default of 5 would have concurrent requests
+// close each other's.
+#define SHARED_MAX_CONNECTIONS 256
+
+// Exceptions must not cross curl: a source that throws aborts the upload.
+static size_t reader(char *buffer, size_t size, size_t nmemb, void *body)
+{
+    try
+    {
+        return static_cast<BodySource*>(body)->read(buffer, size * nmemb);
+    }
+    catch(...)
+    {
+        return CURL_READFUNC_ABORT;
+    }
+}
+
+// Rewinds the body when curl has to send it again.
+static int seeker(void *body, curl_off_t offset, int origin)
+{
+    if(origin != SEEK_SET || offset < 0)
+        return CURL_SEEKFUNC_CANTSEEK;
+
+    try
+    {
+        if(static_cast<BodySource*>(body)->seek(offset))
+            return CURL_SEEKFUNC_OK;
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    catch(...)
+    {
+        return CURL_SEEKFUNC_FAIL;
+    }
+}
+
+// Process-wide libcurl state, allocated on first use so that it does not
+// depend on the order of static initialization.
+struct SharedCaches
+{
+    boost::mutex locks[CURL_LOCK_DATA_LAST];
+    CURLSH       *sessions;
+    CURLSH       *connections;
+};
+
+static SharedCaches    *caches = NULL;
+static boost::once_flag curlOnce = BOOST_ONCE_INIT;
+
+static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void *locks)
+{
+    static_cast<boost::mutex*>(locks)[data].lock();
+}
+
+static void unlockShare(CURL*, curl_lock_data data, void *locks)
+{
+    static_cast<boost::mutex*>(locks)[data].unlock();
+}
+
+static CURLSH* createShare(boost::mutex *locks, bool connections)
+{
+    CURLSH *share = curl_share_init();
+    if(!share ||
+       curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare) != CURLSHE_OK ||
+       curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare) != CURLSHE_OK ||
+       curl_share_setopt(share, CURLSHOPT_USERDATA, locks) != CURLSHE_OK ||
+       curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK)
+    {
+        if(share)
+            curl_share_cleanup(share);
+        throw Exception("Unable to create shared caches");
+    }
+
+    // left unshared by a libcurl built without TLS or too old to share
+    // connections
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    if(connections)
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+    return share;
+}
+
+static void startCurl()
+{
+    if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+        throw Exception("Unable to initialize libcurl");
+
+    SharedCaches *created = new SharedCaches;
+    try
+    {
+        created->sessions    = createShare(created->locks, false);
+        created->connections = createShare(created->locks, true);
+    }
+    catch(...)
+    {
+        delete created;
+        throw;
+    }
+    caches = created;
+}
+
+void initCurl()
+{
+    // rethrows and lets the next call try again if it fails
+    boost::call_once(curlOnce, startCurl);
+}
+
+CURLSH* getSharedCaches(bool connections)
+{
+    return connections ? caches->connections : caches->sessions;
+}
+
+size_t getContentLength(CURL *curl)
+{
+    curl_off_t length;
+    if(curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK ||
+       length <= 0 || (curl_off_t)(size_t)length != length)
+        return 0;
+    return (size_t)length;
+}
+
+CURL* createHandle()
+{
+    CURL *curl = curl_easy_init();
+
+    // signals cannot be used to time out name lookups in threaded programs
+    if(curl && (curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L) != CURLE_OK ||
+                curl_easy_setopt(curl, CURLOPT_SHARE, getSharedCaches(false)) != CURLE_OK ||
+                curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, (long)SHARED_MAX_CONNECTIONS) != CURLE_OK))
+    {
+        curl_easy_cleanup(curl);
+        return NULL;
+    }
+
+    return curl;
+}
+
+static void setOptions(CURL *curl, const string &url, const string &method,
+        BodySource *body, const HeaderMap &headers, curl_write_callback write,
+        void *target, bool acceptEncoded, struct curl_slist *&chunk)
+{
+#ifdef COUCH_DB_DEBUG
+    cout << "Getting data: " << url << " [" << method << "]" << endl;
+#endif
+
+    if(curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write) != CURLE_OK ||
+       curl_easy_setopt(curl, CURLOPT_WRITEDATA, target) != CURLE_OK)
+    {
+        throw Exception("Unable to set writer function");
+    }
+
+    if(curl_easy_setopt(curl, CURLOPT_URL, url.c_str()) != CURLE_OK)
+    {
+        throw Exception("Unable to set URL: " + url);
+    }
+
+    // an empty list offers every encoding libcurl can decode
+    if(curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, acceptEncoded ? "" : NULL) != CURLE_OK)
+        throw Exception("Unable to set accepted encodings");
+
+    bool uploading = body != NULL && body->size() > 0;
+    if(uploading)
+    {
+#ifdef COUCH_DB_DEBUG
+        cout << "Sending data: " << body->size() << " bytes" << endl;
+#endif
+
+        if(curl_easy_setopt(curl, CURLOPT_READFUNCTION, reader) != CURLE_OK ||
+           curl_easy_setopt(curl, CURLOPT_READDATA, body) != CURLE_OK)
+            throw Exception("Unable to set read function");
+
+        if(curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seeker) != CURLE_OK ||
+           curl_easy_setopt(curl, CURLOPT_SEEKDATA, body) != CURLE_OK)
+            throw Exception("Unable to set seek function");
+
+        if(curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L) != CURLE_OK)
+            throw Exception("Unable to set upload request");
+
+        // -1 clears the size of an earlier upload on the handle
+        bool sized = body->size() != BodySource::UNKNOWN_SIZE;
+        if(curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
+                            sized ? (curl_off_t)body->size() : (curl_off_t)-1) != CURLE_OK)
+            throw Exception("Unable to set content size");
+
+        // over HTTP/2, where there is no chunked encoding, curl drops it
+        if(!sized)
+            chunk = curl_slist_append(chunk, "Transfer-Encoding: chunked");
+    }
+
+    if(headers.size() > 0 || uploading)
+    {
+        HeaderMap::const_iterator header = headers.begin();
+        const HeaderMap::const_iterator &headerEnd = headers.end();
+        for(; header != headerEnd; ++header){
+            string headerStr = header->first + ": " + header->second;
+            chunk = curl_slist_append(chunk, headerStr.c_str());
+        }
+
+        if(uploading && headers.find("Content-Type") == headers.end())
+            chunk = curl_slist_append(chunk, "Content-Type: application/json");
+
+        if(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk) != CURLE_OK)
+            throw Exception("Unable to set custom headers");
+    }
+
+    if(curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str()) != CURLE_OK)
+        throw Exception("Unable to set HTTP method: " + method);
+}
+
+struct curl_slist* prepareRequest(CURL *curl, const string &url,
+        const string &method, BodySource *body, const HeaderMap &headers,
+        curl_write_callback write, void *target, bool acceptEncoded)
+{
+    struct curl_slist *chunk = NULL;
+    try
+    {
+        setOptions(curl, url, method, body, headers, write, target, acceptEncoded, chunk);
+    }
+    catch(...)
+    {
+        resetRequest(curl, chunk);
+        throw;
+    }
+
+    return chunk;
+}
+
+void resetRequest(CURL *curl, struct curl_slist *chunk)
+{
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 0L);
+    curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(chunk);
+}
+
+} //namespace CouchDB
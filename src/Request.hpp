@@ -0,0 +1,67 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_REQUEST_HPP__
+#define __COUCH_DB_REQUEST_HPP__
+
+#include <map>
+#include <string>
+
+#include <curl/curl.h>
+
+#include "couchdb/BodySource.hpp"
+
+namespace CouchDB
+{
+
+// Request setup shared by the blocking calls and the asynchronous engine.
+
+// Sets the URL, method, body and headers of a request on the handle. The
+// body, if any, is read from `body`, which must outlive the transfer, and
+// the response is handed to `write` with `target`, decoded as it arrives if
+// `acceptEncoded` let the server compress it. Returns the header list, to
+// be given to resetRequest() once the transfer is over. Throws Exception.
+struct curl_slist* prepareRequest(CURL*, const std::string &url,
+        const std::string &method, BodySource *body,
+        const std::map<std::string, std::string> &headers,
+        curl_write_callback write, void *target, bool acceptEncoded);
+
+// Clears what prepareRequest() set that would otherwise carry over to the
+// next request on the handle, and frees the header list.
+void resetRequest(CURL*, struct curl_slist*);
+
+// Length the server announced for the response being received, 0 if it
+// did not. That of a compressed response is its encoded length.
+size_t getContentLength(CURL*);
+
+// Initializes libcurl once for the whole process; later calls return at
+// once. It is never cleaned up, as handles may outlive any Communication.
+// Throws Exception if it fails.
+void initCurl();
+
+// Caches shared by the handles of every Communication in the process: DNS
+// lookups and TLS sessions, plus open connections if `connections` is set.
+// Those are for handles run on their own with curl_easy_perform; a multi
+// handle's transfers keep to its own connection cache, which multiplexing
+// and its connection limits rely on. initCurl() must have been called.
+CURLSH* getSharedCaches(bool connections);
+
+// New easy handle set up for use from any thread, sharing DNS and TLS
+// session caches, or NULL.
+CURL* createHandle();
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <algorithm>
+#include <ctime>
+
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "RequestTracker.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+// GETs timed to estimate the hedging percentile, and how many are enough
+#define LATENCY_SAMPLES     256
+#define MIN_LATENCY_SAMPLES 20
+
+RequestTracker::RequestTracker()
+    : next(0)
+    , random((boost::uint32_t)(time(NULL) ^ (size_t)this))
+{
+    latencies.reserve(LATENCY_SAMPLES);
+}
+
+void RequestTracker::addLatency(unsigned long microseconds)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    if(latencies.size() < LATENCY_SAMPLES)
+        latencies.push_back(microseconds);
+    else
+        latencies[next] = microseconds;
+    next = (next + 1) % LATENCY_SAMPLES;
+}
+
+bool RequestTracker::getHedgeDelay(double percentile, unsigned long &microseconds) const
+{
+    vector<unsigned long> sorted;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if(latencies.size() < MIN_LATENCY_SAMPLES)
+            return false;
+        sorted = latencies;
+    }
+
+    size_t rank = min(sorted.size() - 1, (size_t)(percentile / 100 * sorted.size()));
+    nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    microseconds = sorted[rank];
+    return true;
+}
+
+// Full jitter: spread over the whole window, so that clients which failed
+// together do not come back together.
+unsigned RequestTracker::getBackoff(unsigned attempt, unsigned backoff, unsigned maxBackoff)
+{
+    unsigned window = min(backoff, maxBackoff);
+    for(unsigned i = 1; i < attempt && window < maxBackoff; ++i)
+        window = window > maxBackoff / 2 ? maxBackoff : window * 2;
+
+    boost::mutex::scoped_lock lock(mutex);
+    return boost::random::uniform_int_distribution<unsigned>(0, window)(random);
+}
+
+void RequestTracker::countRequest()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ++metrics.requests;
+}
+
+void RequestTracker::countRetry()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ++metrics.retries;
+}
+
+void RequestTracker::countHedge()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ++metrics.hedged;
+}
+
+void RequestTracker::countHedgeWon()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    ++metrics.hedgesWon;
+}
+
+RequestMetrics RequestTracker::getMetrics() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return metrics;
+}
+
+} //namespace CouchDB
@@ -0,0 +1,65 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_REQUEST_TRACKER_HPP__
+#define __COUCH_DB_REQUEST_TRACKER_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+#include "couchdb/Communication.hpp"
+
+namespace CouchDB
+{
+
+// What a Communication's RequestPolicy goes by: the latencies of recent
+// GETs, the random source of the backoff, and the counts reported as
+// RequestMetrics. Shared by the threads making requests.
+class RequestTracker : boost::noncopyable
+{
+public:
+    RequestTracker();
+
+    // time a GET that could have been hedged took to be answered
+    void addLatency(unsigned long microseconds);
+
+    // Sets `microseconds` to the latency at `percentile` of the recent
+    // GETs. Returns false while too few have been timed to tell.
+    bool getHedgeDelay(double percentile, unsigned long &microseconds) const;
+
+    // random wait in milliseconds before retry `attempt`, 1 for the first
+    unsigned getBackoff(unsigned attempt, unsigned backoff, unsigned maxBackoff);
+
+    void countRequest();
+    void countRetry();
+    void countHedge();
+    void countHedgeWon();
+
+    RequestMetrics getMetrics() const;
+
+private:
+    mutable boost::mutex       mutex;
+    std::vector<unsigned long> latencies;   // a ring once full
+    size_t                     next;
+    boost::random::mt19937     random;
+    RequestMetrics             metrics;
+};
+
+} //namespace CouchDB
+
+#endif
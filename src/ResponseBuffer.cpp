@@ -0,0 +1,211 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "couchdb/Exception.hpp"
+#include "couchdb/ResponseBuffer.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+ResponseBuffer::ResponseBuffer()
+    : mapped(NULL)
+    , mappedSize(0)
+    , length(0)
+    , threshold(0)
+    , fd(-1)
+{
+}
+
+ResponseBuffer::~ResponseBuffer()
+{
+    unmap();
+}
+
+const char* ResponseBuffer::data() const
+{
+    return mapped ? mapped : text.data();
+}
+
+size_t ResponseBuffer::size() const
+{
+    return mapped ? length : text.size();
+}
+
+bool ResponseBuffer::empty() const
+{
+    return size() == 0;
+}
+
+bool ResponseBuffer::isMapped() const
+{
+    return mapped != NULL;
+}
+
+void ResponseBuffer::setSpillThreshold(size_t bytes)
+{
+#ifndef _WIN32
+    threshold = bytes;
+#endif
+}
+
+size_t ResponseBuffer::getSpillThreshold() const
+{
+    return threshold;
+}
+
+void ResponseBuffer::reserve(size_t bytes)
+{
+    if(mapped)
+    {
+        if(bytes > mappedSize)
+            map(bytes);
+    }
+    else if(threshold > 0 && bytes > threshold)
+        map(bytes);
+    else
+        text.reserve(bytes);
+}
+
+void ResponseBuffer::append(const char *data, size_t count)
+{
+    size_t needed = size() + count;
+    if(!mapped && (threshold == 0 || needed <= threshold))
+    {
+        text.append(data, count);
+        return;
+    }
+
+    // doubling, as a string would, keeps remapping rare
+    if(!mapped || needed > mappedSize)
+        map(max(2 * needed, threshold));
+
+    memcpy(mapped + length, data, count);
+    length += count;
+}
+
+void ResponseBuffer::clear()
+{
+    text.clear();
+    unmap();
+}
+
+void ResponseBuffer::swap(ResponseBuffer &other)
+{
+    text.swap(other.text);
+    std::swap(mapped,     other.mapped);
+    std::swap(mappedSize, other.mappedSize);
+    std::swap(length,     other.length);
+    std::swap(threshold,  other.threshold);
+    std::swap(fd,         other.fd);
+}
+
+bool ResponseBuffer::swap(string &other)
+{
+    if(mapped)
+        return false;
+
+    text.swap(other);
+    return true;
+}
+
+#ifndef _WIN32
+
+// Creates the file mapping, moving what is held in memory into it, or
+// grows it. The file only ever grows, so what it holds survives remapping.
+void ResponseBuffer::map(size_t bytes)
+{
+    if(fd < 0)
+    {
+        const char *dir  = getenv("TMPDIR");
+        string     path  = string(dir && *dir ? dir : "/tmp") + "/couchdbpp-XXXXXX";
+        vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+
+        fd = mkstemp(&name[0]);
+        if(fd < 0)
+            throw Exception("Unable to create a temporary file in " + path);
+
+        // nothing left on disk once the descriptor is closed
+        unlink(&name[0]);
+    }
+
+    if(mapped)
+    {
+        munmap(mapped, mappedSize);
+        mapped = NULL;
+    }
+
+    void *address = MAP_FAILED;
+    if(ftruncate(fd, bytes) == 0)
+        address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(address == MAP_FAILED)
+    {
+        unmap();
+        text.clear();
+        throw Exception("Unable to map a temporary file");
+    }
+
+    mapped     = static_cast<char*>(address);
+    mappedSize = bytes;
+
+    if(!text.empty())
+    {
+        memcpy(mapped, text.data(), text.size());
+        length = text.size();
+
+        // give the memory back rather than keep the capacity
+        string().swap(text);
+    }
+}
+
+void ResponseBuffer::unmap()
+{
+    if(mapped)
+        munmap(mapped, mappedSize);
+    if(fd >= 0)
+        close(fd);
+
+    mapped     = NULL;
+    mappedSize = 0;
+    length     = 0;
+    fd         = -1;
+}
+
+#else
+
+// never called, the threshold stays 0
+void ResponseBuffer::map(size_t)
+{
+}
+
+void ResponseBuffer::unmap()
+{
+}
+
+#endif
+
+} //namespace CouchDB
@@ -0,0 +1,150 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cctype>
+#include <cstring>
+
+#include "couchdb/Writer.hpp"
+
+#include "Session.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+#define COOKIE_NAME "AuthSession="
+
+// below CouchDB's default session timeout of 600 seconds
+#define DEFAULT_REFRESH_SECONDS 540
+
+Session::Session()
+    : renewed(0)
+    , renewals(0)
+    , refresh(DEFAULT_REFRESH_SECONDS)
+{
+}
+
+void Session::open(const string &_name, const string &_password)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    name     = _name;
+    password = _password;
+    cookie.clear();
+    renewed  = 0;
+}
+
+void Session::close()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    name.clear();
+    password.clear();
+    cookie.clear();
+    renewed = 0;
+}
+
+bool Session::isOpen() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return name.size() > 0;
+}
+
+bool Session::getCookie(string &value) const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    value = cookie;
+    return name.size() > 0;
+}
+
+bool Session::isDue() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return name.size() > 0 && time(NULL) - renewed >= (time_t)refresh;
+}
+
+size_t Session::getRenewals() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return renewals;
+}
+
+void Session::setRefresh(unsigned seconds)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    refresh = seconds;
+}
+
+unsigned Session::getRefresh() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return refresh;
+}
+
+string Session::getLoginBody() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    string body = "{\"name\":";
+    writeJSONString(name, body);
+    body += ",\"password\":";
+    writeJSONString(password, body);
+    body += '}';
+    return body;
+}
+
+void Session::setCookie(const char *value, size_t size)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    if(name.empty())
+        return;
+
+    cookie.assign(value, size);
+    renewed = time(NULL);
+    ++renewals;
+}
+
+size_t Session::readHeader(char *data, size_t size, size_t nmemb, void *session)
+{
+    static const char field[] = "set-cookie:";
+
+    size_t length = size * nmemb;
+    if(length < sizeof(field) - 1)
+        return length;
+    for(size_t i = 0; i < sizeof(field) - 1; ++i)
+    {
+        if(tolower((unsigned char)data[i]) != field[i])
+            return length;
+    }
+
+    const char *value = data + sizeof(field) - 1;
+    const char *end   = data + length;
+    while(value < end && *value == ' ')
+        ++value;
+    if((size_t)(end - value) <= sizeof(COOKIE_NAME) - 1 ||
+       memcmp(value, COOKIE_NAME, sizeof(COOKIE_NAME) - 1) != 0)
+        return length;
+
+    // an empty value is the server dropping a refused cookie; the next
+    // login replaces it
+    const char *stop = value + sizeof(COOKIE_NAME) - 1;
+    while(stop < end && *stop != ';' && *stop != '\r' && *stop != '\n')
+        ++stop;
+    if(stop > value + sizeof(COOKIE_NAME) - 1)
+        static_cast<Session*>(session)->setCookie(value, stop - value);
+
+    return length;
+}
+
+} //namespace CouchDB
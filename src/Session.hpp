@@ -0,0 +1,83 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_SESSION_HPP__
+#define __COUCH_DB_SESSION_HPP__
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ctime>
+#include <string>
+
+namespace CouchDB
+{
+
+#define SESSION_PATH "/_session"
+
+// Cookie authentication state of a Communication, see
+// Communication::login. Read and updated from any thread, the I/O thread
+// included. The password is kept to log in again once the cookie expires.
+class Session : boost::noncopyable
+{
+public:
+    Session();
+
+    // Starts a session, whose cookie comes from the login response, or
+    // ends it.
+    void open(const std::string &name, const std::string &password);
+    void close();
+
+    bool isOpen() const;
+
+    // Copies the Cookie header value to send, empty until a login
+    // succeeded. Returns false if no session is open.
+    bool getCookie(std::string&) const;
+
+    // whether the cookie is older than the refresh age
+    bool isDue() const;
+
+    // cookies received so far, the same value sent again included
+    size_t getRenewals() const;
+
+    void setRefresh(unsigned seconds);
+    unsigned getRefresh() const;
+
+    // JSON body of a login request
+    std::string getLoginBody() const;
+
+    // Header callback, same shape as libcurl's, keeping the AuthSession
+    // cookie a response sets while a session is open.
+    static size_t readHeader(char*, size_t, size_t, void *session);
+
+    // held while logging in, so that the threads finding the cookie refused
+    // at the same time only log in once
+    boost::mutex loginMutex;
+
+private:
+    void setCookie(const char*, size_t);
+
+    mutable boost::mutex mutex;
+    std::string          name;
+    std::string          password;
+    std::string          cookie;
+    time_t               renewed;
+    size_t               renewals;
+    unsigned             refresh;
+};
+
+} //namespace CouchDB
+
+#endif
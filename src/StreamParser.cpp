@@ -0,0 +1,419 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+
+#include "couchdb/StreamParser.hpp"
+
+#include "JSONScalars.hpp"
+#include "StringKernels.hpp"
+#include "ValueBuilder.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+
+namespace CouchDB
+{
+
+// ---[ HANDLERS ]---------------------------------------------------------------
+
+JSONHandler::~JSONHandler()
+{
+}
+
+void JSONHandler::null()                        {}
+void JSONHandler::boolean(bool)                 {}
+void JSONHandler::integer(int64_t)              {}
+void JSONHandler::real(double)                  {}
+void JSONHandler::string(const char*, size_t)   {}
+void JSONHandler::key(const char*, size_t)      {}
+void JSONHandler::startObject()                 {}
+void JSONHandler::endObject()                   {}
+void JSONHandler::startArray()                  {}
+void JSONHandler::endArray()                    {}
+
+ValueHandler::ValueHandler()
+    : builder(new ValueBuilder())
+{
+}
+
+ValueHandler::~ValueHandler()
+{
+}
+
+Value& ValueHandler::getRoot()
+{
+    return builder->getRoot();
+}
+
+void ValueHandler::null()                               { builder->null(); }
+void ValueHandler::boolean(bool value)                  { builder->boolean(value); }
+void ValueHandler::integer(int64_t value)               { builder->integer(value); }
+void ValueHandler::real(double value)                   { builder->real(value); }
+void ValueHandler::string(const char *str, size_t len)  { builder->string(str, len); }
+void ValueHandler::key(const char *str, size_t len)     { builder->key(str, len); }
+void ValueHandler::startObject()                        { builder->startObject(); }
+void ValueHandler::endObject()                          { builder->endObject(); }
+void ValueHandler::startArray()                         { builder->startArray(); }
+void ValueHandler::endArray()                           { builder->endArray(); }
+
+// ---[ STREAM PARSER ]----------------------------------------------------------
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// characters that may continue a number or a literal
+static inline bool isTokenChar(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+           c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+StreamParser::StreamParser(JSONHandler &_handler)
+    : handler(_handler)
+{
+    reset();
+}
+
+void StreamParser::reset()
+{
+    scopes.clear();
+    pending.clear();
+    expect  = EXPECT_VALUE;
+    token   = TOKEN_NONE;
+    escaped = false;
+    failed  = false;
+}
+
+bool StreamParser::feed(const string &data)
+{
+    return feed(data.data(), data.size());
+}
+
+bool StreamParser::feed(const char *data, size_t size)
+{
+    const char *cur = data;
+    const char *end = data + size;
+
+    if(failed)
+        return false;
+
+    if(token != TOKEN_NONE && !resumeToken(cur, end))
+        return fail();
+
+    while(cur < end)
+    {
+        char c = *cur;
+        if(isSpace(c))
+        {
+            ++cur;
+            continue;
+        }
+
+        switch(expect)
+        {
+        case EXPECT_NOTHING:
+            return fail();
+
+        case EXPECT_COLON:
+            if(c != ':')
+                return fail();
+            ++cur;
+            expect = EXPECT_VALUE;
+            continue;
+
+        case EXPECT_NEXT:
+            if(c == ',')
+            {
+                ++cur;
+                expect = scopes.back() == '{' ? EXPECT_KEY : EXPECT_VALUE;
+                continue;
+            }
+            if((c == '}' && scopes.back() == '{') || (c == ']' && scopes.back() == '['))
+            {
+                ++cur;
+                endContainer();
+                continue;
+            }
+            return fail();
+
+        case EXPECT_FIRST_KEY:
+            if(c == '}')
+            {
+                ++cur;
+                endContainer();
+                continue;
+            }
+            // fall through
+        case EXPECT_KEY:
+            if(c != '"' || !startToken(TOKEN_KEY, cur, end))
+                return fail();
+            continue;
+
+        case EXPECT_FIRST_VALUE:
+            if(c == ']')
+            {
+                ++cur;
+                endContainer();
+                continue;
+            }
+            // fall through
+        case EXPECT_VALUE:
+            break;
+        }
+
+        // a value starts here
+        switch(c)
+        {
+        case '{':
+            ++cur;
+            handler.startObject();
+            scopes.push_back('{');
+            expect = EXPECT_FIRST_KEY;
+            break;
+
+        case '[':
+            ++cur;
+            handler.startArray();
+            scopes.push_back('[');
+            expect = EXPECT_FIRST_VALUE;
+            break;
+
+        case '"':
+            if(!startToken(TOKEN_STRING, cur, end))
+                return fail();
+            break;
+
+        case 't':
+        case 'f':
+        case 'n':
+            if(!startToken(TOKEN_LITERAL, cur, end))
+                return fail();
+            break;
+
+        default:
+            if(c != '-' && (c < '0' || c > '9'))
+                return fail();
+            if(!startToken(TOKEN_NUMBER, cur, end))
+                return fail();
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool StreamParser::finish()
+{
+    if(failed)
+        return false;
+
+    // a number has no terminator of its own, the end of input is one
+    if(token == TOKEN_NUMBER || token == TOKEN_LITERAL)
+    {
+        Token last = token;
+        token = TOKEN_NONE;
+        if(!endToken(last, pending.data(), pending.data() + pending.size()))
+            return fail();
+        pending.clear();
+    }
+
+    if(token != TOKEN_NONE || expect != EXPECT_NOTHING)
+        return fail();
+
+    return true;
+}
+
+// Returns the closing quote of a string, or NULL if it is not in [cur, end).
+// `escaped` carries a trailing backslash over to the next chunk.
+const char* StreamParser::findQuote(const char *cur, const char *end)
+{
+    while(cur < end)
+    {
+        if(escaped)
+        {
+            escaped = false;
+            ++cur;
+            continue;
+        }
+
+        bool       nonASCII = false;
+        const char *special = findQuoteOrEscape(cur, end, nonASCII);
+        if(special == end)
+            break;
+        if(*special == '"')
+            return special;
+
+        // a control character is left for the string reader to refuse
+        cur     = special + 1;
+        escaped = *special == '\\';
+    }
+    return NULL;
+}
+
+// Reads the token at `cur` if it ends within this chunk, otherwise keeps
+// what there is of it for the next one.
+bool StreamParser::startToken(Token type, const char *&cur, const char *end)
+{
+    const char *start = cur;
+    const char *stop  = NULL;
+
+    if(type == TOKEN_STRING || type == TOKEN_KEY)
+    {
+        escaped = false;
+        const char *quote = findQuote(cur + 1, end);
+        if(quote)
+            stop = quote + 1;
+    }
+    else
+    {
+        stop = cur + 1;
+        while(stop < end && isTokenChar(*stop))
+            ++stop;
+        if(stop == end)
+            stop = NULL;
+    }
+
+    if(!stop)
+    {
+        // the token continues in the next chunk
+        pending.assign(start, end);
+        token = type;
+        cur   = end;
+        return true;
+    }
+
+    cur = stop;
+    return endToken(type, start, stop);
+}
+
+bool StreamParser::resumeToken(const char *&cur, const char *end)
+{
+    const char *stop;
+
+    if(token == TOKEN_STRING || token == TOKEN_KEY)
+    {
+        const char *quote = findQuote(cur, end);
+        stop = quote ? quote + 1 : end;
+        pending.append(cur, stop);
+        cur = stop;
+        if(!quote)
+            return true;
+    }
+    else
+    {
+        stop = cur;
+        while(stop < end && isTokenChar(*stop))
+            ++stop;
+        pending.append(cur, stop);
+        cur = stop;
+        if(stop == end)
+            return token != TOKEN_LITERAL || pending.size() <= 5;
+    }
+
+    Token type = token;
+    token = TOKEN_NONE;
+    bool ok = endToken(type, pending.data(), pending.data() + pending.size());
+    pending.clear();
+    return ok;
+}
+
+// Decodes a complete token and reports it.
+bool StreamParser::endToken(Token type, const char *start, const char *stop)
+{
+    const char *cur = start;
+
+    switch(type)
+    {
+    case TOKEN_STRING:
+    case TOKEN_KEY:
+    {
+        const char *str;
+        size_t     length;
+
+        ++cur;
+        if(!readJSONString(cur, stop, scratch, str, length) || cur != stop)
+            return false;
+
+        if(type == TOKEN_KEY)
+        {
+            handler.key(str, length);
+            expect = EXPECT_COLON;
+            return true;
+        }
+
+        handler.string(str, length);
+        break;
+    }
+
+    case TOKEN_NUMBER:
+    {
+        JSONNumber number;
+        if(!readJSONNumber(cur, stop, number) || cur != stop)
+            return false;
+
+        if(number.isReal)
+            handler.real(number.real);
+        else
+            handler.integer(number.integer);
+        break;
+    }
+
+    case TOKEN_LITERAL:
+        if(readJSONLiteral(cur, stop, "true", 4) && cur == stop)
+            handler.boolean(true);
+        else if(readJSONLiteral(cur, stop, "false", 5) && cur == stop)
+            handler.boolean(false);
+        else if(readJSONLiteral(cur, stop, "null", 4) && cur == stop)
+            handler.null();
+        else
+            return false;
+        break;
+
+    case TOKEN_NONE:
+        return false;
+    }
+
+    endValue();
+    return true;
+}
+
+void StreamParser::endContainer()
+{
+    char scope = scopes.back();
+    scopes.pop_back();
+
+    if(scope == '{')
+        handler.endObject();
+    else
+        handler.endArray();
+
+    endValue();
+}
+
+void StreamParser::endValue()
+{
+    expect = scopes.empty() ? EXPECT_NOTHING : EXPECT_NEXT;
+}
+
+bool StreamParser::fail()
+{
+    failed = true;
+    return false;
+}
+
+} //namespace CouchDB
@@ -0,0 +1,302 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/cstdint.hpp>
+
+#include "StringKernels.hpp"
+
+#ifdef COUCH_DB_X86_KERNELS
+    #include <immintrin.h>
+#endif
+
+using namespace std;
+
+using ::boost::uint32_t;
+
+namespace CouchDB
+{
+
+typedef const char* (*FindQuoteKernel)(const char*, const char*, bool&);
+typedef const char* (*FindEscapableKernel)(const char*, const char*);
+typedef const char* (*SkipASCIIKernel)(const char*, const char*);
+
+// ---[ SCALAR KERNEL ]----------------------------------------------------------
+
+static const char* findQuoteScalar(const char *cur, const char *end, bool &nonASCII)
+{
+    unsigned char high = 0;
+    for(; cur < end && *cur != '"' && *cur != '\\' && (unsigned char)*cur >= 0x20; ++cur)
+        high |= (unsigned char)*cur;
+
+    if(high & 0x80)
+        nonASCII = true;
+    return cur;
+}
+
+static const char* findEscapableScalar(const char *cur, const char *end)
+{
+    while(cur < end && *cur != '"' && *cur != '\\' && (unsigned char)*cur >= 0x20)
+        ++cur;
+    return cur;
+}
+
+static const char* skipASCIIScalar(const char *cur, const char *end)
+{
+    while(cur < end && !(*cur & 0x80))
+        ++cur;
+    return cur;
+}
+
+#ifdef COUCH_DB_X86_KERNELS
+
+// The vector loops stop at the first block containing a match and leave
+// the rest, including the last partial block, to the scalar loops.
+
+// ---[ SSE2 KERNEL ]------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static const char* findQuoteSSE2(const char *cur, const char *end, bool &nonASCII)
+{
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control   = _mm_set1_epi8(0x1f);
+
+    __m128i high = _mm_setzero_si128();
+    for(; end - cur >= 16; cur += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)cur);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chars, quote), _mm_cmpeq_epi8(chars, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chars, control), control)));
+        if(mask)
+        {
+            unsigned before = (mask & (0 - mask)) - 1;
+            if(_mm_movemask_epi8(high) || (_mm_movemask_epi8(chars) & before))
+                nonASCII = true;
+            return cur + __builtin_ctz(mask);
+        }
+        high = _mm_or_si128(high, chars);
+    }
+
+    if(_mm_movemask_epi8(high))
+        nonASCII = true;
+    return findQuoteScalar(cur, end, nonASCII);
+}
+
+__attribute__((target("sse2")))
+static const char* findEscapableSSE2(const char *cur, const char *end)
+{
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control   = _mm_set1_epi8(0x1f);
+
+    for(; end - cur >= 16; cur += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)cur);
+        __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chars, quote), _mm_cmpeq_epi8(chars, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chars, control), control));
+        unsigned mask = _mm_movemask_epi8(special);
+        if(mask)
+            return cur + __builtin_ctz(mask);
+    }
+    return findEscapableScalar(cur, end);
+}
+
+__attribute__((target("sse2")))
+static const char* skipASCIISSE2(const char *cur, const char *end)
+{
+    for(; end - cur >= 16; cur += 16)
+    {
+        unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)cur));
+        if(mask)
+            return cur + __builtin_ctz(mask);
+    }
+    return skipASCIIScalar(cur, end);
+}
+
+// ---[ AVX2 KERNEL ]------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static const char* findQuoteAVX2(const char *cur, const char *end, bool &nonASCII)
+{
+    const __m256i quote     = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control   = _mm256_set1_epi8(0x1f);
+
+    __m256i high = _mm256_setzero_si256();
+    for(; end - cur >= 32; cur += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)cur);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chars, quote), _mm256_cmpeq_epi8(chars, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(chars, control), control)));
+        if(mask)
+        {
+            uint32_t before = (mask & (0 - mask)) - 1;
+            if(_mm256_movemask_epi8(high) || ((uint32_t)_mm256_movemask_epi8(chars) & before))
+                nonASCII = true;
+            return cur + __builtin_ctz(mask);
+        }
+        high = _mm256_or_si256(high, chars);
+    }
+
+    if(_mm256_movemask_epi8(high))
+        nonASCII = true;
+    return findQuoteScalar(cur, end, nonASCII);
+}
+
+__attribute__((target("avx2")))
+static const char* findEscapableAVX2(const char *cur, const char *end)
+{
+    const __m256i quote     = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control   = _mm256_set1_epi8(0x1f);
+
+    for(; end - cur >= 32; cur += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)cur);
+        __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chars, quote), _mm256_cmpeq_epi8(chars, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(chars, control), control));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        if(mask)
+            return cur + __builtin_ctz(mask);
+    }
+    return findEscapableSSE2(cur, end);
+}
+
+__attribute__((target("avx2")))
+static const char* skipASCIIAVX2(const char *cur, const char *end)
+{
+    for(; end - cur >= 32; cur += 32)
+    {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)cur));
+        if(mask)
+            return cur + __builtin_ctz(mask);
+    }
+    return skipASCIISSE2(cur, end);
+}
+
+#endif //COUCH_DB_X86_KERNELS
+
+// ---[ RUNTIME DISPATCH ]-------------------------------------------------------
+
+struct StringKernel
+{
+    KernelLevel         level;
+    FindQuoteKernel     findQuote;
+    FindEscapableKernel findEscapable;
+    SkipASCIIKernel     skipASCII;
+};
+
+static StringKernel findKernel(KernelLevel level)
+{
+    StringKernel kernel = { KERNEL_SCALAR, findQuoteScalar, findEscapableScalar, skipASCIIScalar };
+#ifdef COUCH_DB_X86_KERNELS
+    if(level == KERNEL_SSE2)
+    {
+        StringKernel sse2 = { KERNEL_SSE2, findQuoteSSE2, findEscapableSSE2, skipASCIISSE2 };
+        kernel = sse2;
+    }
+    else if(level == KERNEL_AVX2)
+    {
+        StringKernel avx2 = { KERNEL_AVX2, findQuoteAVX2, findEscapableAVX2, skipASCIIAVX2 };
+        kernel = avx2;
+    }
+#endif
+    return kernel;
+}
+
+static StringKernel& activeKernel()
+{
+    static StringKernel kernel = findKernel(detectKernelLevel());
+    return kernel;
+}
+
+const char* findQuoteOrEscape(const char *cur, const char *end, bool &nonASCII)
+{
+    return activeKernel().findQuote(cur, end, nonASCII);
+}
+
+const char* findEscapable(const char *cur, const char *end)
+{
+    return activeKernel().findEscapable(cur, end);
+}
+
+// ---[ UTF-8 VALIDATION ]-------------------------------------------------------
+
+bool isValidUTF8(const char *data, const char *end)
+{
+    const unsigned char *cur  = (const unsigned char*)data;
+    const unsigned char *stop = (const unsigned char*)end;
+    SkipASCIIKernel     skipASCII = activeKernel().skipASCII;
+
+    for(;;)
+    {
+        cur = (const unsigned char*)skipASCII((const char*)cur, end);
+        if(cur == stop)
+            return true;
+
+        // lead byte: number of continuation bytes and the smallest and
+        // largest allowed value of the first one, which rules out overlong
+        // forms, surrogates and code points above U+10FFFF
+        unsigned char lead = *cur;
+        size_t        count;
+        unsigned char low = 0x80, high = 0xbf;
+
+        if(lead >= 0xc2 && lead <= 0xdf)
+            count = 1;
+        else if(lead >= 0xe0 && lead <= 0xef)
+        {
+            count = 2;
+            if(lead == 0xe0)
+                low = 0xa0;
+            else if(lead == 0xed)
+                high = 0x9f;
+        }
+        else if(lead >= 0xf0 && lead <= 0xf4)
+        {
+            count = 3;
+            if(lead == 0xf0)
+                low = 0x90;
+            else if(lead == 0xf4)
+                high = 0x8f;
+        }
+        else
+            return false;
+
+        if((size_t)(stop - cur) <= count || cur[1] < low || cur[1] > high)
+            return false;
+        for(size_t i = 2; i <= count; ++i)
+        {
+            if((cur[i] & 0xc0) != 0x80)
+                return false;
+        }
+        cur += count + 1;
+    }
+}
+
+KernelLevel getStringKernel()
+{
+    return activeKernel().level;
+}
+
+void setStringKernel(KernelLevel level)
+{
+    activeKernel() = findKernel(level);
+}
+
+} //namespace CouchDB
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_STRING_KERNELS_HPP__
+#define __COUCH_DB_STRING_KERNELS_HPP__
+
+#include "KernelSelection.hpp"
+
+namespace CouchDB
+{
+
+// Bulk scanning of string contents, using the same SIMD kernels and the
+// same runtime selection as the structural index.
+
+// Returns the first quote, backslash or control character in [cur, end),
+// or end. `nonASCII` is set if a byte before it has the high bit set,
+// otherwise left alone.
+const char* findQuoteOrEscape(const char *cur, const char *end, bool &nonASCII);
+
+// Returns the first character in [cur, end) that must be escaped in JSON
+// output (quote, backslash or control character), or end.
+const char* findEscapable(const char *cur, const char *end);
+
+// Checks for well-formed UTF-8: no overlong forms, no surrogates and
+// nothing above U+10FFFF.
+bool isValidUTF8(const char *cur, const char *end);
+
+// The kernel in use; the level must have passed findKernelLevel().
+KernelLevel getStringKernel();
+void setStringKernel(KernelLevel);
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,392 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <cstring>
+
+#include "couchdb/Exception.hpp"
+
+#include "StructuralIndex.hpp"
+
+#ifdef COUCH_DB_X86_KERNELS
+    #include <immintrin.h>
+#endif
+
+using namespace std;
+
+using ::boost::uint32_t;
+using ::boost::uint64_t;
+
+namespace CouchDB
+{
+
+// The input is processed in blocks of 64 bytes. Each kernel classifies a
+// block into four bitmasks (one bit per byte) and hands them to
+// processBlock(), which is shared by all kernels and does the string and
+// escape tracking with plain integer arithmetic.
+
+struct BlockMasks
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t space;
+};
+
+struct IndexerState
+{
+    IndexerState() : prevEscaped(0), prevInString(0), prevScalar(0) {}
+
+    uint64_t prevEscaped;
+    uint64_t prevInString;
+    uint64_t prevScalar;
+};
+
+static inline uint64_t prefixXor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+static inline unsigned countBits(uint64_t bits)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll(bits);
+#else
+    unsigned count = 0;
+    for(; bits; bits &= bits - 1)
+        ++count;
+    return count;
+#endif
+}
+
+static inline unsigned trailingZeros(uint64_t bits)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(bits);
+#else
+    unsigned count = 0;
+    for(; !(bits & 1); bits >>= 1)
+        ++count;
+    return count;
+#endif
+}
+
+// Returns the characters escaped by a backslash; odd-length backslash runs
+// escape the following character, even-length runs escape nothing.
+static inline uint64_t findEscaped(IndexerState &state, uint64_t backslash)
+{
+    const uint64_t evenBits = 0x5555555555555555ULL;
+
+    backslash &= ~state.prevEscaped;
+    uint64_t followsEscape = (backslash << 1) | state.prevEscaped;
+
+    uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    uint64_t evenStartSequences = oddStarts + backslash;
+    state.prevEscaped = evenStartSequences < oddStarts ? 1 : 0;
+
+    return (evenBits ^ (evenStartSequences << 1)) & followsEscape;
+}
+
+static inline void processBlock(IndexerState &state, const BlockMasks &masks,
+        uint32_t base, vector<uint32_t> &index)
+{
+    uint64_t quote = masks.quote & ~findEscaped(state, masks.backslash);
+
+    // every bit from an opening quote up to (not including) its closing quote
+    uint64_t inString = prefixXor(quote) ^ state.prevInString;
+    state.prevInString = (uint64_t)((::boost::int64_t)inString >> 63);
+    uint64_t stringTail = inString ^ quote;
+
+    // literals and numbers are indexed by their first character only
+    uint64_t scalar = ~(masks.op | masks.space);
+    uint64_t nonQuoteScalar = scalar & ~quote;
+    uint64_t followsScalar = (nonQuoteScalar << 1) | state.prevScalar;
+    state.prevScalar = nonQuoteScalar >> 63;
+
+    uint64_t structurals = (masks.op | (scalar & ~followsScalar)) & ~stringTail;
+    if(!structurals)
+        return;
+
+    size_t offset = index.size();
+    index.resize(offset + countBits(structurals));
+
+    uint32_t *out = &index[offset];
+    for(; structurals; structurals &= structurals - 1)
+        *out++ = base + trailingZeros(structurals);
+}
+
+// ---[ SCALAR KERNEL ]----------------------------------------------------------
+
+enum CharClass
+{
+    CLASS_QUOTE     = 1,
+    CLASS_BACKSLASH = 2,
+    CLASS_OP        = 4,
+    CLASS_SPACE     = 8
+};
+
+class CharClassTable
+{
+public:
+    CharClassTable()
+    {
+        memset(table, 0, sizeof(table));
+        table[(unsigned char)'"' ] = CLASS_QUOTE;
+        table[(unsigned char)'\\'] = CLASS_BACKSLASH;
+        table[(unsigned char)'{' ] = CLASS_OP;
+        table[(unsigned char)'}' ] = CLASS_OP;
+        table[(unsigned char)'[' ] = CLASS_OP;
+        table[(unsigned char)']' ] = CLASS_OP;
+        table[(unsigned char)':' ] = CLASS_OP;
+        table[(unsigned char)',' ] = CLASS_OP;
+        table[(unsigned char)' ' ] = CLASS_SPACE;
+        table[(unsigned char)'\t'] = CLASS_SPACE;
+        table[(unsigned char)'\n'] = CLASS_SPACE;
+        table[(unsigned char)'\r'] = CLASS_SPACE;
+    }
+
+    unsigned char table[256];
+};
+
+static const CharClassTable charClasses;
+
+static inline void classifyScalar(const char *block, BlockMasks &masks)
+{
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for(unsigned i = 0; i < 64; ++i)
+    {
+        unsigned char cls = charClasses.table[(unsigned char)block[i]];
+        if(!cls)
+            continue;
+
+        uint64_t bit = (uint64_t)1 << i;
+        if(cls & CLASS_QUOTE)     masks.quote     |= bit;
+        if(cls & CLASS_BACKSLASH) masks.backslash |= bit;
+        if(cls & CLASS_OP)        masks.op        |= bit;
+        if(cls & CLASS_SPACE)     masks.space     |= bit;
+    }
+}
+
+static bool indexScalar(const char *data, size_t size, vector<uint32_t> &index)
+{
+    IndexerState state;
+    BlockMasks   masks;
+    char         tail[64];
+
+    size_t pos = 0;
+    for(; pos + 64 <= size; pos += 64)
+    {
+        classifyScalar(data + pos, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    if(pos < size)
+    {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, data + pos, size - pos);
+        classifyScalar(tail, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    return state.prevInString == 0;
+}
+
+#ifdef COUCH_DB_X86_KERNELS
+
+// ---[ SSE2 KERNEL ]------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static inline void classifySSE2(const char *block, BlockMasks &masks)
+{
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i colon     = _mm_set1_epi8(':');
+    const __m128i comma     = _mm_set1_epi8(',');
+    const __m128i lower     = _mm_set1_epi8(0x20);
+    const __m128i brace     = _mm_set1_epi8('{');  // '[' | 0x20
+    const __m128i close     = _mm_set1_epi8('}');  // ']' | 0x20
+    const __m128i blank     = _mm_set1_epi8(' ');
+    const __m128i tab       = _mm_set1_epi8('\t');
+    const __m128i newline   = _mm_set1_epi8('\n');
+    const __m128i cr        = _mm_set1_epi8('\r');
+
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for(unsigned i = 0; i < 4; ++i)
+    {
+        __m128i chars  = _mm_loadu_si128((const __m128i*)(block + i * 16));
+        __m128i folded = _mm_or_si128(chars, lower);
+
+        __m128i op = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(folded, brace), _mm_cmpeq_epi8(folded, close)),
+                _mm_or_si128(_mm_cmpeq_epi8(chars, colon), _mm_cmpeq_epi8(chars, comma)));
+        __m128i space = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chars, blank), _mm_cmpeq_epi8(chars, tab)),
+                _mm_or_si128(_mm_cmpeq_epi8(chars, newline), _mm_cmpeq_epi8(chars, cr)));
+
+        unsigned shift = i * 16;
+        masks.quote     |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, quote)) << shift;
+        masks.backslash |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, backslash)) << shift;
+        masks.op        |= (uint64_t)(unsigned)_mm_movemask_epi8(op) << shift;
+        masks.space     |= (uint64_t)(unsigned)_mm_movemask_epi8(space) << shift;
+    }
+}
+
+__attribute__((target("sse2")))
+static bool indexSSE2(const char *data, size_t size, vector<uint32_t> &index)
+{
+    IndexerState state;
+    BlockMasks   masks;
+    char         tail[64];
+
+    size_t pos = 0;
+    for(; pos + 64 <= size; pos += 64)
+    {
+        classifySSE2(data + pos, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    if(pos < size)
+    {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, data + pos, size - pos);
+        classifySSE2(tail, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    return state.prevInString == 0;
+}
+
+// ---[ AVX2 KERNEL ]------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static inline void classifyAVX2(const char *block, BlockMasks &masks)
+{
+    const __m256i quote     = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i colon     = _mm256_set1_epi8(':');
+    const __m256i comma     = _mm256_set1_epi8(',');
+    const __m256i lower     = _mm256_set1_epi8(0x20);
+    const __m256i brace     = _mm256_set1_epi8('{');
+    const __m256i close     = _mm256_set1_epi8('}');
+    const __m256i blank     = _mm256_set1_epi8(' ');
+    const __m256i tab       = _mm256_set1_epi8('\t');
+    const __m256i newline   = _mm256_set1_epi8('\n');
+    const __m256i cr        = _mm256_set1_epi8('\r');
+
+    masks.quote = masks.backslash = masks.op = masks.space = 0;
+    for(unsigned i = 0; i < 2; ++i)
+    {
+        __m256i chars  = _mm256_loadu_si256((const __m256i*)(block + i * 32));
+        __m256i folded = _mm256_or_si256(chars, lower);
+
+        __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, brace), _mm256_cmpeq_epi8(folded, close)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chars, colon), _mm256_cmpeq_epi8(chars, comma)));
+        __m256i space = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chars, blank), _mm256_cmpeq_epi8(chars, tab)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chars, newline), _mm256_cmpeq_epi8(chars, cr)));
+
+        unsigned shift = i * 32;
+        masks.quote     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, quote)) << shift;
+        masks.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, backslash)) << shift;
+        masks.op        |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+        masks.space     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << shift;
+    }
+}
+
+__attribute__((target("avx2")))
+static bool indexAVX2(const char *data, size_t size, vector<uint32_t> &index)
+{
+    IndexerState state;
+    BlockMasks   masks;
+    char         tail[64];
+
+    size_t pos = 0;
+    for(; pos + 64 <= size; pos += 64)
+    {
+        classifyAVX2(data + pos, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    if(pos < size)
+    {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, data + pos, size - pos);
+        classifyAVX2(tail, masks);
+        processBlock(state, masks, (uint32_t)pos, index);
+    }
+
+    return state.prevInString == 0;
+}
+
+#endif //COUCH_DB_X86_KERNELS
+
+// ---[ RUNTIME DISPATCH ]-------------------------------------------------------
+
+struct KernelEntry
+{
+    KernelLevel      level;
+    StructuralKernel kernel;
+};
+
+static KernelEntry findKernel(KernelLevel level)
+{
+    KernelEntry entry = { KERNEL_SCALAR, indexScalar };
+#ifdef COUCH_DB_X86_KERNELS
+    if(level == KERNEL_SSE2)
+    {
+        entry.level  = KERNEL_SSE2;
+        entry.kernel = indexSSE2;
+    }
+    else if(level == KERNEL_AVX2)
+    {
+        entry.level  = KERNEL_AVX2;
+        entry.kernel = indexAVX2;
+    }
+#endif
+    return entry;
+}
+
+static KernelEntry& activeKernel()
+{
+    static KernelEntry kernel = findKernel(detectKernelLevel());
+    return kernel;
+}
+
+bool buildStructuralIndex(const char *data, size_t size, vector<uint32_t> &index)
+{
+    // the offsets are 32 bits wide
+    index.clear();
+    if(size > 0xffffffffUL)
+        throw Exception("JSON text too large to index: over 4 GB");
+    return activeKernel().kernel(data, size, index);
+}
+
+KernelLevel getStructuralKernel()
+{
+    return activeKernel().level;
+}
+
+void setStructuralKernel(KernelLevel level)
+{
+    activeKernel() = findKernel(level);
+}
+
+} //namespace CouchDB
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_STRUCTURAL_INDEX_HPP__
+#define __COUCH_DB_STRUCTURAL_INDEX_HPP__
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+#include <vector>
+
+#include "KernelSelection.hpp"
+
+namespace CouchDB
+{
+
+// Stage one of the JSON parser: records the offset of every structural
+// character ({ } [ ] : ,), every opening quote and the first character of
+// every literal or number that lies outside of a string. Returns false if
+// the input ends inside a string; throws Exception if it is 4 GB or more,
+// past what the 32-bit offsets reach.
+typedef bool (*StructuralKernel)(const char*, size_t,
+        std::vector< ::boost::uint32_t >&);
+
+bool buildStructuralIndex(const char*, size_t,
+        std::vector< ::boost::uint32_t >&);
+
+// The kernel in use; the level must have passed findKernelLevel().
+KernelLevel getStructuralKernel();
+void setStructuralKernel(KernelLevel);
+
+} //namespace CouchDB
+
+#endif
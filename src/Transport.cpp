@@ -0,0 +1,49 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include "couchdb/Transport.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+Transport::Request::Request(const string &_url, const string &_method,
+        const HeaderMap &_headers, BodySource *_body, const string &_unixSocket,
+        bool _acceptEncoded)
+    : url(_url)
+    , method(_method)
+    , headers(_headers)
+    , body(_body)
+    , unixSocket(_unixSocket)
+    , acceptEncoded(_acceptEncoded)
+{
+}
+
+Transport::Response::Response(Writer _write, void *_target)
+    : write(_write)
+    , target(_target)
+    , header(NULL)
+    , headerTarget(NULL)
+    , status(0)
+    , length(0)
+{
+}
+
+Transport::~Transport()
+{
+}
+
+} //namespace CouchDB
@@ -0,0 +1,633 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/static_assert.hpp>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "couchdb/Value.hpp"
+#include "couchdb/Arena.hpp"
+#include "couchdb/Exception.hpp"
+
+#include "ObjectMembers.hpp"
+
+using namespace std;
+
+using ::boost::int64_t;
+using ::boost::uint32_t;
+
+namespace CouchDB
+{
+
+BOOST_STATIC_ASSERT(sizeof(Value) == 16);
+BOOST_STATIC_ASSERT(sizeof(Value::Member) == 2 * sizeof(Value));
+
+// Header of the heap block behind an array or object. It is followed by
+// `capacity` Values for arrays and `capacity` Members for objects.
+struct Value::Container
+{
+    uint32_t size;
+    uint32_t capacity;
+};
+
+static const char *typeNames[] = {
+    "null", "boolean", "integer", "real", "string", "array", "object"
+};
+
+static size_t itemsPerSlot(unsigned type)
+{
+    return type == Value::TYPE_OBJECT ? 2 : 1;
+}
+
+Value::Value()
+{
+    setTag(TYPE_NULL);
+}
+
+Value::Value(bool value)
+{
+    setTag(TYPE_BOOLEAN);
+    data.large.boolean = value;
+}
+
+Value::Value(int value)
+{
+    setTag(TYPE_INTEGER);
+    data.large.integer = value;
+}
+
+Value::Value(int64_t value)
+{
+    setTag(TYPE_INTEGER);
+    data.large.integer = value;
+}
+
+Value::Value(double value)
+{
+    setTag(TYPE_REAL);
+    data.large.real = value;
+}
+
+Value::Value(const char *value)
+{
+    setString(value, strlen(value));
+}
+
+Value::Value(const char *value, size_t length)
+{
+    setString(value, length);
+}
+
+Value::Value(const string &value)
+{
+    setString(value.data(), value.size());
+}
+
+Value::Value(const Value &value)
+{
+    data = value.data;
+    setTag(tag() & ~FLAG_EXTERNAL);
+
+    unsigned type = value.getType();
+    if(type == TYPE_STRING && !(tag() & FLAG_SMALL))
+    {
+        setString(value.data.large.string, value.data.large.length);
+    }
+    else if(type == TYPE_ARRAY || type == TYPE_OBJECT)
+    {
+        data.large.container = NULL;
+        if(value.empty())
+            return;
+
+        reserve(value.size());
+
+        size_t count = value.size() * itemsPerSlot(type);
+        Value *target = items();
+        const Value *source = value.items();
+        for(size_t i = 0; i < count; ++i)
+        {
+            new(target + i) Value(source[i]);
+            data.large.container->size = (uint32_t)((i + 1) / itemsPerSlot(type));
+        }
+    }
+}
+
+#ifndef BOOST_NO_CXX11_RVALUE_REFERENCES
+Value::Value(Value &&value) BOOST_NOEXCEPT
+{
+    data = value.data;
+    value.setTag(TYPE_NULL);
+}
+
+Value& Value::operator=(Value &&value) BOOST_NOEXCEPT
+{
+    swap(value);
+    return *this;
+}
+#endif
+
+Value::~Value()
+{
+    release();
+}
+
+Value& Value::operator=(const Value &value)
+{
+    Value copy(value);
+    swap(copy);
+    return *this;
+}
+
+void Value::swap(Value &value)
+{
+    // values own no self-references, so they can be exchanged bytewise
+    std::swap(data, value.data);
+}
+
+Value Value::createArray(size_t capacity)
+{
+    Value value;
+    value.setTag(TYPE_ARRAY);
+    value.data.large.container = NULL;
+    value.reserve(capacity);
+    return value;
+}
+
+Value Value::createObject(size_t capacity)
+{
+    Value value;
+    value.setTag(TYPE_OBJECT);
+    value.data.large.container = NULL;
+    value.reserve(capacity);
+    return value;
+}
+
+Value Value::adopt(Type type, Value *values, size_t count, Arena *arena)
+{
+    Value container;
+    container.setTag(type);
+    container.data.large.container = NULL;
+    if(count == 0)
+        return container;
+
+    size_t slots = count * itemsPerSlot(type);
+    if(arena)
+    {
+        container.data.large.container =
+            (Container*)arena->allocate(sizeof(Container) + slots * sizeof(Value));
+        container.data.large.container->capacity = (uint32_t)count;
+        container.setTag(type | FLAG_EXTERNAL);
+    }
+    else
+    {
+        container.reserve(count);
+    }
+
+    memcpy((void*)container.items(), (const void*)values, slots * sizeof(Value));
+    container.data.large.container->size = (uint32_t)count;
+
+    // the container owns the elements now
+    for(size_t i = 0; i < slots; ++i)
+        values[i].setTag(TYPE_NULL);
+
+    return container;
+}
+
+Value Value::createString(const char *str, size_t length, Arena *arena)
+{
+    if(!arena || length <= SMALL_CAPACITY)
+        return Value(str, length);
+
+    if(length > UINT_MAX)
+        throw Exception("String too large");
+
+    Value value;
+    value.data.large.string = (char*)arena->allocate(length);
+    value.data.large.length = (uint32_t)length;
+    memcpy(value.data.large.string, str, length);
+    value.setTag(TYPE_STRING | FLAG_EXTERNAL);
+    return value;
+}
+
+Value Value::borrowString(const char *str, size_t length)
+{
+    if(length <= SMALL_CAPACITY)
+        return Value(str, length);
+
+    if(length > UINT_MAX)
+        throw Exception("String too large");
+
+    Value value;
+    value.data.large.string = const_cast<char*>(str);
+    value.data.large.length = (uint32_t)length;
+    value.setTag(TYPE_STRING | FLAG_EXTERNAL);
+    return value;
+}
+
+Value::Type Value::getType() const
+{
+    return (Type)(tag() & TYPE_MASK);
+}
+
+bool Value::isNull() const
+{
+    return getType() == TYPE_NULL;
+}
+
+bool Value::isBoolean() const
+{
+    return getType() == TYPE_BOOLEAN;
+}
+
+bool Value::isNumber() const
+{
+    return getType() == TYPE_INTEGER || getType() == TYPE_REAL;
+}
+
+bool Value::isString() const
+{
+    return getType() == TYPE_STRING;
+}
+
+bool Value::isArray() const
+{
+    return getType() == TYPE_ARRAY;
+}
+
+bool Value::isObject() const
+{
+    return getType() == TYPE_OBJECT;
+}
+
+bool Value::getBoolean() const
+{
+    expect(TYPE_BOOLEAN, "getBoolean");
+    return data.large.boolean;
+}
+
+int64_t Value::getInteger() const
+{
+    expect(TYPE_INTEGER, "getInteger");
+    return data.large.integer;
+}
+
+double Value::getReal() const
+{
+    if(getType() == TYPE_INTEGER)
+        return (double)data.large.integer;
+
+    expect(TYPE_REAL, "getReal");
+    return data.large.real;
+}
+
+boost::string_view Value::getString() const
+{
+    expect(TYPE_STRING, "getString");
+    if(tag() & FLAG_SMALL)
+        return boost::string_view(data.small.chars, data.small.length);
+    return boost::string_view(data.large.string, data.large.length);
+}
+
+string Value::asString() const
+{
+    boost::string_view str = getString();
+    return string(str.data(), str.size());
+}
+
+size_t Value::size() const
+{
+    unsigned type = getType();
+    if(type != TYPE_ARRAY && type != TYPE_OBJECT)
+        return 0;
+    return data.large.container ? data.large.container->size : 0;
+}
+
+bool Value::empty() const
+{
+    return size() == 0;
+}
+
+const Value& Value::operator[](size_t index) const
+{
+    expect(TYPE_ARRAY, "operator[]");
+    if(index >= size())
+        throw Exception("Array index out of range");
+    return items()[index];
+}
+
+Value& Value::operator[](size_t index)
+{
+    expect(TYPE_ARRAY, "operator[]");
+    if(index >= size())
+        throw Exception("Array index out of range");
+    return items()[index];
+}
+
+void Value::push_back(const Value &value)
+{
+    expect(TYPE_ARRAY, "push_back");
+
+    Value copy(value);
+    size_t count = size();
+    reserve(count + 1);
+
+    // take over the copy's storage without running its destructor
+    memcpy((void*)(items() + count), (const void*)&copy, sizeof(Value));
+    copy.setTag(TYPE_NULL);
+    data.large.container->size = (uint32_t)(count + 1);
+}
+
+const Value::Member& Value::getMember(size_t index) const
+{
+    expect(TYPE_OBJECT, "getMember");
+    if(index >= size())
+        throw Exception("Member index out of range");
+    return reinterpret_cast<const Member*>(items())[index];
+}
+
+Value::Member& Value::getMember(size_t index)
+{
+    expect(TYPE_OBJECT, "getMember");
+    if(index >= size())
+        throw Exception("Member index out of range");
+    return reinterpret_cast<Member*>(items())[index];
+}
+
+const Value* Value::find(const boost::string_view &key) const
+{
+    if(getType() != TYPE_OBJECT)
+        return NULL;
+
+    // later duplicates win, as they do when parsing into an Object
+    const Member *members = reinterpret_cast<const Member*>(items());
+    for(size_t i = size(); i > 0; --i)
+    {
+        if(members[i - 1].key.getString() == key)
+            return &members[i - 1].value;
+    }
+    return NULL;
+}
+
+Value* Value::find(const boost::string_view &key)
+{
+    return const_cast<Value*>(static_cast<const Value*>(this)->find(key));
+}
+
+const Value& Value::get(const boost::string_view &key) const
+{
+    expect(TYPE_OBJECT, "get");
+
+    const Value *value = find(key);
+    if(!value)
+        throw Exception("No member named '" + string(key.data(), key.size()) + "'");
+    return *value;
+}
+
+Value& Value::operator[](const boost::string_view &key)
+{
+    expect(TYPE_OBJECT, "operator[]");
+
+    Value *value = find(key);
+    if(value)
+        return *value;
+
+    return addMember(key);
+}
+
+Value& Value::addMember(const boost::string_view &key)
+{
+    expect(TYPE_OBJECT, "addMember");
+
+    size_t count = size();
+    reserve(count + 1);
+
+    Member *member = reinterpret_cast<Member*>(items()) + count;
+    new(&member->key) Value(key.data(), key.size());
+    new(&member->value) Value();
+    data.large.container->size = (uint32_t)(count + 1);
+
+    return member->value;
+}
+
+unsigned char Value::tag() const
+{
+    return data.small.tag;
+}
+
+void Value::setTag(unsigned char tag)
+{
+    data.small.tag = tag;
+}
+
+void Value::setString(const char *value, size_t length)
+{
+    if(length <= SMALL_CAPACITY)
+    {
+        memcpy(data.small.chars, value, length);
+        data.small.length = (unsigned char)length;
+        setTag(TYPE_STRING | FLAG_SMALL);
+        return;
+    }
+
+    if(length > UINT_MAX)
+        throw Exception("String too large");
+
+    char *string = (char*)malloc(length);
+    if(!string)
+        throw std::bad_alloc();
+
+    memcpy(string, value, length);
+    data.large.string = string;
+    data.large.length = (uint32_t)length;
+    setTag(TYPE_STRING);
+}
+
+void Value::reserve(size_t capacity)
+{
+    Container *container = data.large.container;
+    if(capacity == 0 || (container && container->capacity >= capacity))
+        return;
+
+    if(tag() & FLAG_EXTERNAL)
+    {
+        // move out of the arena before growing; the elements stay where they are
+        size_t used = sizeof(Container) + container->size * itemsPerSlot(getType()) * sizeof(Value);
+        Container *owned = (Container*)malloc(used);
+        if(!owned)
+            throw std::bad_alloc();
+
+        memcpy(owned, container, used);
+        owned->capacity = container->size;
+        data.large.container = container = owned;
+        setTag(tag() & ~FLAG_EXTERNAL);
+    }
+
+    size_t newCapacity = container ? container->capacity * 2 : 4;
+    if(newCapacity < capacity)
+        newCapacity = capacity;
+
+    // Values hold no pointers to themselves, so the block can be moved by realloc
+    size_t bytes = sizeof(Container) + newCapacity * itemsPerSlot(getType()) * sizeof(Value);
+    Container *grown = (Container*)realloc(container, bytes);
+    if(!grown)
+        throw std::bad_alloc();
+
+    if(!container)
+        grown->size = 0;
+    grown->capacity = (uint32_t)newCapacity;
+    data.large.container = grown;
+}
+
+Value* Value::items() const
+{
+    return reinterpret_cast<Value*>(data.large.container + 1);
+}
+
+void Value::expect(Type type, const char *operation) const
+{
+    if(getType() != type)
+        throw Exception(string("Value::") + operation + " called on " +
+                typeNames[getType()] + ", expected " + typeNames[type]);
+}
+
+void Value::release()
+{
+    if(tag() & FLAG_EXTERNAL)
+    {
+        // the arena frees everything at once
+        setTag(TYPE_NULL);
+        return;
+    }
+
+    unsigned type = getType();
+    if(type == TYPE_STRING && !(tag() & FLAG_SMALL))
+    {
+        free(data.large.string);
+    }
+    else if((type == TYPE_ARRAY || type == TYPE_OBJECT) && data.large.container)
+    {
+        size_t count = size() * itemsPerSlot(type);
+        Value *values = items();
+        for(size_t i = 0; i < count; ++i)
+            values[i].~Value();
+        free(data.large.container);
+    }
+    setTag(TYPE_NULL);
+}
+
+// ---[ ADAPTERS ]---------------------------------------------------------------
+
+Value toValue(const Variant &var)
+{
+    if(!var || var->empty())
+        return Value();
+
+    const boost::any &value = *var;
+    const type_info &type = value.type();
+
+    if(type == typeid(string))
+        return Value(*boost::any_cast<string>(&value));
+    if(type == typeid(bool))
+        return Value(*boost::any_cast<bool>(&value));
+    if(type == typeid(int))
+        return Value(*boost::any_cast<int>(&value));
+    if(type == typeid(int64_t))
+        return Value(*boost::any_cast<int64_t>(&value));
+    if(type == typeid(double))
+        return Value(*boost::any_cast<double>(&value));
+
+    if(const Object *obj = boost::any_cast<Object>(&value))
+    {
+        Value result = Value::createObject(obj->size());
+        Object::const_iterator member = obj->begin();
+        const Object::const_iterator &memberEnd = obj->end();
+        for(; member != memberEnd; ++member)
+            result.addMember(member->first) = toValue(member->second);
+        return result;
+    }
+
+    if(const Array *arr = boost::any_cast<Array>(&value))
+    {
+        Value result = Value::createArray(arr->size());
+        Array::const_iterator item = arr->begin();
+        const Array::const_iterator &itemEnd = arr->end();
+        for(; item != itemEnd; ++item)
+            result.push_back(toValue(*item));
+        return result;
+    }
+
+    throw Exception(string("Unrecognized type: ") + type.name());
+}
+
+Variant toVariant(const Value &value)
+{
+    switch(value.getType())
+    {
+    case Value::TYPE_BOOLEAN:
+        return createVariant(value.getBoolean());
+
+    case Value::TYPE_INTEGER:
+    {
+        int64_t integer = value.getInteger();
+        if(integer >= INT_MIN && integer <= INT_MAX)
+            return createVariant((int)integer);
+        return createVariant(integer);
+    }
+
+    case Value::TYPE_REAL:
+        return createVariant(value.getReal());
+
+    case Value::TYPE_STRING:
+        return createVariant(value.asString());
+
+    case Value::TYPE_ARRAY:
+    {
+        Variant var = createVariant(Array());
+        Array &arr = *boost::any_cast<Array>(var.get());
+        arr.reserve(value.size());
+        for(size_t i = 0; i < value.size(); ++i)
+            arr.push_back(toVariant(value[i]));
+        return var;
+    }
+
+    case Value::TYPE_OBJECT:
+    {
+        Variant var = createVariant(Object());
+        if(value.empty())
+            return var;
+
+        vector<Object::value_type> members(value.size());
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+            const Value::Member &member = value.getMember(i);
+            boost::string_view key = member.key.getString();
+            members[i].first.assign(key.data(), key.size());
+            members[i].second = toVariant(member.value);
+        }
+        assignMembers(*boost::any_cast<Object>(var.get()), &members[0],
+                &members[0] + members.size());
+        return var;
+    }
+
+    default:
+        return Variant(new boost::any());
+    }
+}
+
+} //namespace CouchDB
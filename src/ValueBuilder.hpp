@@ -0,0 +1,158 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#ifndef __COUCH_DB_VALUE_BUILDER_HPP__
+#define __COUCH_DB_VALUE_BUILDER_HPP__
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <vector>
+
+#include "couchdb/Value.hpp"
+
+namespace CouchDB
+{
+
+// Builds a Value tree from parser events. Keeps the values of all open
+// containers on one stack; a finished array or object takes its elements
+// over in a single copy.
+//
+// With an arena, long object keys are interned so every occurrence shares
+// one copy. With a borrowed range as well, strings lying inside it (those
+// without escapes) point into it instead of being copied; the range must
+// outlive the tree.
+class ValueBuilder
+{
+public:
+    ValueBuilder(Arena *_arena = NULL)
+        : arena(_arena)
+        , borrowBegin(NULL)
+        , borrowEnd(NULL)
+    {
+        values.reserve(64);
+    }
+
+    void borrowFrom(const char *begin, const char *end)
+    {
+        borrowBegin = begin;
+        borrowEnd   = end;
+    }
+
+    Value& getRoot()
+    {
+        return values.front();
+    }
+
+    void null()
+    {
+        values.push_back(Value());
+    }
+
+    void boolean(bool value)
+    {
+        values.push_back(Value(value));
+    }
+
+    void integer(::boost::int64_t value)
+    {
+        values.push_back(Value(value));
+    }
+
+    void real(double value)
+    {
+        values.push_back(Value(value));
+    }
+
+    void string(const char *str, size_t length)
+    {
+        if(str >= borrowBegin && str < borrowEnd)
+            values.push_back(Value::borrowString(str, length));
+        else
+            values.push_back(Value::createString(str, length, arena));
+    }
+
+    void key(const char *str, size_t length)
+    {
+        if(!arena || length <= Value::SMALL_CAPACITY)
+        {
+            values.push_back(Value(str, length));
+            return;
+        }
+
+        boost::string_view name(str, length);
+        Keys::const_iterator known = keys.find(name);
+        if(known != keys.end())
+        {
+            values.push_back(Value::borrowString(known->data(), length));
+            return;
+        }
+
+        if(str >= borrowBegin && str < borrowEnd)
+            values.push_back(Value::borrowString(str, length));
+        else
+            values.push_back(Value::createString(str, length, arena));
+
+        keys.insert(values.back().getString());
+    }
+
+    void startObject()
+    {
+        starts.push_back(values.size());
+    }
+
+    void endObject()
+    {
+        finish(Value::TYPE_OBJECT, 2);
+    }
+
+    void startArray()
+    {
+        starts.push_back(values.size());
+    }
+
+    void endArray()
+    {
+        finish(Value::TYPE_ARRAY, 1);
+    }
+
+private:
+    void finish(Value::Type type, size_t itemsPerSlot)
+    {
+        size_t start = starts.back();
+        size_t count = values.size() - start;
+        starts.pop_back();
+
+        Value container = Value::adopt(type, count ? &values[start] : NULL,
+                count / itemsPerSlot, arena);
+        values.resize(start);
+        values.push_back(Value());
+        values.back().swap(container);
+    }
+
+    typedef boost::unordered_set<boost::string_view> Keys;
+
+    Arena               *arena;
+    const char          *borrowBegin;
+    const char          *borrowEnd;
+    std::vector<Value>  values;
+    std::vector<size_t> starts;
+    Keys                keys;
+};
+
+} //namespace CouchDB
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/cstdint.hpp>
+
+#include "couchdb/Variant.hpp"
+#include "couchdb/Exception.hpp"
+
+using namespace std;
+
+namespace CouchDB
+{
+
+static string getTypeName(const type_info &type)
+{
+    if(type == typeid(void))
+        return "null";
+    if(type == typeid(string))
+        return "string";
+    if(type == typeid(bool))
+        return "bool";
+    if(type == typeid(int))
+        return "int";
+    if(type == typeid(::boost::int64_t))
+        return "int64";
+    if(type == typeid(double))
+        return "double";
+    if(type == typeid(Object))
+        return "Object";
+    if(type == typeid(Array))
+        return "Array";
+    return type.name();
+}
+
+void throwUnexpectedType(const Variant &var, const type_info &expected)
+{
+    const type_info &held = var ? var->type() : typeid(void);
+    throw Exception("Variant holds " + getTypeName(held) + ", expected " +
+            getTypeName(expected));
+}
+
+const Variant* find(const Object &obj, const string &key)
+{
+    Object::const_iterator member = obj.find(key);
+    if(member == obj.end())
+        return NULL;
+    return &member->second;
+}
+
+const Variant* find(const Variant &var, const string &key)
+{
+    return find(as<Object>(var), key);
+}
+
+const Variant& get(const Object &obj, const string &key)
+{
+    const Variant *value = find(obj, key);
+    if(!value)
+        throw Exception("No member named '" + key + "'");
+    return *value;
+}
+
+const Variant& get(const Variant &var, const string &key)
+{
+    return get(as<Object>(var), key);
+}
+
+} //namespace CouchDB
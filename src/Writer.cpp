@@ -0,0 +1,306 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <boost/cstdint.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#include "couchdb/Writer.hpp"
+#include "couchdb/Exception.hpp"
+
+#include "StringKernels.hpp"
+
+using namespace std;
+
+using ::boost::int32_t;
+using ::boost::int64_t;
+using ::boost::uint64_t;
+
+namespace CouchDB
+{
+
+// ---[ SCALARS ]----------------------------------------------------------------
+
+// 0: copied as is, 1: escaped as \u00XX, otherwise the character to put
+// after the backslash
+static const char escapes[256] =
+{
+    1,   1,   1,   1,   1,   1,   1,   1,  'b', 't', 'n',  1,  'f', 'r',  1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    0,   0,  '"',  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, '\\',  0,   0,   0
+};
+
+void writeJSONString(const char *str, size_t length, string &out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    const char *cur = str;
+    const char *end = str + length;
+
+    out.reserve(out.size() + length + 2);
+    out += '"';
+
+    while(cur < end)
+    {
+        // copy the longest run that needs no escaping in one go
+        const char *run = cur;
+        cur = findEscapable(cur, end);
+        out.append(run, cur - run);
+
+        if(cur == end)
+            break;
+
+        char escape = escapes[(unsigned char)*cur];
+        if(escape == 1)
+        {
+            char unicode[6] = { '\\', 'u', '0', '0',
+                                hex[(unsigned char)*cur >> 4], hex[*cur & 0xf] };
+            out.append(unicode, 6);
+        }
+        else
+        {
+            char pair[2] = { '\\', escape };
+            out.append(pair, 2);
+        }
+        ++cur;
+    }
+
+    out += '"';
+}
+
+void writeJSONString(const string &str, string &out)
+{
+    writeJSONString(str.data(), str.size(), out);
+}
+
+// the decimal digits of the value, two at a time
+static void writeDigits(uint64_t rest, string &out)
+{
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    char digits[20];
+    char *pos = digits + sizeof(digits);
+
+    while(rest >= 100)
+    {
+        unsigned pair = (unsigned)(rest % 100) * 2;
+        rest /= 100;
+        *--pos = pairs[pair + 1];
+        *--pos = pairs[pair];
+    }
+    if(rest >= 10)
+    {
+        *--pos = pairs[rest * 2 + 1];
+        *--pos = pairs[rest * 2];
+    }
+    else
+    {
+        *--pos = (char)('0' + rest);
+    }
+
+    out.append(pos, digits + sizeof(digits) - pos);
+}
+
+void writeJSONNumber(int64_t value, string &out)
+{
+    if(value < 0)
+    {
+        out += '-';
+        writeDigits(0 - (uint64_t)value, out);
+    }
+    else
+        writeDigits((uint64_t)value, out);
+}
+
+void writeJSONNumber(uint64_t value, string &out)
+{
+    writeDigits(value, out);
+}
+
+void writeJSONNumber(double value, string &out)
+{
+    if(!(value == value) || value - value != 0)
+    {
+        out.append("null", 4);
+        return;
+    }
+
+    char   text[32];
+    size_t length;
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    length = to_chars(text, text + sizeof(text), value).ptr - text;
+#else
+    // the fewest of 15, 16 and 17 significant digits that read back the same
+    length = snprintf(text, sizeof(text), "%.15g", value);
+    if(strtod(text, NULL) != value)
+        length = snprintf(text, sizeof(text), "%.16g", value);
+    if(strtod(text, NULL) != value)
+        length = snprintf(text, sizeof(text), "%.17g", value);
+#endif
+
+    out.append(text, length);
+
+    // keep it a real for readers that tell integers apart
+    if(!memchr(text, '.', length) && !memchr(text, 'e', length))
+        out.append(".0", 2);
+}
+
+// ---[ TREES ]------------------------------------------------------------------
+
+static void writeVariant(const boost::any &value, string &out)
+{
+    if(value.empty())
+    {
+        out.append("null", 4);
+        return;
+    }
+
+    if(const Object *obj = boost::any_cast<Object>(&value))
+    {
+        out += '{';
+        Object::const_iterator member = obj->begin();
+        const Object::const_iterator &memberEnd = obj->end();
+        for(; member != memberEnd; ++member)
+        {
+            if(member != obj->begin())
+                out += ',';
+            writeJSONString(member->first, out);
+            out += ':';
+            writeVariant(*member->second, out);
+        }
+        out += '}';
+    }
+    else if(const Array *arr = boost::any_cast<Array>(&value))
+    {
+        out += '[';
+        Array::const_iterator item = arr->begin();
+        const Array::const_iterator &itemEnd = arr->end();
+        for(; item != itemEnd; ++item)
+        {
+            if(item != arr->begin())
+                out += ',';
+            writeVariant(**item, out);
+        }
+        out += ']';
+    }
+    else if(const string *str = boost::any_cast<string>(&value))
+        writeJSONString(*str, out);
+    else if(const bool *boolean = boost::any_cast<bool>(&value))
+        out.append(*boolean ? "true" : "false", *boolean ? 4 : 5);
+    else if(const int32_t *integer = boost::any_cast<int32_t>(&value))
+        writeJSONNumber((int64_t)*integer, out);
+    else if(const int64_t *integer = boost::any_cast<int64_t>(&value))
+        writeJSONNumber(*integer, out);
+    else if(const double *real = boost::any_cast<double>(&value))
+        writeJSONNumber(*real, out);
+    else
+        throw Exception(string("Unrecognized type: ") + value.type().name());
+}
+
+void writeJSON(const Variant &var, string &out)
+{
+    if(!var)
+        out.append("null", 4);
+    else
+        writeVariant(*var, out);
+}
+
+void writeJSON(const Value &value, string &out)
+{
+    switch(value.getType())
+    {
+    case Value::TYPE_NULL:
+        out.append("null", 4);
+        break;
+
+    case Value::TYPE_BOOLEAN:
+        out.append(value.getBoolean() ? "true" : "false", value.getBoolean() ? 4 : 5);
+        break;
+
+    case Value::TYPE_INTEGER:
+        writeJSONNumber(value.getInteger(), out);
+        break;
+
+    case Value::TYPE_REAL:
+        writeJSONNumber(value.getReal(), out);
+        break;
+
+    case Value::TYPE_STRING:
+    {
+        boost::string_view str = value.getString();
+        writeJSONString(str.data(), str.size(), out);
+        break;
+    }
+
+    case Value::TYPE_ARRAY:
+        out += '[';
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+            if(i > 0)
+                out += ',';
+            writeJSON(value[i], out);
+        }
+        out += ']';
+        break;
+
+    case Value::TYPE_OBJECT:
+        out += '{';
+        for(size_t i = 0; i < value.size(); ++i)
+        {
+            const Value::Member &member = value.getMember(i);
+            boost::string_view key = member.key.getString();
+
+            if(i > 0)
+                out += ',';
+            writeJSONString(key.data(), key.size(), out);
+            out += ':';
+            writeJSON(member.value, out);
+        }
+        out += '}';
+        break;
+    }
+}
+
+string toJSON(const Variant &var)
+{
+    string out;
+    writeJSON(var, out);
+    return out;
+}
+
+string toJSON(const Value &value)
+{
+    string out;
+    writeJSON(value, out);
+    return out;
+}
+
+} //namespace CouchDB
@@ -0,0 +1,1252 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <zlib.h>
+
+#include "couchdb/Communication.hpp"
+#include "couchdb/Connection.hpp"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static string gzip(const string &data, int level)
+{
+   z_stream stream;
+   memset(&stream, 0, sizeof(stream));
+   deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+
+   string out(deflateBound(&stream, data.size()), '\0');
+   stream.next_in   = (Bytef*)data.data();
+   stream.avail_in  = data.size();
+   stream.next_out  = (Bytef*)&out[0];
+   stream.avail_out = out.size();
+   deflate(&stream, Z_FINISH);
+   out.resize(stream.total_out);
+   deflateEnd(&stream);
+   return out;
+}
+
+// ---[ LOCAL SERVER ]-----------------------------------------------------------
+
+// Minimal HTTP/1.1 keep-alive server standing in for CouchDB, so the client
+// side can be measured without one. Every request is answered with a fixed
+// JSON reply after `delay` microseconds, which plays the part of the work
+// the server would do.
+class LocalServer
+{
+public:
+   // Listens on loopback TCP, or on the Unix domain socket at
+   // `socketPath` if one is given.
+   explicit LocalServer(int _delay, const string &_socketPath = "")
+      : socketPath(_socketPath)
+      , port(0)
+      , delay(_delay)
+      , linkSpeed(0)
+      , authCost(0)
+      , stallEvery(0)
+      , stallTime(0)
+      , failEvery(0)
+      , dropEvery(0)
+      , chunkSize(0)
+      , trailers(false)
+      , closeEvery(0)
+      , idleClose(0)
+      , stopping(false)
+   {
+      bool listening;
+      if(socketPath.empty())
+      {
+         listenFd = socket(AF_INET, SOCK_STREAM, 0);
+
+         int one = 1;
+         setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+         sockaddr_in addr;
+         memset(&addr, 0, sizeof(addr));
+         addr.sin_family      = AF_INET;
+         addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+         addr.sin_port        = 0;
+
+         socklen_t length = sizeof(addr);
+         listening = bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd, 128) == 0 &&
+                     getsockname(listenFd, (sockaddr*)&addr, &length) == 0;
+         port = ntohs(addr.sin_port);
+      }
+      else
+      {
+         listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+         sockaddr_un addr;
+         memset(&addr, 0, sizeof(addr));
+         addr.sun_family = AF_UNIX;
+         strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+         unlink(socketPath.c_str());
+         listening = bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd, 128) == 0;
+      }
+
+      if(!listening)
+         throw runtime_error("Unable to start the local server");
+
+      acceptor = thread([this]() { acceptLoop(); });
+   }
+
+   ~LocalServer()
+   {
+      stopping = true;
+      shutdown(listenFd, SHUT_RDWR);
+      acceptor.join();
+
+      {
+         lock_guard<mutex> lock(clientsMutex);
+         for(size_t i = 0; i < clientFds.size(); ++i)
+            shutdown(clientFds[i], SHUT_RDWR);
+      }
+      for(size_t i = 0; i < clients.size(); ++i)
+         clients[i].join();
+
+      close(listenFd);
+      if(!socketPath.empty())
+         unlink(socketPath.c_str());
+   }
+
+   string getURL() const
+   {
+      if(!socketPath.empty())
+         return "http://localhost";
+      return "http://127.0.0.1:" + to_string(port);
+   }
+
+   // connections accepted so far
+   size_t getConnections()
+   {
+      lock_guard<mutex> lock(clientsMutex);
+      return clientFds.size();
+   }
+
+   // Answers GET requests other than the welcome one with `body`, gzipped
+   // once up front for clients accepting it, as a compressing proxy with
+   // a cache would, if `compress` is set. To be set before the first
+   // request.
+   void setPayload(const string &body, bool compress = true)
+   {
+      payload = body;
+      if(compress)
+         gzippedPayload = gzip(body, 6);
+   }
+
+   // Holds every exchange for as long as its bytes, both ways, would take
+   // on a link of `bytesPerSecond`, 0 for no limit. To be set before the
+   // first request.
+   void setLinkSpeed(double bytesPerSecond)
+   {
+      linkSpeed = bytesPerSecond;
+   }
+
+   // bytes exchanged so far, headers included
+   size_t getTraffic() const
+   {
+      return traffic;
+   }
+
+   // Requires authentication, checking a password by spinning for
+   // `microseconds` as CouchDB spends on hashing it: once per request for
+   // Basic credentials, once per POST /_session for a cookie, which is
+   // then let through for free. Anything else is refused with 401. To be
+   // set before the first request.
+   void setAuthCost(int microseconds)
+   {
+      authCost = microseconds;
+   }
+
+   // passwords checked so far
+   size_t getPasswordChecks() const
+   {
+      return passwordChecks;
+   }
+
+   // Holds every `every`th request for another `microseconds`, as a node
+   // busy compacting would. To be set before the first request.
+   void setStalls(int every, int microseconds)
+   {
+      stallEvery = every;
+      stallTime  = microseconds;
+   }
+
+   // Answers every `every`th request 503. To be set before the first
+   // request.
+   void setFailures(int every)
+   {
+      failEvery = every;
+   }
+
+   // Closes the connection instead of answering every `every`th request.
+   // To be set before the first request.
+   void setDrops(int every)
+   {
+      dropEvery = every;
+   }
+
+   // From now on refuses every login with 401, and the cookie handed out
+   // so far, as after a password change.
+   void refuseLogins()
+   {
+      loginsRefused = true;
+   }
+
+   // Sends every body chunked, in chunks of at most `size` bytes, followed
+   // by two trailer fields if `withTrailers` is set; 0 sends a
+   // Content-Length instead. To be set before the first request.
+   void setChunked(size_t size, bool withTrailers)
+   {
+      chunkSize = size;
+      trailers  = withTrailers;
+   }
+
+   // Answers every `every`th request on a connection with
+   // "Connection: close" and closes it after the response. To be set before
+   // the first request.
+   void setCloseEvery(int every)
+   {
+      closeEvery = every;
+   }
+
+   // Closes a connection without notice once it has been idle between
+   // requests for `microseconds`, as servers and proxies reaping keep-alive
+   // connections do. To be set before the first request.
+   void setIdleClose(int microseconds)
+   {
+      idleClose = microseconds;
+   }
+
+private:
+   void acceptLoop()
+   {
+      while(!stopping)
+      {
+         int fd = accept(listenFd, NULL, NULL);
+         if(fd < 0)
+            break;
+
+         int one = 1;
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+         lock_guard<mutex> lock(clientsMutex);
+         clientFds.push_back(fd);
+         clients.push_back(thread([this, fd]() { serve(fd); }));
+      }
+   }
+
+   void serve(int fd)
+   {
+      static const string welcome = "{\"couchdb\":\"Welcome\",\"version\":\"3.3.0\"}";
+      static const string written = "{\"ok\":true,\"id\":\"4d3f1f0e6e0c4a5b9d8e7f6a5b4c3d2e\","
+                                    "\"rev\":\"1-967a00dff5e02add41819138abb3284d\"}";
+      string input;
+      char   chunk[16384];
+      int    answered = 0;
+
+      for(;;)
+      {
+         size_t headerEnd;
+         while((headerEnd = input.find("\r\n\r\n")) == string::npos)
+         {
+            pollfd waiting = { fd, POLLIN, 0 };
+            if(idleClose > 0 && input.empty() && poll(&waiting, 1, idleClose / 1000) == 0)
+            {
+               close(fd);
+               return;
+            }
+            ssize_t got = read(fd, chunk, sizeof(chunk));
+            if(got <= 0)
+            {
+               close(fd);
+               return;
+            }
+            input.append(chunk, got);
+         }
+
+         string head = input.substr(0, headerEnd + 4);
+         string lower(head);
+         transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+         size_t bodyLength = 0;
+         size_t field = lower.find("\r\ncontent-length:");
+         if(field != string::npos)
+            bodyLength = strtoul(head.c_str() + field + 17, NULL, 10);
+
+         if(lower.find("\r\nexpect: 100-continue") != string::npos)
+            send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+
+         while(input.size() < headerEnd + 4 + bodyLength)
+         {
+            ssize_t got = read(fd, chunk, sizeof(chunk));
+            if(got <= 0)
+            {
+               close(fd);
+               return;
+            }
+            input.append(chunk, got);
+         }
+         input.erase(0, headerEnd + 4 + bodyLength);
+
+         bool welcoming = head.compare(0, 6, "GET / ") == 0;
+         const string *body = welcoming ? &welcome : &written;
+         const char *status = "200 OK";
+         string fields;
+         if(authCost > 0)
+         {
+            size_t sent     = lower.find("\r\ncookie: authsession=");
+            bool   signedIn = sent != string::npos && head.compare(sent + 22, cookie.size(), cookie) == 0 &&
+                              !loginsRefused;
+            if(head.compare(0, 15, "POST /_session ") == 0)
+            {
+               checkPassword();
+               if(loginsRefused)
+               {
+                  status = "401 Unauthorized";
+                  body   = &unauthorized;
+               }
+               else
+               {
+                  body   = &loggedIn;
+                  fields = "Set-Cookie: AuthSession=" + cookie + "; Version=1; Path=/; HttpOnly\r\n";
+               }
+            }
+            else if(lower.find("\r\nauthorization: basic ") != string::npos)
+               checkPassword();
+            else if(!signedIn)
+            {
+               status = "401 Unauthorized";
+               body   = &unauthorized;
+            }
+         }
+         size_t count = ++served;
+         if(dropEvery > 0 && count % dropEvery == 0)
+         {
+            close(fd);
+            return;
+         }
+         if(failEvery > 0 && count % failEvery == 0)
+         {
+            status = "503 Service Unavailable";
+            body   = &unavailable;
+         }
+
+         if(!payload.empty() && !welcoming && body == &written && head.compare(0, 4, "GET ") == 0)
+         {
+            size_t accept = lower.find("\r\naccept-encoding:");
+            if(!gzippedPayload.empty() && accept != string::npos &&
+               lower.find("gzip", accept) < lower.find("\r\n", accept + 2))
+            {
+               body     = &gzippedPayload;
+               fields   = "Content-Encoding: gzip\r\n";
+            }
+            else
+               body = &payload;
+         }
+
+         bool closing = closeEvery > 0 && ++answered % closeEvery == 0;
+         if(closing)
+            fields += "Connection: close\r\n";
+
+         string framed;
+         if(chunkSize > 0)
+         {
+            fields += "Transfer-Encoding: chunked\r\n";
+            for(size_t offset = 0; offset < body->size(); offset += chunkSize)
+            {
+               size_t size = min(chunkSize, body->size() - offset);
+               char prefix[24];
+               framed.append(prefix, snprintf(prefix, sizeof(prefix), "%zx\r\n", size));
+               framed.append(*body, offset, size);
+               framed += "\r\n";
+            }
+            framed += "0\r\n";
+            if(trailers)
+               framed += "X-Served: " + to_string(count) + "\r\nX-Checksum: none\r\n";
+            framed += "\r\n";
+            body = &framed;
+         }
+         else
+            fields += "Content-Length: " + to_string(body->size()) + "\r\n";
+
+         string response = string("HTTP/1.1 ") + status + "\r\nContent-Type: application/json\r\n" + fields +
+                           "\r\n";
+
+         size_t exchanged = headerEnd + 4 + bodyLength + response.size() + body->size();
+         traffic += exchanged;
+
+         int wait = delay;
+         if(stallEvery > 0 && count % stallEvery == 0)
+            wait += stallTime;
+         if(linkSpeed > 0)
+            wait += exchanged / linkSpeed * 1e6;
+         if(wait > 0)
+            this_thread::sleep_for(chrono::microseconds(wait));
+         if(send(fd, response.data(), response.size(), MSG_NOSIGNAL | MSG_MORE) < 0 ||
+            send(fd, body->data(), body->size(), MSG_NOSIGNAL) < 0 || closing)
+         {
+            close(fd);
+            return;
+         }
+      }
+   }
+
+   // burns the CPU time a password hash would take
+   void checkPassword()
+   {
+      ++passwordChecks;
+      Clock::time_point until = Clock::now() + chrono::microseconds(authCost);
+      while(Clock::now() < until)
+         ;
+   }
+
+   static const string cookie;
+   static const string loggedIn;
+   static const string unauthorized;
+   static const string unavailable;
+
+   string           socketPath;
+   int              listenFd;
+   int              port;
+   int              delay;
+   double           linkSpeed;
+   int              authCost;
+   int              stallEvery;
+   int              stallTime;
+   int              failEvery;
+   int              dropEvery;
+   size_t           chunkSize;
+   bool             trailers;
+   int              closeEvery;
+   int              idleClose;
+   string           payload;
+   string           gzippedPayload;
+   atomic<size_t>   traffic{0};
+   atomic<size_t>   passwordChecks{0};
+   atomic<size_t>   served{0};
+   atomic<bool>     loginsRefused{false};
+   atomic<bool>     stopping;
+   thread           acceptor;
+   mutex            clientsMutex;
+   vector<int>      clientFds;
+   vector<thread>   clients;
+};
+
+const string LocalServer::cookie       = "dTpCNUY1N0Q2QjpL";
+const string LocalServer::loggedIn     = "{\"ok\":true,\"name\":\"u\",\"roles\":[]}";
+const string LocalServer::unauthorized = "{\"error\":\"unauthorized\","
+                                         "\"reason\":\"You are not authorized to access this db.\"}";
+const string LocalServer::unavailable  = "{\"error\":\"unavailable\",\"reason\":\"Service unavailable\"}";
+
+// ---[ THREAD SCALING ]---------------------------------------------------------
+
+// Runs `requests` write-reply requests on each of `threads` threads and
+// returns the overall rate; `commFor` picks the Communication a thread uses.
+template<typename CommFor>
+static double requestRate(int threads, int requests, CommFor commFor)
+{
+   atomic<int> failures(0);
+   vector<thread> workers;
+
+   Clock::time_point start = Clock::now();
+   for(int t = 0; t < threads; ++t)
+   {
+      workers.push_back(thread([&, t]() {
+         CouchDB::Communication &comm = commFor(t);
+         for(int i = 0; i < requests; ++i)
+         {
+            try
+            {
+               CouchDB::WriteReply reply;
+               comm.getReply("/db/doc", reply);
+               if(!reply.ok)
+                  ++failures;
+            }
+            catch(const exception&)
+            {
+               ++failures;
+            }
+         }
+      }));
+   }
+   for(size_t t = 0; t < workers.size(); ++t)
+      workers[t].join();
+
+   double seconds = chrono::duration<double>(Clock::now() - start).count();
+   if(failures > 0)
+      cerr << "  " << failures << " requests failed" << endl;
+   return threads * requests / seconds;
+}
+
+static void benchScaling(int delay, int requests)
+{
+   LocalServer server(delay);
+   string url = server.getURL();
+
+   printf("Thread scaling, %d us server time per request\n", delay);
+   printf("  %-8s %16s %16s %16s\n", "threads", "shared, 1 handle", "per-thread conn", "shared, pooled");
+
+   int counts[] = { 1, 2, 4, 8, 16 };
+   for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+   {
+      int threads = counts[c];
+
+      // a single handle serves one request at a time, as before the pool
+      CouchDB::Communication single(url);
+      single.setMaxHandles(1);
+      double singleRate = requestRate(threads, requests,
+            [&](int) -> CouchDB::Communication& { return single; });
+
+      vector<unique_ptr<CouchDB::Communication> > own;
+      for(int t = 0; t < threads; ++t)
+         own.push_back(unique_ptr<CouchDB::Communication>(new CouchDB::Communication(url)));
+      double ownRate = requestRate(threads, requests,
+            [&](int t) -> CouchDB::Communication& { return *own[t]; });
+
+      CouchDB::Communication shared(url);
+      shared.setMaxHandles(threads);
+      double sharedRate = requestRate(threads, requests,
+            [&](int) -> CouchDB::Communication& { return shared; });
+
+      printf("  %-8d %12.0f r/s %12.0f r/s %12.0f r/s\n", threads, singleRate, ownRate, sharedRate);
+   }
+}
+
+// ---[ ASYNCHRONOUS REQUESTS ]--------------------------------------------------
+
+// Runs `total` write-reply requests from the calling thread, keeping up to
+// `window` of them in flight, and returns the rate. Each completion starts
+// the next request from the I/O thread.
+static double asyncRate(CouchDB::Communication &comm, int total, int window)
+{
+   mutex              doneMutex;
+   condition_variable allDone;
+   atomic<int>        started(0);
+   atomic<int>        finished(0);
+   atomic<int>        failures(0);
+
+   CouchDB::AsyncHandler handler = [&](CouchDB::AsyncResponse &response) {
+      CouchDB::WriteReply reply;
+      if(!response.error.empty() || !CouchDB::decodeWriteReply(response.body.data(), response.body.size(), reply) || !reply.ok)
+         ++failures;
+
+      if(started++ < total)
+         comm.requestAsync("/db/doc", handler);
+
+      if(++finished == total)
+      {
+         lock_guard<mutex> lock(doneMutex);
+         allDone.notify_one();
+      }
+   };
+
+   Clock::time_point start = Clock::now();
+   for(int i = 0; i < window && started++ < total; ++i)
+      comm.requestAsync("/db/doc", handler);
+
+   {
+      unique_lock<mutex> lock(doneMutex);
+      allDone.wait(lock, [&]() { return finished == total; });
+   }
+
+   double seconds = chrono::duration<double>(Clock::now() - start).count();
+   if(failures > 0)
+      cerr << "  " << failures << " requests failed" << endl;
+   return total / seconds;
+}
+
+// Blocking calls against async ones when the server takes `delay`
+// microseconds per request, as on a distant link.
+static void benchLatency(int delay, int total)
+{
+   LocalServer server(delay);
+   string url = server.getURL();
+
+   printf("Requests in flight, %d us server time per request\n", delay);
+
+   {
+      CouchDB::Communication comm(url);
+      double rate = requestRate(1, total / 20,
+            [&](int) -> CouchDB::Communication& { return comm; });
+      printf("  %-32s %10.0f r/s\n", "blocking, 1 thread", rate);
+   }
+
+   int threads[] = { 16, 64 };
+   for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+   {
+      CouchDB::Communication comm(url);
+      comm.setMaxHandles(threads[t]);
+      double rate = requestRate(threads[t], total / threads[t],
+            [&](int) -> CouchDB::Communication& { return comm; });
+
+      char label[64];
+      snprintf(label, sizeof(label), "blocking, %d threads", threads[t]);
+      printf("  %-32s %10.0f r/s\n", label, rate);
+   }
+
+   int windows[] = { 16, 64, 256 };
+   for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w)
+   {
+      CouchDB::Communication comm(url);
+      double rate = asyncRate(comm, total, windows[w]);
+
+      char label[64];
+      snprintf(label, sizeof(label), "async, 1 thread, %d in flight", windows[w]);
+      printf("  %-32s %10.0f r/s\n", label, rate);
+   }
+
+   // same, driven by an io_context the program runs itself
+   {
+      boost::asio::io_context io;
+      boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(io.get_executor());
+      thread runner([&]() { io.run(); });
+
+      double rate;
+      {
+         CouchDB::Communication comm(url);
+         comm.setIOContext(io);
+         rate = asyncRate(comm, total, 256);
+
+         // nothing of the Communication may run while it is destroyed
+         io.stop();
+         runner.join();
+      }
+      printf("  %-32s %10.0f r/s\n", "async, io_context, 256 in flight", rate);
+   }
+}
+
+// ---[ SHARED CONNECTIONS ]-----------------------------------------------------
+
+// Many threads against a server speaking only HTTP/1.1: handles of their
+// own, against the HTTP/2 mode falling back to a bounded keep-alive pool.
+static void benchSharing(int delay, int threads, int requests)
+{
+   printf("Connection sharing, %d threads, %d us server time per request\n", threads, delay);
+
+   size_t limits[] = { 0, 16, 4 };
+   for(size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); ++l)
+   {
+      LocalServer server(delay);
+      CouchDB::Communication comm(server.getURL());
+      comm.setMaxHandles(threads);
+
+      char label[64];
+      if(limits[l] == 0)
+         snprintf(label, sizeof(label), "handle per thread");
+      else
+      {
+         comm.setHTTPVersion(CouchDB::Communication::HTTP_2);
+         comm.setMaxConnections(limits[l]);
+         snprintf(label, sizeof(label), "HTTP/2 mode, %d connections", (int)limits[l]);
+      }
+
+      double rate = requestRate(threads, requests,
+            [&](int) -> CouchDB::Communication& { return comm; });
+      printf("  %-32s %10.0f r/s %6d connections\n", label, rate, (int)server.getConnections());
+   }
+}
+
+// ---[ COMPRESSION ]------------------------------------------------------------
+
+// An _all_docs page with the given number of rows.
+static string createAllDocsPage(int rows)
+{
+   string page = "{\"total_rows\":" + to_string(rows) + ",\"offset\":0,\"rows\":[\n";
+   for(int i = 0; i < rows; ++i)
+   {
+      char row[160];
+      unsigned id = i * 2654435761u;
+      snprintf(row, sizeof(row), "%s{\"id\":\"%032x\",\"key\":\"%032x\","
+               "\"value\":{\"rev\":\"1-%032x\"}}", i ? ",\n" : "", id, id, id ^ 0x5bd1e995);
+      page += row;
+   }
+   return page + "\n]}\n";
+}
+
+// Milliseconds per request, and bytes on the wire, for `requests` calls
+// made by `call` against a server behind a link of `mbits` Mbit/s.
+template<typename Call>
+static double exchangeTime(const string &payload, double mbits, int requests,
+      const CouchDB::CompressionOptions &options, Call call, size_t &traffic)
+{
+   LocalServer server(0);
+   server.setPayload(payload);
+   server.setLinkSpeed(mbits * 1e6 / 8);
+
+   CouchDB::Communication comm(server.getURL());
+   comm.setCompression(options);
+   call(comm);   // connects
+
+   Clock::time_point start = Clock::now();
+   for(int i = 0; i < requests; ++i)
+      call(comm);
+   double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+   traffic = server.getTraffic() / (requests + 1);
+   return seconds * 1e3 / requests;
+}
+
+// Fetching a page of `rows` rows, and uploading one as a document, with and
+// without compression: bandwidth saved against CPU spent, by link speed.
+static void benchCompression(int rows, int requests)
+{
+   string page = createAllDocsPage(rows);
+
+   CouchDB::CompressionOptions identity;
+   identity.acceptEncoded = false;
+   CouchDB::CompressionOptions accept;
+   CouchDB::CompressionOptions fast;
+   fast.minimumSize = 1024;
+   CouchDB::CompressionOptions small = fast;
+   small.level = 6;
+
+   auto download = [](CouchDB::Communication &comm) { comm.getRawData("/db/_all_docs"); };
+   auto upload   = [&](CouchDB::Communication &comm) {
+      CouchDB::WriteReply reply;
+      comm.getReply("/db/doc", reply, "PUT", page);
+   };
+
+   printf("Compression, %d row _all_docs page (%d bytes), ms per request\n", rows, (int)page.size());
+   printf("  %-10s %10s %10s   %10s %10s %10s\n", "link", "GET plain", "GET gzip",
+          "PUT plain", "PUT gzip 1", "PUT gzip 6");
+
+   double speeds[] = { 10, 100, 1000, 0 };
+   size_t traffic[5];
+   for(size_t l = 0; l < sizeof(speeds) / sizeof(speeds[0]); ++l)
+   {
+      double times[5];
+      times[0] = exchangeTime(page, speeds[l], requests, identity, download, traffic[0]);
+      times[1] = exchangeTime(page, speeds[l], requests, accept, download, traffic[1]);
+      times[2] = exchangeTime(page, speeds[l], requests, identity, upload, traffic[2]);
+      times[3] = exchangeTime(page, speeds[l], requests, fast, upload, traffic[3]);
+      times[4] = exchangeTime(page, speeds[l], requests, small, upload, traffic[4]);
+
+      char label[32];
+      if(speeds[l] > 0)
+         snprintf(label, sizeof(label), "%g Mbit/s", speeds[l]);
+      else
+         snprintf(label, sizeof(label), "loopback");
+      printf("  %-10s %10.2f %10.2f   %10.2f %10.2f %10.2f\n", label,
+             times[0], times[1], times[2], times[3], times[4]);
+   }
+   printf("  %-10s %10d %10d   %10d %10d %10d\n", "bytes", (int)traffic[0], (int)traffic[1],
+          (int)traffic[2], (int)traffic[3], (int)traffic[4]);
+}
+
+// ---[ UNIX DOMAIN SOCKETS ]----------------------------------------------------
+
+// Small-document reads from a server on the same host, over loopback TCP
+// and over a Unix domain socket.
+static void benchUnixSocket(int requests)
+{
+   string path = "/tmp/couchdbpp-bench-" + to_string(getpid()) + ".sock";
+
+   printf("Co-located server, small replies\n");
+   printf("  %-10s %12s %12s %12s %12s\n", "threads", "TCP r/s", "TCP us", "Unix r/s", "Unix us");
+
+   int counts[] = { 1, 8 };
+   for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+   {
+      int threads = counts[c];
+      double rates[2];
+      for(int local = 0; local < 2; ++local)
+      {
+         LocalServer server(0, local ? path : "");
+         CouchDB::Communication comm(server.getURL());
+         comm.setMaxHandles(threads);
+         if(local)
+            comm.setUnixSocket(path);
+
+         rates[local] = requestRate(threads, requests,
+               [&](int) -> CouchDB::Communication& { return comm; });
+      }
+
+      printf("  %-10d %12.0f %12.1f %12.0f %12.1f\n", threads, rates[0], threads * 1e6 / rates[0],
+             rates[1], threads * 1e6 / rates[1]);
+   }
+}
+
+// ---[ LARGE RESPONSES ]--------------------------------------------------------
+
+// Resident anonymous and file-backed memory of the process, in MB.
+static void getResident(double &anonymous, double &file)
+{
+   anonymous = file = 0;
+
+   FILE *status = fopen("/proc/self/status", "r");
+   if(!status)
+      return;
+
+   char line[256];
+   while(fgets(line, sizeof(line), status))
+   {
+      long kb;
+      if(sscanf(line, "RssAnon: %ld kB", &kb) == 1)
+         anonymous = kb / 1024.0;
+      else if(sscanf(line, "RssFile: %ld kB", &kb) == 1)
+         file = kb / 1024.0;
+   }
+   fclose(status);
+}
+
+// Receiving a response of `megabytes` MB into a string, and into a
+// ResponseBuffer in memory or spilled to a file mapping: time taken and
+// memory held while the body is kept.
+static void benchLargeResponses(int megabytes)
+{
+   LocalServer server(0);
+   server.setPayload(createAllDocsPage(megabytes * 7500), false);
+   string url = server.getURL();
+
+   printf("Large responses, %d MB body\n", megabytes);
+   printf("  %-26s %10s %14s %14s\n", "", "ms", "anonymous MB", "file MB");
+
+   for(int mode = 0; mode < 3; ++mode)
+   {
+      CouchDB::Communication comm(url);
+      CouchDB::CompressionOptions identity;
+      identity.acceptEncoded = false;
+      comm.setCompression(identity);
+      if(mode == 2)
+         comm.setSpillThreshold(16 << 20);
+
+      double anonymousBefore, fileBefore, anonymous, file;
+      getResident(anonymousBefore, fileBefore);
+
+      Clock::time_point start = Clock::now();
+      string                 text;
+      CouchDB::ResponseBuffer buffer;
+      if(mode == 0)
+         text = comm.getRawData("/db/_all_docs");
+      else
+         comm.getRawData("/db/_all_docs", buffer);
+      double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      getResident(anonymous, file);
+
+      const char *labels[] = { "string", "buffer, in memory", "buffer, spilled past 16 MB" };
+      printf("  %-26s %10.1f %14.1f %14.1f\n", labels[mode], ms,
+             anonymous - anonymousBefore, file - fileBefore);
+   }
+}
+
+// ---[ TRANSPORTS ]-------------------------------------------------------------
+
+// Blocking requests over libcurl and over the built-in epoll client: small
+// replies from 1 and 8 threads, then a large response read into a buffer.
+static void benchTransports(int requests, int megabytes)
+{
+   boost::shared_ptr<CouchDB::Transport> epoll(new CouchDB::EpollTransport());
+
+   printf("Transports, small replies\n");
+   printf("  %-10s %12s %12s %12s %12s\n", "threads", "curl r/s", "curl us", "epoll r/s", "epoll us");
+
+   int counts[] = { 1, 8 };
+   for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+   {
+      int threads = counts[c];
+      double rates[2];
+      for(int lean = 0; lean < 2; ++lean)
+      {
+         LocalServer server(0);
+         CouchDB::Communication comm(server.getURL());
+         comm.setMaxHandles(threads);
+         if(lean)
+            comm.setTransport(epoll);
+
+         rates[lean] = requestRate(threads, requests,
+               [&](int) -> CouchDB::Communication& { return comm; });
+      }
+
+      printf("  %-10d %12.0f %12.1f %12.0f %12.1f\n", threads, rates[0], threads * 1e6 / rates[0],
+             rates[1], threads * 1e6 / rates[1]);
+   }
+
+   LocalServer server(0);
+   server.setPayload(createAllDocsPage(megabytes * 7500), false);
+
+   printf("Transports, %d MB body\n", megabytes);
+   printf("  %-10s %12s\n", "", "ms");
+   for(int lean = 0; lean < 2; ++lean)
+   {
+      CouchDB::Communication comm(server.getURL());
+      CouchDB::CompressionOptions identity;
+      identity.acceptEncoded = false;
+      comm.setCompression(identity);
+      if(lean)
+         comm.setTransport(epoll);
+
+      CouchDB::ResponseBuffer buffer;
+      comm.getRawData("/db/_all_docs", buffer);   // connection and buffer warm-up
+      Clock::time_point start = Clock::now();
+      comm.getRawData("/db/_all_docs", buffer);
+      double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      printf("  %-10s %12.1f\n", lean ? "epoll" : "curl", ms);
+   }
+}
+
+// ---[ RESPONSE FRAMING ]-------------------------------------------------------
+
+// GETs of an _all_docs page over both transports, with the body framed by
+// Content-Length, chunked with and without trailers, on connections the
+// server closes after every fourth response, and on ones it drops once
+// idle for 2 ms while the client pauses 5 ms between requests, so that
+// every request but the first finds its connection gone. Checks each body
+// and counts the connections the server accepted.
+static bool benchFraming(int requests)
+{
+   boost::shared_ptr<CouchDB::Transport> epoll(new CouchDB::EpollTransport(8, 5000));
+   string page = createAllDocsPage(500);
+
+   printf("Response framing, %zu byte body\n", page.size());
+   printf("  %-18s %12s %12s %12s %12s\n", "", "curl r/s", "curl conns", "epoll r/s", "epoll conns");
+
+   const char *names[] = { "content-length", "chunked", "chunked+trailers", "close every 4", "idle close" };
+   for(int mode = 0; mode < 5; ++mode)
+   {
+      int count = mode == 4 ? requests / 20 : requests;
+      double rates[2];
+      size_t connections[2];
+      for(int lean = 0; lean < 2; ++lean)
+      {
+         LocalServer server(0);
+         server.setPayload(page, false);
+         if(mode == 1 || mode == 2)
+            server.setChunked(1000, mode == 2);
+         else if(mode == 3)
+            server.setCloseEvery(4);
+         else if(mode == 4)
+            server.setIdleClose(2000);
+
+         CouchDB::Communication comm(server.getURL());
+         CouchDB::CompressionOptions identity;
+         identity.acceptEncoded = false;
+         comm.setCompression(identity);
+         if(lean)
+            comm.setTransport(epoll);
+
+         CouchDB::ResponseBuffer buffer;
+         Clock::time_point start = Clock::now();
+         for(int i = 0; i < count; ++i)
+         {
+            if(mode == 4 && i > 0)
+               this_thread::sleep_for(chrono::milliseconds(5));
+
+            long status;
+            comm.getRawData("/db/_all_docs", buffer, status);
+            if(status != 200 || string(buffer.data(), buffer.size()) != page)
+            {
+               cerr << "  " << names[mode] << ": body mismatch over " << (lean ? "epoll" : "curl") << endl;
+               return false;
+            }
+         }
+         rates[lean]       = count / chrono::duration<double>(Clock::now() - start).count();
+         connections[lean] = server.getConnections();
+      }
+
+      printf("  %-18s %12.0f %12zu %12.0f %12zu\n", names[mode], rates[0], connections[0], rates[1],
+             connections[1]);
+   }
+   return true;
+}
+
+// ---[ COLD START ]-------------------------------------------------------------
+
+// Short-lived connections, each created, used for one request and dropped:
+// one after the other, then on many threads starting at once. Also counts
+// the TCP connections the server had to accept.
+static void benchColdStart(int connections, int threads)
+{
+   printf("Cold start, one request per Connection\n");
+   printf("  %-24s %12s %14s %12s\n", "", "ms", "us/connection", "TCP opens");
+
+   for(int burst = 0; burst < 2; ++burst)
+   {
+      LocalServer server(0);
+      string url = server.getURL();
+      int count = burst ? threads : connections;
+      atomic<int> failures(0);
+
+      Clock::time_point start = Clock::now();
+      if(!burst)
+      {
+         for(int i = 0; i < connections; ++i)
+         {
+            CouchDB::Connection conn(url);
+            if(!conn.createDatabase("db"))
+               ++failures;
+         }
+      }
+      else
+      {
+         vector<thread> workers;
+         for(int t = 0; t < threads; ++t)
+         {
+            workers.push_back(thread([&]() {
+               try
+               {
+                  CouchDB::Connection conn(url);
+                  if(!conn.createDatabase("db"))
+                     ++failures;
+               }
+               catch(const exception&)
+               {
+                  ++failures;
+               }
+            }));
+         }
+         for(size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+      }
+      double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      if(failures > 0)
+         cerr << "  " << failures << " connections failed" << endl;
+      string label = burst ? to_string(threads) + " threads at once" : "sequential";
+      printf("  %-24s %12.1f %14.1f %12zu\n", label.c_str(), ms, ms * 1000 / count,
+             server.getConnections());
+   }
+}
+
+// ---[ SESSIONS ]---------------------------------------------------------------
+
+// Requests against a server that spends `cost` microseconds checking a
+// password, authenticated with Basic credentials in the URL and with a
+// session cookie from login(), from 1 and 8 threads.
+static void benchSessions(int cost, int requests)
+{
+   printf("Authentication, %d us per password check\n", cost);
+   printf("  %-10s %12s %12s %12s %12s\n", "threads", "basic r/s", "checks", "cookie r/s", "checks");
+
+   int counts[] = { 1, 8 };
+   for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+   {
+      int threads = counts[c];
+      double rates[2];
+      size_t checks[2];
+      for(int cookie = 0; cookie < 2; ++cookie)
+      {
+         LocalServer server(0);
+         server.setAuthCost(cost);
+
+         string url = server.getURL();
+         CouchDB::Communication comm(cookie ? url : "http://u:p@" + url.substr(7));
+         comm.setMaxHandles(threads);
+         if(cookie)
+            comm.login("u", "p");
+
+         rates[cookie] = requestRate(threads, requests,
+               [&](int) -> CouchDB::Communication& { return comm; });
+         checks[cookie] = server.getPasswordChecks();
+      }
+
+      printf("  %-10d %12.0f %12zu %12.0f %12zu\n", threads, rates[0], checks[0], rates[1], checks[1]);
+   }
+}
+
+// ---[ RETRIES AND HEDGING ]----------------------------------------------------
+
+// Sequential GETs against a server that stalls one request in `stallEvery`
+// for `stallTime` microseconds: latency percentiles without a policy and
+// hedged past the 95th percentile. Then the same number of GETs against
+// one answering one request in `failEvery` 503, without and with retries.
+static void benchRecovery(int requests, int stallEvery, int stallTime, int failEvery)
+{
+   printf("Stalls, %d us every %d requests\n", stallTime, stallEvery);
+   printf("  %-10s %10s %10s %10s %10s %10s %8s %8s\n", "", "total ms", "p50 us", "p99 us", "p99.9 us",
+          "max us", "hedged", "won");
+
+   for(int hedging = 0; hedging < 2; ++hedging)
+   {
+      LocalServer server(0);
+      server.setStalls(stallEvery, stallTime);
+
+      CouchDB::Communication comm(server.getURL());
+      CouchDB::RequestPolicy policy;
+      policy.hedgePercentile = hedging ? 95 : 0;
+      comm.setRequestPolicy(policy);
+
+      vector<double> latencies;
+      Clock::time_point start = Clock::now();
+      for(int i = 0; i < requests; ++i)
+      {
+         Clock::time_point sent = Clock::now();
+         comm.getRawData("/db/doc");
+         latencies.push_back(chrono::duration<double, micro>(Clock::now() - sent).count());
+      }
+      double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      sort(latencies.begin(), latencies.end());
+      CouchDB::RequestMetrics metrics = comm.getRequestMetrics();
+      printf("  %-10s %10.1f %10.0f %10.0f %10.0f %10.0f %8zu %8zu\n", hedging ? "hedged" : "plain", ms,
+             latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100],
+             latencies[latencies.size() * 999 / 1000], latencies.back(), metrics.hedged, metrics.hedgesWon);
+   }
+
+   printf("Failures, 503 every %d requests\n", failEvery);
+   printf("  %-10s %10s %10s %10s\n", "", "total ms", "failed", "retries");
+
+   for(int retrying = 0; retrying < 2; ++retrying)
+   {
+      LocalServer server(0);
+      server.setFailures(failEvery);
+
+      CouchDB::Communication comm(server.getURL());
+      CouchDB::RequestPolicy policy;
+      policy.maxRetries = retrying ? 3 : 0;
+      policy.backoff    = 1;
+      comm.setRequestPolicy(policy);
+
+      int failed = 0;
+      Clock::time_point start = Clock::now();
+      for(int i = 0; i < requests; ++i)
+      {
+         long status;
+         comm.getRawData("/db/doc", status);
+         if(status != 200)
+            ++failed;
+      }
+      double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+      printf("  %-10s %10.1f %10d %10zu\n", retrying ? "retried" : "plain", ms, failed,
+             comm.getRequestMetrics().retries);
+   }
+}
+
+// Requests against a server failing every one of them, with up to three
+// retries: 503 answers to GET and to PUT, without and with retryWrites,
+// dropped connections over both transports, and a login refused once the
+// session has expired, which is no connection failure and must be thrown
+// at once. Checks each was retried exactly as often as the policy allows.
+static bool checkRetries()
+{
+   printf("Retry policy, maxRetries 3\n");
+   printf("  %-30s %8s %8s  %s\n", "", "retries", "expected", "outcome");
+
+   typedef function<void(LocalServer&, CouchDB::Communication&)> Step;
+   auto check = [](const char *name, size_t expected, bool writes, bool lean, const Step &setup,
+                   const Step &request) -> bool {
+      LocalServer server(0);
+      CouchDB::Communication comm(server.getURL());
+      if(lean)
+         comm.setTransport(boost::shared_ptr<CouchDB::Transport>(new CouchDB::EpollTransport()));
+      setup(server, comm);
+
+      CouchDB::RequestPolicy policy;
+      policy.maxRetries  = 3;
+      policy.backoff     = 1;
+      policy.retryWrites = writes;
+      comm.setRequestPolicy(policy);
+
+      string outcome;
+      try
+      {
+         request(server, comm);
+         outcome = to_string(comm.getResponseCode());
+      }
+      catch(const CouchDB::TransportException &e)
+      {
+         outcome = string("connection failed: ") + e.what();
+      }
+      catch(const CouchDB::Exception &e)
+      {
+         outcome = string("thrown: ") + e.what();
+      }
+
+      size_t retries = comm.getRequestMetrics().retries;
+      printf("  %-30s %8zu %8zu  %s\n", name, retries, expected, outcome.c_str());
+      return retries == expected;
+   };
+
+   Step failing  = [](LocalServer &server, CouchDB::Communication&) { server.setFailures(1); };
+   Step dropping = [](LocalServer &server, CouchDB::Communication&) { server.setDrops(1); };
+   Step get      = [](LocalServer&, CouchDB::Communication &comm) { comm.getRawData("/db/doc"); };
+   Step put      = [](LocalServer&, CouchDB::Communication &comm) {
+      CouchDB::WriteReply reply;
+      comm.getReply("/db/doc", reply, "PUT", "{}");
+   };
+   Step signIn   = [](LocalServer &server, CouchDB::Communication &comm) {
+      server.setAuthCost(1);
+      comm.login("u", "p");
+   };
+   Step expired  = [](LocalServer &server, CouchDB::Communication &comm) {
+      comm.getRawData("/db/doc");
+      server.refuseLogins();
+      comm.getRawData("/db/doc");
+   };
+
+   bool ok = check("GET answered 503", 3, false, false, failing, get);
+   ok = check("PUT answered 503", 0, false, false, failing, put) && ok;
+   ok = check("PUT answered 503, retryWrites", 3, true, false, failing, put) && ok;
+   ok = check("GET dropped, curl", 3, false, false, dropping, get) && ok;
+   ok = check("PUT dropped, curl", 0, false, false, dropping, put) && ok;
+   ok = check("GET dropped, epoll", 3, false, true, dropping, get) && ok;
+   ok = check("PUT dropped, epoll", 0, false, true, dropping, put) && ok;
+   ok = check("login refused, curl", 0, false, false, signIn, expired) && ok;
+   ok = check("login refused, epoll", 0, false, true, signIn, expired) && ok;
+   return ok;
+}
+
+int main()
+{
+#ifndef __OPTIMIZE__
+   cerr << "Warning: built without optimization, the figures below mean little" << endl;
+#endif
+   benchScaling(0, 2000);
+   benchScaling(500, 200);
+   benchLatency(5000, 5000);
+   benchSharing(500, 64, 100);
+   benchCompression(2000, 20);
+   benchLargeResponses(256);
+   benchUnixSocket(20000);
+   benchTransports(20000, 64);
+   if(!benchFraming(2000))
+      return 1;
+   benchColdStart(2000, 256);
+   benchSessions(1000, 2000);
+   benchRecovery(5000, 100, 50000, 50);
+   if(!checkRetries())
+      return 1;
+   return 0;
+}
@@ -0,0 +1,820 @@
+/**
+ * Copyright 2009 Tragicphantom Productions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+**/
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "couchdb/Binding.hpp"
+#include "couchdb/CouchDB.hpp"
+#include "couchdb/Parser.hpp"
+#include "couchdb/Projection.hpp"
+#include "couchdb/Reply.hpp"
+#include "couchdb/StreamParser.hpp"
+#include "couchdb/Writer.hpp"
+#include "couchdb/Value.hpp"
+
+#include "tinyjson/tinyjson.hpp"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// the containers Object and Array used to be, and tinyjson still builds
+typedef deque<CouchDB::Variant>            LegacyArray;
+typedef map<string, CouchDB::Variant>      LegacyObject;
+
+struct TextRecord
+{
+   int    key;
+   double dValue;
+   int    big;
+   bool   flag;
+   string body;
+};
+
+struct TextDocument
+{
+   string             _id;
+   string             _rev;
+   vector<TextRecord> records;
+};
+
+COUCHDB_FIELDS(TextRecord, (key)(dValue)(big)(flag)(body))
+COUCHDB_FIELDS(TextDocument, (_id)(_rev)(records))
+
+// Builds an _all_docs page with the given number of rows.
+static string createAllDocsPage(int numRows)
+{
+   ostringstream out;
+   out << "{\"total_rows\":" << numRows << ",\"offset\":0,\"rows\":[\n";
+   for(int i = 0; i < numRows; ++i)
+   {
+      char id[40];
+      sprintf(id, "%032x", i * 2654435761u);
+      out << (i ? ",\n" : "")
+          << "{\"id\":\"" << id << "\",\"key\":\"" << id
+          << "\",\"value\":{\"rev\":\"1-967a00dff5e02add41819138abb3284d\"}}";
+   }
+   out << "\n]}\n";
+   return out.str();
+}
+
+// Builds a document with long text fields, numbers and nested records.
+static string createTextDocument(int numRecords)
+{
+   ostringstream out;
+   out << "{\"_id\":\"text-document\",\"_rev\":\"3-b4a1e0a5d2c3\",\"records\":[";
+   for(int i = 0; i < numRecords; ++i)
+   {
+      out << (i ? "," : "")
+          << "{\"key\":" << i << ",\"dValue\":" << i * 0.25
+          << ",\"big\":" << 1000003 * i
+          << ",\"flag\":" << (i % 2 ? "true" : "false")
+          << ",\"none\":null"
+          << ",\"body\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, "
+             "sed do eiusmod tempor \\\"incididunt\\\" ut labore et dolore magna aliqua.\\n"
+             "Ut enim ad minim veniam, quis nostrud exercitation \\u00e9\\u4e2d ullamco.\"}";
+   }
+   out << "]}";
+   return out.str();
+}
+
+static bool equalTrees(const CouchDB::Variant &a, const CouchDB::Variant &b);
+
+static bool equalValues(const boost::any &a, const boost::any &b)
+{
+   if(a.empty() || b.empty())
+      return a.empty() == b.empty();
+
+   if(a.type() != b.type())
+      return false;
+
+   if(a.type() == typeid(string))
+      return boost::any_cast<string>(a) == boost::any_cast<string>(b);
+   if(a.type() == typeid(bool))
+      return boost::any_cast<bool>(a) == boost::any_cast<bool>(b);
+   if(a.type() == typeid(int))
+      return boost::any_cast<int>(a) == boost::any_cast<int>(b);
+   if(a.type() == typeid(double))
+      return boost::any_cast<double>(a) == boost::any_cast<double>(b);
+
+   if(const CouchDB::Object *objA = boost::any_cast<CouchDB::Object>(&a))
+   {
+      const CouchDB::Object &objB = *boost::any_cast<CouchDB::Object>(&b);
+      if(objA->size() != objB.size())
+         return false;
+
+      CouchDB::Object::const_iterator i = objA->begin(), j = objB.begin();
+      for(; i != objA->end(); ++i, ++j)
+         if(i->first != j->first || !equalTrees(i->second, j->second))
+            return false;
+      return true;
+   }
+
+   if(const CouchDB::Array *arrA = boost::any_cast<CouchDB::Array>(&a))
+   {
+      const CouchDB::Array &arrB = *boost::any_cast<CouchDB::Array>(&b);
+      if(arrA->size() != arrB.size())
+         return false;
+
+      for(size_t i = 0; i < arrA->size(); ++i)
+         if(!equalTrees((*arrA)[i], arrB[i]))
+            return false;
+      return true;
+   }
+
+   return false;
+}
+
+static bool equalTrees(const CouchDB::Variant &a, const CouchDB::Variant &b)
+{
+   return equalValues(*a, *b);
+}
+
+// Copies a tree between the legacy and the current containers.
+template<typename FromObject, typename FromArray, typename ToObject, typename ToArray>
+static CouchDB::Variant convertTree(const CouchDB::Variant &var)
+{
+   if(const FromObject *obj = boost::any_cast<FromObject>(var.get()))
+   {
+      ToObject result;
+      for(typename FromObject::const_iterator i = obj->begin(); i != obj->end(); ++i)
+         result[i->first] = convertTree<FromObject, FromArray, ToObject, ToArray>(i->second);
+      return CouchDB::createVariant(result);
+   }
+
+   if(const FromArray *arr = boost::any_cast<FromArray>(var.get()))
+   {
+      ToArray result;
+      for(typename FromArray::const_iterator i = arr->begin(); i != arr->end(); ++i)
+         result.push_back(convertTree<FromObject, FromArray, ToObject, ToArray>(*i));
+      return CouchDB::createVariant(result);
+   }
+
+   return var;
+}
+
+static CouchDB::Variant parseTinyJSON(const string &data)
+{
+   return convertTree<LegacyObject, LegacyArray, CouchDB::Object, CouchDB::Array>(
+         json::parse(data.begin(), data.end()));
+}
+
+template<typename Function>
+static double timeRuns(Function function, int runs)
+{
+   Clock::time_point start = Clock::now();
+   for(int i = 0; i < runs; ++i)
+      function();
+   return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const string &name, size_t bytes, int runs, double seconds)
+{
+   printf("  %-28s %9.1f MB/s %10.3f ms/run\n", name.c_str(),
+          bytes * (double)runs / seconds / 1e6, seconds * 1e3 / runs);
+}
+
+static void reportCalls(const string &name, int runs, double seconds)
+{
+   printf("  %-28s %9.0f ns/call\n", name.c_str(), seconds * 1e9 / runs);
+}
+
+// ---[ PARSER THROUGHPUT ]------------------------------------------------------
+
+static bool benchParser(const string &name, const string &data, int runs)
+{
+   cout << name << " (" << data.size() << " bytes)" << endl;
+
+   CouchDB::Variant expected = parseTinyJSON(data);
+
+   const char *kernels[] = { "scalar", "sse2", "avx2" };
+   for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+   {
+      if(!CouchDB::setParserKernel(kernels[k]))
+         continue;
+
+      if(!equalTrees(expected, CouchDB::parseJSON(data)))
+      {
+         cerr << "  parse tree mismatch with kernel " << kernels[k] << endl;
+         return false;
+      }
+
+      double seconds = timeRuns([&]() { CouchDB::parseJSON(data); }, runs);
+      report(string("two-stage/") + kernels[k], data.size(), runs, seconds);
+
+      seconds = timeRuns([&]() { CouchDB::parseValue(data); }, runs);
+      report(string("two-stage/") + kernels[k] + " (Value)", data.size(), runs, seconds);
+   }
+
+   int tinyRuns = runs / 4 + 1;
+   report("tinyjson", data.size(), tinyRuns,
+          timeRuns([&]() { json::parse(data.begin(), data.end()); }, tinyRuns));
+
+   return true;
+}
+
+// ---[ VALUE VERSUS VARIANT ]---------------------------------------------------
+
+static size_t heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+   return mallinfo2().uordblks;
+#else
+   return 0;
+#endif
+}
+
+static size_t collectIDs(const CouchDB::Variant &page, vector<string> &ids)
+{
+   const CouchDB::Object &obj = *boost::any_cast<CouchDB::Object>(page.get());
+   const CouchDB::Array &rows = *boost::any_cast<CouchDB::Array>(obj.find("rows")->second.get());
+   for(size_t i = 0; i < rows.size(); ++i)
+   {
+      const CouchDB::Object &row = *boost::any_cast<CouchDB::Object>(rows[i].get());
+      ids.push_back(*boost::any_cast<string>(row.find("id")->second.get()));
+   }
+   return ids.size();
+}
+
+static size_t collectIDs(const CouchDB::Value &page, vector<string> &ids)
+{
+   const CouchDB::Value &rows = page.get("rows");
+   for(size_t i = 0; i < rows.size(); ++i)
+   {
+      boost::string_view id = rows[i].get("id").getString();
+      ids.push_back(string(id.data(), id.size()));
+   }
+   return ids.size();
+}
+
+static bool benchValue(const string &name, const string &data, int runs)
+{
+   cout << name << ": Variant versus Value" << endl;
+
+   CouchDB::Variant var = CouchDB::parseJSON(data);
+   CouchDB::ParseOptions options;
+   options.useArena = true;
+   if(!equalTrees(var, CouchDB::toVariant(CouchDB::parseValue(data))) ||
+      !equalTrees(var, CouchDB::toVariant(*CouchDB::parseTree(data, options))) ||
+      !equalTrees(var, CouchDB::toVariant(CouchDB::toValue(var))))
+   {
+      cerr << "  Value tree does not round trip" << endl;
+      return false;
+   }
+
+   size_t before = heapInUse();
+   CouchDB::Variant heldVariant = CouchDB::parseJSON(data);
+   size_t variantBytes = heapInUse() - before;
+
+   before = heapInUse();
+   CouchDB::Value heldValue = CouchDB::parseValue(data);
+   size_t valueBytes = heapInUse() - before;
+
+   CouchDB::ParseOptions arenaOptions;
+   arenaOptions.useArena = true;
+   before = heapInUse();
+   CouchDB::ValuePtr heldArena = CouchDB::parseTree(data, arenaOptions);
+   size_t arenaBytes = heapInUse() - before;
+
+   // the borrowing tree keeps the text it was parsed from, so count it too
+   CouchDB::ParseOptions borrowOptions;
+   borrowOptions.borrowStrings = true;
+   before = heapInUse();
+   string text(data);
+   CouchDB::ValuePtr heldBorrowed = CouchDB::parseTreeSwap(text, borrowOptions);
+   size_t borrowedBytes = heapInUse() - before;
+
+   if(variantBytes && valueBytes)
+   {
+      printf("  %-28s %9.1f MB\n", "memory, Variant", variantBytes / 1e6);
+      printf("  %-28s %9.1f MB\n", "memory, Value", valueBytes / 1e6);
+      printf("  %-28s %9.1f MB\n", "memory, Value (arena)", arenaBytes / 1e6);
+      printf("  %-28s %9.1f MB (%.1f MB of it text)\n", "memory, Value (borrowed)",
+             borrowedBytes / 1e6, data.size() / 1e6);
+   }
+
+   if(!equalTrees(var, CouchDB::toVariant(*heldBorrowed)))
+   {
+      cerr << "  borrowed tree does not match" << endl;
+      return false;
+   }
+
+   report("parse into Variant", data.size(), runs,
+          timeRuns([&]() { CouchDB::parseJSON(data); }, runs));
+   report("parse into Value", data.size(), runs,
+          timeRuns([&]() { CouchDB::parseValue(data); }, runs));
+
+   CouchDB::ParseOptions arena;
+   arena.useArena = true;
+   report("parse into Value (arena)", data.size(), runs,
+          timeRuns([&]() { CouchDB::parseTree(data, arena); }, runs));
+
+   // as Communication does it: the response buffer is handed to the tree
+   report("parse into Value (borrowed)", data.size(), runs,
+          timeRuns([&]() { string text(data); CouchDB::parseTreeSwap(text, borrowOptions); }, runs));
+   report("  of which copying the text", data.size(), runs,
+          timeRuns([&]() { string text(data); }, runs));
+
+   // as it would arrive from curl, in 16 KB chunks
+   auto stream = [&](CouchDB::JSONHandler &handler) {
+      CouchDB::StreamParser parser(handler);
+      for(size_t pos = 0; pos < data.size(); pos += 16384)
+         parser.feed(data.data() + pos, min<size_t>(16384, data.size() - pos));
+      return parser.finish();
+   };
+
+   CouchDB::ValueHandler streamed;
+   if(!stream(streamed) || !equalTrees(var, CouchDB::toVariant(streamed.getRoot())))
+   {
+      cerr << "  streamed tree does not match" << endl;
+      return false;
+   }
+
+   report("stream into Value", data.size(), runs,
+          timeRuns([&]() { CouchDB::ValueHandler handler; stream(handler); }, runs));
+   report("stream, events only", data.size(), runs,
+          timeRuns([&]() { CouchDB::JSONHandler handler; stream(handler); }, runs));
+
+   vector<string> ids;
+   ids.reserve(20000);
+   report("parse + ids (Variant)", data.size(), runs,
+          timeRuns([&]() { ids.clear(); collectIDs(CouchDB::parseJSON(data), ids); }, runs));
+   report("parse + ids (Value)", data.size(), runs,
+          timeRuns([&]() { ids.clear(); collectIDs(CouchDB::parseValue(data), ids); }, runs));
+   report("parse + ids (arena)", data.size(), runs,
+          timeRuns([&]() { ids.clear(); collectIDs(*CouchDB::parseTree(data, arena), ids); }, runs));
+   report("parse + ids (borrowed)", data.size(), runs,
+          timeRuns([&]() {
+             ids.clear();
+             string text(data);
+             collectIDs(*CouchDB::parseTreeSwap(text, borrowOptions), ids);
+          }, runs));
+
+   return true;
+}
+
+// ---[ PROJECTED PARSING ]------------------------------------------------------
+
+static bool benchProjection(const string &page, const string &document, int runs)
+{
+   cout << "Projection versus full parse" << endl;
+
+   // getDocument: _id and _rev out of a large document
+   string id, rev;
+   CouchDB::Projection doc;
+   doc.bind("_id", id).bind("_rev", rev);
+   if(!doc.apply(document) || id != "text-document")
+   {
+      cerr << "  projection did not find _id" << endl;
+      return false;
+   }
+
+   // The projection stops once _id and _rev are bound, so it reads only the
+   // head of the document; per-call time is the only fair comparison.
+   int calls = runs * 100;
+   reportCalls("document _id/_rev (Value)", runs,
+               timeRuns([&]() { CouchDB::parseValue(document).get("_rev").asString(); }, runs));
+   reportCalls("document _id/_rev (projected)", calls,
+               timeRuns([&]() { doc.apply(document); }, calls));
+
+   // listDocuments: every row's id, key and value.rev
+   vector<string> ids, expected;
+   collectIDs(CouchDB::parseValue(page), expected);
+
+   string rowId, rowKey, rowRev;
+   CouchDB::Projection row;
+   row.bind("id", rowId).bind("key", rowKey).bind("value.rev", rowRev);
+   CouchDB::Projection rows;
+   rows.each("rows", row, [&]() { ids.push_back(rowId); });
+
+   if(!rows.apply(page) || ids != expected)
+   {
+      cerr << "  projected rows do not match" << endl;
+      return false;
+   }
+
+   report("_all_docs rows (Value)", page.size(), runs,
+          timeRuns([&]() { ids.clear(); collectIDs(CouchDB::parseValue(page), ids); }, runs));
+   report("_all_docs rows (projected)", page.size(), runs,
+          timeRuns([&]() { ids.clear(); rows.apply(page); }, runs));
+
+   return true;
+}
+
+// ---[ SERIALIZER ]-------------------------------------------------------------
+
+// The operator<< based printer createDocument used before the writer, kept
+// for comparison.
+static void legacyPrint(ostream &out, const boost::any &value, string indent)
+{
+   string childIndent = indent + "   ";
+
+   if(value.empty())
+      out << "null";
+   else if(value.type() == typeid(string))
+      out << '"' << boost::any_cast<string>(value) << '"';
+   else if(value.type() == typeid(bool))
+      out << boost::any_cast<bool>(value);
+   else if(value.type() == typeid(int))
+      out << boost::any_cast<int>(value);
+   else if(value.type() == typeid(double))
+      out << boost::any_cast<double>(value);
+   else if(value.type() == typeid(CouchDB::Object))
+   {
+      CouchDB::Object obj = boost::any_cast<CouchDB::Object>(value);
+      out << "{";
+      for(CouchDB::Object::iterator i = obj.begin(); i != obj.end(); ++i)
+      {
+         if(i != obj.begin())
+            out << ",";
+         out << '"' << i->first << "\": ";
+         legacyPrint(out, *i->second, childIndent);
+      }
+      out << "}";
+   }
+   else if(value.type() == typeid(CouchDB::Array))
+   {
+      CouchDB::Array arr = boost::any_cast<CouchDB::Array>(value);
+      out << "[";
+      for(CouchDB::Array::iterator i = arr.begin(); i != arr.end(); ++i)
+      {
+         if(i != arr.begin())
+            out << ",";
+         legacyPrint(out, **i, childIndent);
+      }
+      out << "]";
+   }
+}
+
+static bool benchWriter(const string &name, const string &data, int runs)
+{
+   cout << name << ": serializing" << endl;
+
+   CouchDB::Variant var   = CouchDB::parseJSON(data);
+   CouchDB::Value   value = CouchDB::parseValue(data);
+
+   string json = CouchDB::toJSON(var);
+   if(!equalTrees(var, CouchDB::parseJSON(json)) ||
+      !equalTrees(var, CouchDB::parseJSON(CouchDB::toJSON(value))))
+   {
+      cerr << "  written JSON does not read back the same" << endl;
+      return false;
+   }
+
+   report("ostream printer (before)", json.size(), runs,
+          timeRuns([&]() { ostringstream out; legacyPrint(out, *var, ""); out.str(); }, runs));
+
+   string buffer;
+   report("writer, Variant", json.size(), runs,
+          timeRuns([&]() { buffer.clear(); CouchDB::writeJSON(var, buffer); }, runs));
+   report("writer, Value", json.size(), runs,
+          timeRuns([&]() { buffer.clear(); CouchDB::writeJSON(value, buffer); }, runs));
+
+   return true;
+}
+
+// ---[ TYPED BINDING ]----------------------------------------------------------
+
+static double asDouble(const boost::any &value)
+{
+   // whole numbers come back as ints
+   if(value.type() == typeid(int))
+      return boost::any_cast<int>(value);
+   return boost::any_cast<double>(value);
+}
+
+// What filling a struct from getData() looks like without the binding.
+static void fromVariant(const CouchDB::Variant &var, TextDocument &doc)
+{
+   CouchDB::Object obj = boost::any_cast<CouchDB::Object>(*var);
+   doc._id  = boost::any_cast<string>(*obj["_id"]);
+   doc._rev = boost::any_cast<string>(*obj["_rev"]);
+
+   CouchDB::Array records = boost::any_cast<CouchDB::Array>(*obj["records"]);
+   doc.records.resize(records.size());
+   for(size_t i = 0; i < records.size(); ++i)
+   {
+      CouchDB::Object rec = boost::any_cast<CouchDB::Object>(*records[i]);
+      doc.records[i].key    = boost::any_cast<int>(*rec["key"]);
+      doc.records[i].dValue = asDouble(*rec["dValue"]);
+      doc.records[i].big    = boost::any_cast<int>(*rec["big"]);
+      doc.records[i].flag   = boost::any_cast<bool>(*rec["flag"]);
+      doc.records[i].body   = boost::any_cast<string>(*rec["body"]);
+   }
+}
+
+// ... and building a document the way createRecord() in tester.cpp does.
+static CouchDB::Variant toVariant(const TextDocument &doc)
+{
+   CouchDB::Array records;
+   for(size_t i = 0; i < doc.records.size(); ++i)
+   {
+      CouchDB::Object rec;
+      rec["key"]    = CouchDB::createVariant(doc.records[i].key);
+      rec["dValue"] = CouchDB::createVariant(doc.records[i].dValue);
+      rec["big"]    = CouchDB::createVariant(doc.records[i].big);
+      rec["flag"]   = CouchDB::createVariant(doc.records[i].flag);
+      rec["body"]   = CouchDB::createVariant(doc.records[i].body);
+      records.push_back(CouchDB::createVariant(rec));
+   }
+
+   CouchDB::Object obj;
+   obj["_id"]     = CouchDB::createVariant(doc._id);
+   obj["_rev"]    = CouchDB::createVariant(doc._rev);
+   obj["records"] = CouchDB::createVariant(records);
+   return CouchDB::createVariant(obj);
+}
+
+static bool benchBinding(const string &data, int runs)
+{
+   cout << "Typed binding versus Variant" << endl;
+
+   TextDocument typed = CouchDB::fromJSON<TextDocument>(data);
+   TextDocument viaVariant;
+   fromVariant(CouchDB::parseJSON(data), viaVariant);
+
+   if(typed.records.size() != viaVariant.records.size() ||
+      typed.records.back().body != viaVariant.records.back().body ||
+      !equalTrees(CouchDB::parseJSON(CouchDB::toJSON(typed)), toVariant(typed)))
+   {
+      cerr << "  typed document does not match" << endl;
+      return false;
+   }
+
+   report("decode via Variant", data.size(), runs,
+          timeRuns([&]() { TextDocument doc; fromVariant(CouchDB::parseJSON(data), doc); }, runs));
+   report("decode typed", data.size(), runs,
+          timeRuns([&]() { CouchDB::fromJSON<TextDocument>(data); }, runs));
+
+   string buffer;
+   report("encode via Variant", data.size(), runs,
+          timeRuns([&]() { buffer.clear(); CouchDB::writeJSON(toVariant(typed), buffer); }, runs));
+   report("encode typed", data.size(), runs,
+          timeRuns([&]() { buffer.clear(); CouchDB::writeJSONAs(typed, buffer); }, runs));
+
+   return true;
+}
+
+// ---[ CONTAINERS ]-------------------------------------------------------------
+
+// Builds a Variant tree from stream events, one container insert per value,
+// as a caller assembling a tree by hand would.
+template<typename ObjectType, typename ArrayType>
+class TreeHandler : public CouchDB::JSONHandler
+{
+public:
+   const CouchDB::Variant& getRoot() const { return root; }
+
+   void null()                                 { add(CouchDB::Variant(new boost::any())); }
+   void boolean(bool value)                    { add(CouchDB::createVariant(value)); }
+   void integer(boost::int64_t value)          { add(CouchDB::createVariant((int)value)); }
+   void real(double value)                     { add(CouchDB::createVariant(value)); }
+   void string(const char *str, size_t length) { add(CouchDB::createVariant(std::string(str, length))); }
+   void key(const char *str, size_t length)    { keys.back().assign(str, length); }
+
+   void startObject()
+   {
+      CouchDB::Variant var = CouchDB::createVariant(ObjectType());
+      add(var);
+      objects.push_back(boost::any_cast<ObjectType>(var.get()));
+      arrays.push_back(NULL);
+      keys.push_back(std::string());
+   }
+
+   void startArray()
+   {
+      CouchDB::Variant var = CouchDB::createVariant(ArrayType());
+      add(var);
+      objects.push_back(NULL);
+      arrays.push_back(boost::any_cast<ArrayType>(var.get()));
+      keys.push_back(std::string());
+   }
+
+   void endObject() { pop(); }
+   void endArray()  { pop(); }
+
+private:
+   void add(const CouchDB::Variant &var)
+   {
+      if(objects.empty())
+         root = var;
+      else if(objects.back())
+         (*objects.back())[keys.back()] = var;
+      else
+         arrays.back()->push_back(var);
+   }
+
+   void pop()
+   {
+      objects.pop_back();
+      arrays.pop_back();
+      keys.pop_back();
+   }
+
+   CouchDB::Variant    root;
+   vector<ObjectType*> objects;
+   vector<ArrayType*>  arrays;
+   vector<std::string> keys;
+};
+
+template<typename ObjectType, typename ArrayType>
+static CouchDB::Variant streamTree(const std::string &data)
+{
+   TreeHandler<ObjectType, ArrayType> handler;
+   CouchDB::StreamParser parser(handler);
+   parser.feed(data);
+   parser.finish();
+   return handler.getRoot();
+}
+
+// Looks up the members of every row the way the library reads _all_docs.
+template<typename ObjectType, typename ArrayType>
+static size_t lookupRows(const CouchDB::Variant &page)
+{
+   const ObjectType &obj = *boost::any_cast<ObjectType>(page.get());
+   const ArrayType &rows = *boost::any_cast<ArrayType>(obj.find("rows")->second.get());
+
+   size_t found = 0;
+   for(typename ArrayType::const_iterator row = rows.begin(); row != rows.end(); ++row)
+   {
+      const ObjectType &rowObj = *boost::any_cast<ObjectType>(row->get());
+      const ObjectType &value  = *boost::any_cast<ObjectType>(rowObj.find("value")->second.get());
+      found += rowObj.count("id") + rowObj.count("key") + value.count("rev");
+   }
+   return found;
+}
+
+// Visits every member of every row.
+template<typename ObjectType, typename ArrayType>
+static size_t iterateRows(const CouchDB::Variant &page, const char *rowsKey)
+{
+   const ObjectType &obj = *boost::any_cast<ObjectType>(page.get());
+   const ArrayType &rows = *boost::any_cast<ArrayType>(obj.find(rowsKey)->second.get());
+
+   size_t bytes = 0;
+   for(typename ArrayType::const_iterator row = rows.begin(); row != rows.end(); ++row)
+   {
+      const ObjectType &rowObj = *boost::any_cast<ObjectType>(row->get());
+      for(typename ObjectType::const_iterator member = rowObj.begin(); member != rowObj.end(); ++member)
+         bytes += member->first.size();
+   }
+   return bytes;
+}
+
+static bool benchContainers(const string &page, const string &document, int runs)
+{
+   cout << "Containers: map/deque versus flat" << endl;
+
+   CouchDB::Variant legacyPage = streamTree<LegacyObject, LegacyArray>(page);
+   CouchDB::Variant flatPage   = streamTree<CouchDB::Object, CouchDB::Array>(page);
+   if(!equalTrees(CouchDB::parseJSON(page), flatPage) ||
+      !equalTrees(flatPage, convertTree<LegacyObject, LegacyArray, CouchDB::Object, CouchDB::Array>(legacyPage)))
+   {
+      cerr << "  container trees do not match" << endl;
+      return false;
+   }
+
+   report("_all_docs parse, map/deque", page.size(), runs,
+          timeRuns([&]() { streamTree<LegacyObject, LegacyArray>(page); }, runs));
+   report("_all_docs parse, flat", page.size(), runs,
+          timeRuns([&]() { streamTree<CouchDB::Object, CouchDB::Array>(page); }, runs));
+   report("text parse, map/deque", document.size(), runs,
+          timeRuns([&]() { streamTree<LegacyObject, LegacyArray>(document); }, runs));
+   report("text parse, flat", document.size(), runs,
+          timeRuns([&]() { streamTree<CouchDB::Object, CouchDB::Array>(document); }, runs));
+
+   CouchDB::Variant legacyDocument = streamTree<LegacyObject, LegacyArray>(document);
+   CouchDB::Variant flatDocument   = streamTree<CouchDB::Object, CouchDB::Array>(document);
+
+   size_t sink = 0;
+   report("row lookups, map/deque", page.size(), runs,
+          timeRuns([&]() { sink += lookupRows<LegacyObject, LegacyArray>(legacyPage); }, runs));
+   report("row lookups, flat", page.size(), runs,
+          timeRuns([&]() { sink += lookupRows<CouchDB::Object, CouchDB::Array>(flatPage); }, runs));
+   report("row iteration, map/deque", document.size(), runs,
+          timeRuns([&]() { sink += iterateRows<LegacyObject, LegacyArray>(legacyDocument, "records"); }, runs));
+   report("row iteration, flat", document.size(), runs,
+          timeRuns([&]() { sink += iterateRows<CouchDB::Object, CouchDB::Array>(flatDocument, "records"); }, runs));
+
+   return sink != 0;
+}
+
+// ---[ FIXED-SHAPE REPLIES ]----------------------------------------------------
+
+static bool benchReplies(const string &page, int runs)
+{
+   cout << "Fixed-shape replies" << endl;
+
+   const string write = "{\"ok\":true,\"id\":\"4d3f1f0e6e0c4a5b9d8e7f6a5b4c3d2e\","
+                        "\"rev\":\"1-967a00dff5e02add41819138abb3284d\"}";
+
+   CouchDB::WriteReply reply;
+   CouchDB::readWriteReply(write, reply);
+   if(!reply.ok || reply.id.size() != 32 || reply.rev.size() != 34)
+   {
+      cerr << "  write reply not decoded" << endl;
+      return false;
+   }
+
+   int calls = runs * 5000;
+   size_t sink = 0;
+
+   reportCalls("write reply, Variant", calls, timeRuns([&]() {
+      CouchDB::Variant var = CouchDB::parseJSON(write);
+      sink += CouchDB::get<string>(var, "rev").size() + CouchDB::get<bool>(var, "ok");
+   }, calls));
+
+   reportCalls("write reply, projected", calls, timeRuns([&]() {
+      bool ok = false;
+      string id, rev, error, reason;
+      CouchDB::Projection result;
+      result.bind("ok", ok)
+            .bind("id", id)
+            .bind("rev", rev)
+            .bind("error", error, CouchDB::Projection::BIND_OPTIONAL)
+            .bind("reason", reason, CouchDB::Projection::BIND_OPTIONAL);
+      result.apply(write);
+      sink += rev.size() + ok;
+   }, calls));
+
+   reportCalls("write reply, fixed shape", calls, timeRuns([&]() {
+      CouchDB::WriteReply result;
+      CouchDB::readWriteReply(write, result);
+      sink += result.rev.size() + result.ok;
+   }, calls));
+
+   CouchDB::DocumentList list;
+   CouchDB::readDocumentList(page, list);
+   vector<string> ids;
+   if(list.rows.size() != collectIDs(CouchDB::parseValue(page), ids) ||
+      list.rows.back().id != ids.back())
+   {
+      cerr << "  document list not decoded" << endl;
+      return false;
+   }
+
+   string id, key, rev;
+   CouchDB::Projection row;
+   row.bind("id", id)
+      .bind("key", key)
+      .bind("value.rev", rev);
+   vector<CouchDB::DocumentRow> rows;
+   CouchDB::Projection projected;
+   projected.each("rows", row, [&]() {
+      CouchDB::DocumentRow r = { id, key, rev };
+      rows.push_back(r);
+   });
+
+   report("_all_docs rows, projected", page.size(), runs,
+          timeRuns([&]() { rows.clear(); projected.apply(page); }, runs));
+   report("_all_docs rows, fixed shape", page.size(), runs,
+          timeRuns([&]() { CouchDB::DocumentList result; CouchDB::readDocumentList(page, result); }, runs));
+
+   return sink != 0;
+}
+
+int main()
+{
+#ifndef __OPTIMIZE__
+   cerr << "Warning: built without optimization, the figures below mean little" << endl;
+#endif
+   string kernel = CouchDB::getParserKernel();
+   cout << "Detected parser kernel: " << kernel << endl;
+
+   bool ok = benchParser("_all_docs, 10000 rows", createAllDocsPage(10000), 40)
+          && benchParser("text document, 2000 records", createTextDocument(2000), 40);
+
+   CouchDB::setParserKernel(kernel);
+
+   ok = ok && benchValue("_all_docs, 10000 rows", createAllDocsPage(10000), 40);
+   ok = ok && benchWriter("text document, 2000 records", createTextDocument(2000), 40);
+   ok = ok && benchBinding(createTextDocument(2000), 40);
+   ok = ok && benchContainers(createAllDocsPage(10000), createTextDocument(2000), 40);
+   ok = ok && benchProjection(createAllDocsPage(10000), createTextDocument(2000), 40);
+   ok = ok && benchReplies(createAllDocsPage(10000), 40);
+
+   return ok ? 0 : 1;
+}
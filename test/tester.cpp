@@ -69,6 +69,25 @@ static CouchDB::Variant createRecord(int key, const string &value,
    return CouchDB::createVariant(obj);
 }
 
+struct Record
+{
+   int    key;
+   string value;
+   string value2;
+   double dValue;
+};
+
+struct RecordSet
+{
+   boost::optional<string> _id;  // left out when creating a new document
+   string                  x1;
+   string                  x2;
+   vector<Record>          records;
+};
+
+COUCHDB_FIELDS(Record, (key)(value)(value2)(dValue))
+COUCHDB_FIELDS(RecordSet, (_id)(x1)(x2)(records))
+
 int main()
 {
 #ifdef WIN32
@@ -127,6 +146,17 @@ int main()
               << doc.getData() << endl
               << testDoc.getData() << endl;
 
+      RecordSet typed = db.getDocumentAs<RecordSet>(doc.getID());
+      cout << "Typed document " << *typed._id << " has " << typed.records.size()
+           << " records, first key " << typed.records[0].key << endl;
+
+      typed._id = boost::none;
+      typed.records[0].value = "T1 (typed)";
+      CouchDB::Document typedDoc = db.createDocument(typed);
+      cout << "Created typed doc: " << typedDoc << ": "
+           << typedDoc.getDataAs<RecordSet>().records[0].value << endl;
+      typedDoc.remove();
+
       cout << "Creating a version of the document with id: " << TEST_ID << endl;
       CouchDB::Document docId = db.createDocument(data, TEST_ID);
       cout << "Created new document: " << docId << endl;